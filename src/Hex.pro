@@ -1,7 +1,7 @@
 TEMPLATE  = app
 TARGET    = Hex
 CONFIG   += qt c++11
-QT       += multimedia widgets svg # core / gui included by default with "qt" in config
+QT       += concurrent multimedia widgets svg # core / gui included by default with "qt" in config
 RESOURCES = resources.qrc
 DEFINES  += HEX_VERSION_NAME=\\\"2.1\\\"
 SOURCES  += main.cpp\
@@ -38,7 +38,14 @@ SOURCES  += main.cpp\
             midiportmanager.cpp \
             trackmanagerdialog.cpp \
             trackcommands.cpp \
-            lineeditdelegate.cpp
+            lineeditdelegate.cpp \
+    notestore.cpp \
+    tracknoterenderer.cpp \
+    miditrackencoder.cpp \
+    sequencereventsource.cpp \
+    midifilereader.cpp \
+    projectfile.cpp \
+    editjournal.cpp
 HEADERS  += mainwindow.h \
             note.h \
             rtm/RtMidi.h \
@@ -86,7 +93,17 @@ HEADERS  += mainwindow.h \
     envelopedata.h \
     trackcommands.h \
     lineeditdelegate.h \
-    latticedata.h
+    latticedata.h \
+    atomicbitset.h \
+    notestore.h \
+    tracknoterenderer.h \
+    playbacktimeline.h \
+    minmaxtree.h \
+    miditrackencoder.h \
+    sequencereventsource.h \
+    midifilereader.h \
+    projectfile.h \
+    editjournal.h
 
 win32 {
     DESTDIR = build/win
@@ -7,9 +7,13 @@
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QGraphicsOpacityEffect>
 #include <QtWidgets/QGraphicsSceneMouseEvent>
+#include <QtWidgets/QGraphicsView>
 #include <QtWidgets/QLabel>
 #include <QtWidgets/QScrollBar>
 #include <QtWidgets/QUndoStack>
+#include <math.h>
+
+const int backgroundTileSize = 256; // pixels
 
 AbstractSequencerScene::AbstractSequencerScene(BarLineDrawer *barLineDrawer, QUndoStack *undoStack, QWidget *view)
     : QGraphicsScene(view),
@@ -20,7 +24,11 @@ AbstractSequencerScene::AbstractSequencerScene(BarLineDrawer *barLineDrawer, QUn
       m_snapEnabled(false),
       m_snapSize(1),
       labelFadeEffect(new QGraphicsOpacityEffect(this)),
-      fadeAnimation(new QPropertyAnimation(labelFadeEffect, "opacity"))
+      fadeAnimation(new QPropertyAnimation(labelFadeEffect, "opacity")),
+      backgroundTiles(96), // enough to cover a large screen a couple of times over
+      tileScaleX(0),
+      tileScaleY(0),
+      tileDevicePixelRatio(0)
 {
     m_label->setAttribute(Qt::WA_TransparentForMouseEvents);
     m_label->setGraphicsEffect(labelFadeEffect);
@@ -28,6 +36,30 @@ AbstractSequencerScene::AbstractSequencerScene(BarLineDrawer *barLineDrawer, QUn
     labelFadeEffect->setOpacity(0);
 }
 
+const QPixmap &AbstractSequencerScene::backgroundTile(int column, int row)
+{
+    quint64 key = (static_cast<quint64>(static_cast<quint32>(column)) << 32) | static_cast<quint32>(row);
+    QPixmap *tile = backgroundTiles.object(key);
+
+    if (tile != NULL)
+        return *tile;
+
+    // the tile covers backgroundTileSize logical pixels, but has as many device pixels as the screen does
+    tile = new QPixmap(QSize(backgroundTileSize, backgroundTileSize) * tileDevicePixelRatio);
+    tile->setDevicePixelRatio(tileDevicePixelRatio);
+    tile->fill(Qt::transparent); // the view's background shows through
+
+    QPainter tilePainter(tile);
+    tilePainter.translate(-column * backgroundTileSize, -row * backgroundTileSize);
+    tilePainter.scale(tileScaleX, tileScaleY);
+    QRectF tileRect(0, 0, backgroundTileSize, backgroundTileSize);
+    drawStaticBackground(&tilePainter, tilePainter.transform().inverted().mapRect(tileRect.adjusted(-1, -1, 1, 1))); // a little extra so nothing is lost at the seams
+    tilePainter.end();
+
+    backgroundTiles.insert(key, tile);
+    return *tile;
+}
+
 void AbstractSequencerScene::copy()
 {
     QByteArray itemData;
@@ -41,6 +73,19 @@ void AbstractSequencerScene::copy()
     QApplication::clipboard()->setMimeData(mimeData);
 }
 
+QRectF AbstractSequencerScene::cursorRect() const
+{
+    if (views().isEmpty())
+        return sceneRect();
+
+    // the cursor pen is cosmetic, so its width is in pixels; a pixel more on each side covers rounding
+    const QGraphicsView *view = views().first();
+    double width = (qMax(cursorPen.widthF(), 1.) + 2) / view->transform().m11();
+    QRectF visibleRect(view->mapToScene(view->viewport()->rect()).boundingRect());
+
+    return QRectF(m_cursorPos - width * .5, visibleRect.top(), width, visibleRect.height());
+}
+
 void AbstractSequencerScene::cut()
 {
     copy();
@@ -60,6 +105,47 @@ void AbstractSequencerScene::deleteSelectedItems()
 }
 
 void AbstractSequencerScene::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    QTransform transform(painter->worldTransform());
+    qreal devicePixelRatio = painter->device()->devicePixelRatioF();
+
+    // the views never rotate, but just in case
+    if (transform.type() > QTransform::TxScale)
+    {
+        drawStaticBackground(painter, rect);
+        return;
+    }
+
+    // the tiles are only good for the scale and screen they were drawn for (e.g., not after moving to a HiDPI screen)
+    if (transform.m11() != tileScaleX || transform.m22() != tileScaleY || devicePixelRatio != tileDevicePixelRatio)
+    {
+        backgroundTiles.clear();
+        tileScaleX = transform.m11();
+        tileScaleY = transform.m22();
+        tileDevicePixelRatio = devicePixelRatio;
+    }
+
+    // the view scrolls by whole pixels, so the tiles can be drawn without any scaling or smoothing
+    double dx = qRound(transform.dx());
+    double dy = qRound(transform.dy());
+    QRectF tileSpaceRect(QTransform::fromScale(tileScaleX, tileScaleY).mapRect(rect));
+    int firstColumn = floor(tileSpaceRect.left() / backgroundTileSize);
+    int lastColumn = floor(tileSpaceRect.right() / backgroundTileSize);
+    int firstRow = floor(tileSpaceRect.top() / backgroundTileSize);
+    int lastRow = floor(tileSpaceRect.bottom() / backgroundTileSize);
+
+    painter->setWorldTransform(QTransform::fromTranslate(dx, dy));
+
+    for (int row = firstRow; row <= lastRow; ++row)
+    {
+        for (int column = firstColumn; column <= lastColumn; ++column)
+            painter->drawPixmap(column * backgroundTileSize, row * backgroundTileSize, backgroundTile(column, row));
+    }
+
+    painter->setWorldTransform(transform);
+}
+
+void AbstractSequencerScene::drawBarLines(QPainter *painter, const QRectF &rect)
 {
     barLineDrawer->drawBarLines(painter, rect);
 }
@@ -85,9 +171,15 @@ void AbstractSequencerScene::fadeLabelOut()
     fadeAnimation->start();
 }
 
+void AbstractSequencerScene::invalidateBackgroundCache()
+{
+    backgroundTiles.clear();
+    update();
+}
+
 void AbstractSequencerScene::paste()
 {
-    clearSelection();
+    deselectAll();
 
     QByteArray pastedData(QApplication::clipboard()->mimeData()->data(mimeType()));
 
@@ -99,10 +191,15 @@ void AbstractSequencerScene::paste()
     int numItems;
     stream >> numItems;
 
-    if (numItems == 0)
+    if (numItems <= 0)
         return;
 
-    undoStack->push(pasteCommand(stream, numItems));
+    QUndoCommand *command = pasteCommand(stream, numItems);
+
+    if (command == NULL)
+        return; // e.g., the clipboard came from an older version of Hex
+
+    undoStack->push(command);
 }
 
 void AbstractSequencerScene::pushUndoCommand(QUndoCommand *command)
@@ -116,6 +213,17 @@ void AbstractSequencerScene::roundSetAndEmitCursorPos(unsigned int pos)
     emit cursorMoved(m_cursorPos);
 }
 
+void AbstractSequencerScene::setCursorPos(double pos)
+{
+    if (pos == m_cursorPos)
+        return;
+
+    // only the columns under the old and new cursor positions need repainting
+    update(cursorRect());
+    m_cursorPos = pos;
+    update(cursorRect());
+}
+
 void AbstractSequencerScene::setLength(double length)
 {
     setSceneRect(0, sceneRect().top(), length, sceneRect().height());
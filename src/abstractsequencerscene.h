@@ -1,5 +1,7 @@
 #ifndef ABSTRACTSEQUENCERSCENE_H
 #define ABSTRACTSEQUENCERSCENE_H
+#include <QtCore/QCache>
+#include <QtGui/QPixmap>
 #include <QtWidgets/QGraphicsScene>
 
 class BarLineDrawer;
@@ -20,12 +22,15 @@ public:
     void deleteSelectedItems();
     void fadeLabelIn();
     void fadeLabelOut();
+    void invalidateBackgroundCache(); // call whenever anything drawn by drawStaticBackground() changes (other than the zoom)
     void paste();
     void pushUndoCommand(QUndoCommand *command);
+    void setCursorPos(double pos);
     void setLabelText(const QString &string);
     void setLength(double length);
     void setTopAndHeight(double top, double height);
 
+    virtual void deselectAll() {clearSelection();}
     virtual void selectAll() = 0;
 
     // inline methods
@@ -35,7 +40,6 @@ public:
     unsigned int roundToLowerSnapPos(unsigned int xPos) const {return (m_snapEnabled) ? xPos / static_cast<unsigned int>(m_snapSize) * m_snapSize : xPos;}
     unsigned int roundToNearestSnapPos(unsigned int xPos) const {return (m_snapEnabled) ? ((xPos + m_snapSize / 2 ) / m_snapSize) * m_snapSize : xPos;}
     void setCursorPen(const QPen &pen) {cursorPen = pen; update();}
-    void setCursorPos(double pos) {m_cursorPos = pos; update();}
     void setSnapSize(double size) {m_snapSize = size;}
     void setSnapToGrid(bool on) {m_snapEnabled = on;}
     double snapSize() const {return m_snapSize;}
@@ -44,15 +48,25 @@ signals:
     void cursorMoved(double pos);
 
 protected:
-    void drawBackground(QPainter *painter, const QRectF &rect); // draws bar lines
+    void drawBackground(QPainter *painter, const QRectF &rect); // draws the static background from cached tiles
+    void drawBarLines(QPainter *painter, const QRectF &rect);
     void drawForeground(QPainter *painter, const QRectF &rect); // draws cursor
     void roundSetAndEmitCursorPos(unsigned int pos);
 
 private:
+    // The parts of the background that only change when the view zooms or the
+    // project changes are drawn into pixmap tiles, so that repainting (e.g.,
+    // for each cursor move during playback) only has to blit them. The tiles
+    // are laid out in the view's logical pixels from the scene's origin, so
+    // scrolling reuses them, and have the screen's device pixel ratio.
+    const QPixmap &backgroundTile(int column, int row);
+    QRectF cursorRect() const; // the area the cursor covers in the view
+    virtual void drawStaticBackground(QPainter *painter, const QRectF &rect) {drawBarLines(painter, rect);}
+
     virtual bool copyImplementation(QDataStream &stream) = 0;
     virtual QUndoCommand *deleteCommand() = 0;
     virtual QString mimeType() const = 0;
-    virtual QUndoCommand *pasteCommand(QDataStream &stream, int numItems) = 0;
+    virtual QUndoCommand *pasteCommand(QDataStream &stream, int numItems) = 0; // returns 0 if the items can't be read
 
     // these are initialized in the initializer list
     BarLineDrawer *barLineDrawer;
@@ -65,6 +79,10 @@ private:
     QPropertyAnimation *fadeAnimation;
 
     QPen cursorPen;
+    QCache<quint64, QPixmap> backgroundTiles;
+    double tileScaleX;
+    double tileScaleY;
+    qreal tileDevicePixelRatio;
 };
 
 #endif
@@ -0,0 +1,89 @@
+#ifndef ATOMICBITSET_H
+#define ATOMICBITSET_H
+#include <QtCore/QtAlgorithms>
+#include <atomic>
+
+// A fixed-size set of integers in [0, numBits). Inserting and removing are
+// lock-free, so one thread (e.g., MIDI input) can modify the set while
+// another (e.g., the GUI) iterates over it. Iteration goes a word at a time:
+//     for (int i = set.first(); i != -1; i = set.next(i))
+
+template <int numBits>
+class AtomicBitset
+{
+public:
+    AtomicBitset()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (int i = 0; i < numWords; ++i)
+            words[i].store(0, std::memory_order_relaxed);
+    }
+
+    bool contains(int bit) const
+    {
+        return (words[bit / bitsPerWord].load(std::memory_order_acquire) & mask(bit)) != 0;
+    }
+
+    // returns true if the bit was not already set
+    bool insert(int bit)
+    {
+        return (words[bit / bitsPerWord].fetch_or(mask(bit), std::memory_order_acq_rel) & mask(bit)) == 0;
+    }
+
+    // returns true if the bit was set
+    bool remove(int bit)
+    {
+        return (words[bit / bitsPerWord].fetch_and(~mask(bit), std::memory_order_acq_rel) & mask(bit)) != 0;
+    }
+
+    int count() const
+    {
+        int total = 0;
+
+        for (int i = 0; i < numWords; ++i)
+            total += qPopulationCount(words[i].load(std::memory_order_acquire));
+
+        return total;
+    }
+
+    int first() const
+    {
+        return next(-1);
+    }
+
+    // returns the smallest member greater than bit, or -1 if there is none
+    int next(int bit) const
+    {
+        ++bit;
+
+        if (bit >= numBits)
+            return -1;
+
+        int wordIndex = bit / bitsPerWord;
+        quint32 word = words[wordIndex].load(std::memory_order_acquire) & (~quint32(0) << (bit % bitsPerWord));
+
+        while (word == 0)
+        {
+            if (++wordIndex == numWords)
+                return -1;
+
+            word = words[wordIndex].load(std::memory_order_acquire);
+        }
+
+        return wordIndex * bitsPerWord + qCountTrailingZeroBits(word);
+    }
+
+private:
+    static const int bitsPerWord = 32;
+    static const int numWords = (numBits + bitsPerWord - 1) / bitsPerWord;
+
+    static quint32 mask(int bit) {return quint32(1) << (bit % bitsPerWord);}
+
+    std::atomic<quint32> words[numWords];
+};
+
+#endif
@@ -5,7 +5,7 @@ const double sqrt3Over2 = sqrt(3.0) * .5;
 const double spacingConstant = pow(2., .5) / pow(3., .75);
 
 ButtonShapeCalculator::ButtonShapeCalculator(double size, Shape shape)
-    : spacing (size * spacingConstant), rightCoord(spacing * sqrt3Over2)
+    : shape(shape), spacing(size * spacingConstant), rightCoord(spacing * sqrt3Over2)
 {
     switch (shape)
     {
@@ -21,6 +21,25 @@ ButtonShapeCalculator::ButtonShapeCalculator(double size, Shape shape)
     }
 }
 
+bool ButtonShapeCalculator::contains(const QPointF &point) const
+{
+    // closed-form versions of path.contains(), which is far too slow for hit testing
+    double x = fabs(point.x());
+    double y = fabs(point.y());
+
+    switch (shape)
+    {
+    case Hexagon: // the slanted edges run from (0, spacing) to (rightCoord, spacing / 2)
+        return x <= rightCoord && y <= spacing - x * (spacing * .5 / rightCoord);
+    case Ellipse:
+        return x * x + y * y <= rightCoord * rightCoord;
+    case Square:
+        return x <= rightCoord && y <= rightCoord * sqrt3Over2;
+    }
+
+    return false;
+}
+
 void ButtonShapeCalculator::calculateEllipse()
 {
     rect = QRectF(-rightCoord, -rightCoord, rightCoord * 2, rightCoord * 2);
@@ -7,7 +7,8 @@ class ButtonShapeCalculator
 public:
     enum Shape {Hexagon, Ellipse, Square};
 
-    ButtonShapeCalculator(double size, Shape shape);
+    ButtonShapeCalculator(double size = 1, Shape shape = Hexagon);
+    bool contains(const QPointF &point) const; // point is relative to the button's center
     QRectF buttonBoundingRect() const {return rect;}
     QPainterPath buttonPath() const {return path;}
 
@@ -17,6 +18,7 @@ private:
     void calculateSquare();
 
     // these are initialized in the initializer list
+    Shape shape;
     double spacing;
     double rightCoord;
 
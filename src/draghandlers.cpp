@@ -27,16 +27,17 @@ void DragHandler::onMouseRelease()
         onUndraggedMouseReleaseDerived();
 }
 
-NoteDragHandler::NoteDragHandler(QGraphicsItem *note)
+NoteDragHandler::NoteDragHandler(Note *note)
     : scene(static_cast<SequencerScene*>(note->scene())),
-      draggedItem(note)
+      draggedNote(note->id()),
+      selectedNotes(scene->selectedNotes())
 {
 }
 
 void NoteDragHandler::onUndraggedMouseReleaseDerived()
 {
-    scene->clearSelection();
-    draggedItem->setSelected(true);
+    scene->deselectAll();
+    scene->setNoteSelected(draggedNote, true);
     scene->fadeLabelOut();
 }
 
@@ -202,38 +203,38 @@ void NodeMover::updateLabel()
 // ###########################################################################
 // ###########################################################################
 
-HorizontalNoteMover::HorizontalNoteMover(QGraphicsItem *note, double initialClickXOffset)
+HorizontalNoteMover::HorizontalNoteMover(Note *note, double initialClickXOffset)
     : NoteDragHandler(note),
       initialClickXOffset(initialClickXOffset),
-      notesToMove(scene->selectedItems()),
-      initialPositions(notesToMove.size())
+      draggedNoteInitialXPos(scene->note(draggedNote).start)
 {
-    // find leftmost note's x position, and create array of initial positions
-    double leftmostNoteXPos = draggedItem->pos().x();
-    for (int i = 0; i < notesToMove.size(); ++i)
+    // find leftmost note's x position
+    double leftmostNoteXPos = draggedNoteInitialXPos;
+    for (int i = 0; i < selectedNotes.size(); ++i)
     {
-        initialPositions.appendByValue(notesToMove[i]->pos().x());
-        leftmostNoteXPos = (leftmostNoteXPos < notesToMove[i]->pos().x()) ? leftmostNoteXPos : notesToMove[i]->pos().x();
+        double xPos = scene->note(selectedNotes[i]).start;
+        leftmostNoteXPos = (leftmostNoteXPos < xPos) ? leftmostNoteXPos : xPos;
     }
 
-    minXPos = initialClickXOffset + draggedItem->pos().x() - leftmostNoteXPos;
+    minXPos = initialClickXOffset + draggedNoteInitialXPos - leftmostNoteXPos;
 }
 
 void HorizontalNoteMover::onMouseDragDerived(QGraphicsSceneMouseEvent *event)
 {
-    double draggedItemOldXPos = draggedItem->pos().x();
+    double draggedItemOldXPos = scene->note(draggedNote).start;
     double xOffset = ((event->scenePos().x() < minXPos) ? minXPos : event->scenePos().x()) - (draggedItemOldXPos + initialClickXOffset);
     double draggedItemNewPos = scene->roundToNearestSnapPos(draggedItemOldXPos + xOffset);
     double adjustedXOffset = draggedItemNewPos - draggedItemOldXPos;
-    for (int i = 0; i < notesToMove.size(); ++i)
+    for (int i = 0; i < selectedNotes.size(); ++i)
     {
-        notesToMove[i]->setX(notesToMove[i]->pos().x() + adjustedXOffset);
+        scene->setNoteStart(selectedNotes[i], scene->note(selectedNotes[i]).start + adjustedXOffset);
     }
 }
 
 void HorizontalNoteMover::onDraggedMouseReleaseDerived()
 {
-    scene->pushUndoCommand(new MoveNotesHorizontallyCommand(notesToMove, initialPositions));
+    double xOffset = scene->note(draggedNote).start - draggedNoteInitialXPos;
+    scene->pushUndoCommand(new MoveNotesHorizontallyCommand(selectedNotes, xOffset, scene));
 }
 
 // ###########################################################################
@@ -242,43 +243,41 @@ void HorizontalNoteMover::onDraggedMouseReleaseDerived()
 NoteMover::NoteMover(Note *note, double initialClickXOffset)
     : NoteDragHandler(note),
       initialClickXOffset(initialClickXOffset),
-      initialNoteLaneIndex(static_cast<Note*>(note)->getLaneIndex()),
-      notesToMove(scene->selectedItems()),
-      initialPositions(notesToMove.size())
+      draggedNoteInitialXPos(scene->note(draggedNote).start),
+      initialNoteLaneIndex(scene->note(draggedNote).laneIndex)
 {
-    // find leftmost note's x position, and create array of initial positions
-    double leftmostNoteXPos = note->pos().x();
+    // find leftmost note's x position
+    double leftmostNoteXPos = draggedNoteInitialXPos;
 
-    for (int i = 0; i < notesToMove.size(); ++i)
+    for (int i = 0; i < selectedNotes.size(); ++i)
     {
-        initialPositions.appendByValue(notesToMove[i]->pos().x());
-        leftmostNoteXPos = (leftmostNoteXPos < notesToMove[i]->pos().x()) ? leftmostNoteXPos : notesToMove[i]->pos().x();
+        double xPos = scene->note(selectedNotes[i]).start;
+        leftmostNoteXPos = (leftmostNoteXPos < xPos) ? leftmostNoteXPos : xPos;
     }
 
-    minXPos = initialClickXOffset + note->pos().x() - leftmostNoteXPos;
+    minXPos = initialClickXOffset + draggedNoteInitialXPos - leftmostNoteXPos;
 }
 
 void NoteMover::onMouseDragDerived(QGraphicsSceneMouseEvent *event)
 {
     int closestNoteLane = scene->findClosestNoteLane(event->scenePos().y());
 
-    double draggedItemOldXPos = draggedItem->pos().x();
+    double draggedItemOldXPos = scene->note(draggedNote).start;
     double xOffset = ((event->scenePos().x() < minXPos) ? minXPos : event->scenePos().x()) - (draggedItemOldXPos + initialClickXOffset);
     double draggedItemNewPos = scene->roundToNearestSnapPos(draggedItemOldXPos + xOffset);
     double adjustedXOffset = draggedItemNewPos - draggedItemOldXPos;
 
-    for (int i = 0; i < notesToMove.size(); ++i)
+    for (int i = 0; i < selectedNotes.size(); ++i)
     {
-        static_cast<Note*>(notesToMove[i])->setLaneIndex(closestNoteLane);
-        notesToMove[i]->setX(notesToMove[i]->pos().x() + adjustedXOffset);
+        scene->setNoteLaneIndex(selectedNotes[i], closestNoteLane);
+        scene->setNoteStart(selectedNotes[i], scene->note(selectedNotes[i]).start + adjustedXOffset);
     }
-
-    scene->updateNotePositions();
 }
 
 void NoteMover::onDraggedMouseReleaseDerived()
 {
-    scene->pushUndoCommand(new MoveNotesCommand(notesToMove, initialPositions, initialNoteLaneIndex));
+    double xOffset = scene->note(draggedNote).start - draggedNoteInitialXPos;
+    scene->pushUndoCommand(new MoveNotesCommand(selectedNotes, xOffset, initialNoteLaneIndex, scene->note(draggedNote).laneIndex, scene));
 }
 
 // ###########################################################################
@@ -286,17 +285,16 @@ void NoteMover::onDraggedMouseReleaseDerived()
 
 NoteResizer::NoteResizer(Note *note)
     : NoteDragHandler(note),
-      notesToResize(scene->selectedItems()),
-      initialLengths(notesToResize.size())
+      initialLengths(selectedNotes.size())
 {
     double lengthOfShortestNote = scene->sceneRect().width(); // initialize to some huge value
-    for (int i = 0; i < notesToResize.size(); ++i)
+    for (int i = 0; i < selectedNotes.size(); ++i)
     {
-        initialLengths.appendByValue(notesToResize[i]->boundingRect().width());
+        initialLengths.append(scene->note(selectedNotes[i]).duration);
         lengthOfShortestNote = (lengthOfShortestNote < initialLengths[i]) ? lengthOfShortestNote : initialLengths[i];
     }
 
-    draggedNoteOldEndPos = draggedItem->boundingRect().width() + draggedItem->pos().x();
+    draggedNoteOldEndPos = scene->note(draggedNote).duration + scene->note(draggedNote).start;
     minXPos = draggedNoteOldEndPos - lengthOfShortestNote + scene->getCurrentSnap();
 }
 
@@ -305,15 +303,16 @@ void NoteResizer::onMouseDragDerived(QGraphicsSceneMouseEvent *event)
     double eventPosX = scene->roundToNearestSnapPos(event->scenePos().x());
     double noteLengthDifference = ((eventPosX < minXPos) ? minXPos : eventPosX) - draggedNoteOldEndPos;
 
-    for (int i = 0; i < notesToResize.size(); ++i)
+    for (int i = 0; i < selectedNotes.size(); ++i)
     {
-        static_cast<Note*>(notesToResize[i])->setWidth(initialLengths[i] + noteLengthDifference);
+        scene->setNoteDuration(selectedNotes[i], initialLengths[i] + noteLengthDifference);
     }
 }
 
 void NoteResizer::onDraggedMouseReleaseDerived()
 {
-    scene->pushUndoCommand(new ResizeNotesCommand(notesToResize, initialLengths));
+    double lengthDifference = scene->note(draggedNote).duration + scene->note(draggedNote).start - draggedNoteOldEndPos;
+    scene->pushUndoCommand(new ResizeNotesCommand(selectedNotes, lengthDifference, scene));
 }
 
 // ###########################################################################
@@ -321,17 +320,16 @@ void NoteResizer::onDraggedMouseReleaseDerived()
 
 NoteVelocityAdjuster::NoteVelocityAdjuster(Note *note, double initialClickYOffset)
     : NoteDragHandler(note),
-      clickedNoteInitialVelocity(note->getVelocity()),
+      clickedNoteInitialVelocity(scene->note(draggedNote).velocity),
       initialClickYOffset(initialClickYOffset),
-      notes(scene->selectedItems()),
-      initialVelocities(notes.size())
+      initialVelocities(selectedNotes.size())
 {
     scene->setLabelText(QObject::tr("Velocity: ") + QString::number(clickedNoteInitialVelocity));
     scene->fadeLabelIn();
 
-    for (int i = 0; i < notes.size(); ++i)
+    for (int i = 0; i < selectedNotes.size(); ++i)
     {
-        initialVelocities.appendByValue(static_cast<Note*>(notes[i])->getVelocity());
+        initialVelocities.append(scene->note(selectedNotes[i]).velocity);
     }
 }
 
@@ -345,12 +343,12 @@ void NoteVelocityAdjuster::onMouseDragDerived(QGraphicsSceneMouseEvent *event)
     else if (newVelocity < 0)
         newVelocity = 0;
 
-    if (newVelocity == static_cast<Note *>(draggedItem)->getVelocity())
+    if (newVelocity == scene->note(draggedNote).velocity)
         return;
 
-    for (int i = 0; i < notes.size(); ++i)
+    for (int i = 0; i < selectedNotes.size(); ++i)
     {
-        static_cast<Note *>(notes[i])->setVelocity(newVelocity);
+        scene->setNoteVelocity(selectedNotes[i], newVelocity);
     }
 
     scene->setLabelText(QObject::tr("Velocity: ") + QString::number(newVelocity));
@@ -358,8 +356,9 @@ void NoteVelocityAdjuster::onMouseDragDerived(QGraphicsSceneMouseEvent *event)
 
 void NoteVelocityAdjuster::onDraggedMouseReleaseDerived()
 {
-    scene->setDefaultVelocity(static_cast<Note*>(notes[0])->getVelocity());
-    scene->pushUndoCommand(new ChangeNoteVelocitiesCommand(notes, initialVelocities));
+    unsigned char newVelocity = scene->note(draggedNote).velocity;
+    scene->setDefaultVelocity(newVelocity);
+    scene->pushUndoCommand(new ChangeNoteVelocitiesCommand(selectedNotes, initialVelocities, newVelocity, scene));
     scene->fadeLabelOut();
 }
 
@@ -1,12 +1,12 @@
 #ifndef DRAGHANDLERS_H
 #define DRAGHANDLERS_H
+#include "notestore.h"
 #include "simplemap.h"
 #include "simplevector.h"
 #include <QtCore/QPointF>
 
 class EnvelopeScene;
 class Note;
-class QGraphicsItem;
 class QGraphicsSceneMouseEvent;
 class SequencerScene;
 class TrackManagerDialog;
@@ -35,11 +35,12 @@ private:
 class NoteDragHandler : public DragHandler
 {
 public:
-    NoteDragHandler(QGraphicsItem *note);
+    NoteDragHandler(Note *note);
 
 protected:
     SequencerScene *scene;
-    QGraphicsItem *draggedItem;
+    NoteID draggedNote;
+    SimpleVector<NoteID> selectedNotes; // in ascending order
 
 private:
     void onUndraggedMouseReleaseDerived();
@@ -78,15 +79,14 @@ private:
 class HorizontalNoteMover : public NoteDragHandler
 {
 public:
-    HorizontalNoteMover(QGraphicsItem *thisNote, double initialClickXOffset);
+    HorizontalNoteMover(Note *thisNote, double initialClickXOffset);
 
 private:
     void onMouseDragDerived(QGraphicsSceneMouseEvent *event);
     void onDraggedMouseReleaseDerived();
 
     double initialClickXOffset;
-    SimpleVector<QGraphicsItem*> notesToMove;
-    SimpleVector<float> initialPositions;
+    double draggedNoteInitialXPos;
     double minXPos;
 };
 
@@ -103,9 +103,8 @@ private:
     void onDraggedMouseReleaseDerived();
 
     double initialClickXOffset;
+    double draggedNoteInitialXPos;
     unsigned short int initialNoteLaneIndex;
-    SimpleVector<QGraphicsItem*> notesToMove;
-    SimpleVector<float> initialPositions;
     double minXPos; // used to ensure note's aren't dragged too far left
 };
 
@@ -122,8 +121,7 @@ private:
     void onDraggedMouseReleaseDerived();
 
     double draggedNoteOldEndPos;
-    SimpleVector<QGraphicsItem*> notesToResize;
-    SimpleVector<float> initialLengths;
+    SimpleVector<double> initialLengths;
     double minXPos;
 };
 
@@ -141,7 +139,6 @@ private:
 
     unsigned char clickedNoteInitialVelocity;
     double initialClickYOffset;
-    SimpleVector<QGraphicsItem *> notes;
     SimpleVector<unsigned char> initialVelocities;
 };
 
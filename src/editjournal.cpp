@@ -0,0 +1,626 @@
+#include "editjournal.h"
+#include "sequencerscene.h"
+#include "trackmanagerdialog.h"
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QDataStream>
+#include <QtCore/QSaveFile>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
+#include <string.h>
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const char journalMagic[] = "HXJ1";
+static const int headerSize = 5; // the magic and the base
+static const int frameHeaderSize = 6; // the size of the records and their checksum
+
+static bool syncToDisk(QFile &file)
+{
+    if (!file.flush())
+        return false;
+
+#ifdef Q_OS_WIN
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
+static quint32 frameSize(const QByteArray &journal, int pos)
+{
+    QDataStream in(journal.mid(pos, 4));
+    quint32 size;
+    in >> size;
+    return size;
+}
+
+// the length of the header and the frames that were written completely
+static int intactLength(const QByteArray &journal)
+{
+    if (journal.size() < headerSize || !journal.startsWith(journalMagic))
+        return 0;
+
+    int pos = headerSize;
+    while (journal.size() - pos >= frameHeaderSize)
+    {
+        QDataStream in(journal.mid(pos, frameHeaderSize));
+        quint32 size;
+        quint16 checksum;
+        in >> size >> checksum;
+
+        if (size > static_cast<quint32>(journal.size() - pos - frameHeaderSize)
+                || qChecksum(journal.constData() + pos + frameHeaderSize, size) != checksum)
+            break;
+
+        pos += frameHeaderSize + size;
+    }
+
+    return pos;
+}
+
+EditJournal::EditJournal(SequencerScene *sequencerScene, TrackManagerDialog *trackManager, QObject *parent)
+    : QObject(parent),
+      sequencerScene(sequencerScene),
+      trackManager(trackManager),
+      writeFailed(false),
+      recording(false),
+      base(ProjectBase),
+      journalSize(0),
+      compactionRequested(false),
+      commandNeedsBarrier(false)
+{
+    pendingRebase.inProgress = false;
+
+    flushTimer = new QTimer(this);
+    flushTimer->setSingleShot(true);
+    flushTimer->setInterval(flushIntervalMilliseconds);
+    connect(flushTimer, &QTimer::timeout, this, &EditJournal::flush);
+
+    writer = new QThreadPool(this);
+    writer->setMaxThreadCount(1);
+}
+
+EditJournal::~EditJournal()
+{
+    flush(); // the journal is kept, since nobody said to discard it
+    waitForWrites();
+}
+
+// a journal with a gap in it would replay the wrong edits, so it's better to have none
+void EditJournal::abandon()
+{
+    QString journalPath(file.fileName());
+    file.close();
+    QFile::remove(journalPath);
+    writeFailed = true;
+}
+
+void EditJournal::append(const QByteArray &frames)
+{
+    if (!file.isOpen())
+        return; // an earlier write failed, so there's no journal until it starts over
+
+    if (file.write(frames) != frames.size() || !syncToDisk(file))
+        abandon();
+}
+
+bool EditJournal::applyRecord(QDataStream &in)
+{
+    quint8 type;
+    in >> type;
+
+    if (type == BarrierRecord)
+        return false;
+
+    if (type == NoteInsertedRecord || type == NoteRemovedRecord || type == NoteChangedRecord)
+    {
+        quint8 track, velocity;
+        double start, duration;
+        quint16 laneIndex;
+        in >> track >> start >> duration >> laneIndex >> velocity;
+
+        if (in.status() != QDataStream::Ok || track >= trackManager->numTracks() || laneIndex >= HexSettings::numButtons || velocity > 127)
+            return false;
+
+        if (type == NoteInsertedRecord)
+        {
+            NoteID id = sequencerScene->createNote(start, duration, laneIndex, velocity, track);
+            if (id == invalidNoteID)
+                return false; // the note store is full
+
+            sequencerScene->insertNote(id);
+            replayedNotes.insert(noteKey(track, laneIndex, start), id);
+            return true;
+        }
+
+        NoteID id = findNote(track, start, duration, laneIndex, velocity);
+        if (id == invalidNoteID)
+            return false;
+
+        replayedNotes.remove(noteKey(track, laneIndex, start), id);
+
+        if (type == NoteRemovedRecord)
+        {
+            sequencerScene->releaseNote(id);
+            return true;
+        }
+
+        in >> start >> duration >> laneIndex >> velocity;
+        if (in.status() != QDataStream::Ok || laneIndex >= HexSettings::numButtons || velocity > 127)
+            return false;
+
+        sequencerScene->setNoteStart(id, start);
+        sequencerScene->setNoteDuration(id, duration);
+        sequencerScene->setNoteLaneIndex(id, laneIndex);
+        sequencerScene->setNoteVelocity(id, velocity);
+        replayedNotes.insert(noteKey(track, laneIndex, start), id);
+        return true;
+    }
+
+    qint8 track;
+    quint8 envelope;
+    quint32 pos;
+    in >> track >> envelope >> pos;
+
+    int numEnvelopes = (track == -1) ? TrackManagerDialog::numGlobalEnvelopes : trackManager->numMIDICCEnvelopes(track);
+    if (in.status() != QDataStream::Ok || track < -1 || track >= trackManager->numTracks() || envelope >= numEnvelopes)
+        return false;
+
+    switch (type)
+    {
+    case NodeAddedRecord:
+    {
+        float value;
+        in >> value;
+        trackManager->addNode(track, envelope, pos, value);
+        break;
+    }
+    case NodeMovedRecord:
+    {
+        // nodes can't cross each other when they're moved, so removing and adding it comes to the same thing
+        quint32 newPos;
+        float newValue;
+        in >> newPos >> newValue;
+        trackManager->removeNode(track, envelope, pos);
+        trackManager->addNode(track, envelope, newPos, newValue);
+        break;
+    }
+    case NodeRemovedRecord:
+        trackManager->removeNode(track, envelope, pos);
+        break;
+    default:
+        return false;
+    }
+
+    return in.status() == QDataStream::Ok;
+}
+
+QString EditJournal::baseFilePath(const QString &projectFilePath)
+{
+    QFile journal(journalFilePath(projectFilePath));
+    if (!journal.open(QIODevice::ReadOnly))
+        return QString();
+
+    QByteArray journalHeader(journal.read(headerSize));
+    if (journalHeader.size() != headerSize || !journalHeader.startsWith(journalMagic))
+        return QString();
+
+    if (journal.size() == headerSize)
+        return QString(); // no edits since the journal started
+
+    Base base = static_cast<Base>(journalHeader.at(4));
+    QString filePath(base == ProjectBase ? projectFilePath : recoveryFilePath(projectFilePath, base));
+
+    return QFile::exists(filePath) ? filePath : QString();
+}
+
+QString EditJournal::beginRebase(const QString &newProjectFilePath, bool toRecoveryFile)
+{
+    endCommand();
+
+    pendingRebase.inProgress = true;
+    pendingRebase.carriedFrames.clear();
+    pendingRebase.projectFilePath = newProjectFilePath;
+
+    if (!toRecoveryFile)
+    {
+        pendingRebase.base = ProjectBase;
+        return newProjectFilePath;
+    }
+
+    compactionRequested = false;
+    pendingRebase.base = (base == RecoveryBaseA) ? RecoveryBaseB : RecoveryBaseA;
+    return recoveryFilePath(newProjectFilePath, pendingRebase.base);
+}
+
+void EditJournal::endCommand()
+{
+    writePendingChanges();
+
+    if (commandNeedsBarrier)
+    {
+        commandRecords.prepend(static_cast<char>(BarrierRecord));
+        commandNeedsBarrier = false;
+    }
+
+    if (commandRecords.isEmpty())
+        return;
+
+    QByteArray frame;
+    QDataStream out(&frame, QIODevice::WriteOnly);
+    out.setVersion(13);
+    out << quint32(commandRecords.size()) << qChecksum(commandRecords.constData(), commandRecords.size());
+    out.writeRawData(commandRecords.constData(), commandRecords.size());
+    commandRecords.clear();
+
+    unwrittenFrames.append(frame);
+    journalSize += frame.size();
+
+    if (pendingRebase.inProgress)
+        pendingRebase.carriedFrames.append(frame);
+
+    if (!flushTimer->isActive())
+        flushTimer->start();
+}
+
+NoteID EditJournal::findNote(int track, double start, double duration, unsigned short laneIndex, unsigned char velocity) const
+{
+    uint key = noteKey(track, laneIndex, start);
+
+    for (QMultiHash<uint, NoteID>::const_iterator it = replayedNotes.find(key); it != replayedNotes.end() && it.key() == key; ++it)
+    {
+        const NoteRecord &note = sequencerScene->note(it.value());
+
+        if (note.track == track && note.start == start && note.duration == duration && note.laneIndex == laneIndex && note.velocity == velocity)
+            return it.value();
+    }
+
+    return invalidNoteID;
+}
+
+void EditJournal::finishRebase(bool succeeded)
+{
+    endCommand();
+    const Rebase rebase = pendingRebase;
+    pendingRebase.inProgress = false;
+    pendingRebase.carriedFrames.clear();
+
+    if (!succeeded)
+        return;
+
+    // The old journal gets everything up to now, in case the new one can't
+    // be started. The edits made while the copy was being written are
+    // carried over to the new journal.
+    flush();
+
+    QString oldProjectFilePath(recording ? projectFilePath : QString());
+    recording = true;
+    projectFilePath = rebase.projectFilePath;
+    base = rebase.base;
+    journalSize = headerSize + rebase.carriedFrames.size();
+
+    QtConcurrent::run(writer, [this, oldProjectFilePath, rebase]() {switchJournal(oldProjectFilePath, rebase);});
+}
+
+void EditJournal::flush()
+{
+    flushTimer->stop();
+
+    if (unwrittenFrames.isEmpty() || !recording)
+        return;
+
+    QByteArray frames(unwrittenFrames);
+    unwrittenFrames.clear();
+    QtConcurrent::run(writer, [this, frames]() {append(frames);});
+}
+
+QByteArray EditJournal::header(Base base)
+{
+    QByteArray journalHeader(journalMagic);
+    journalHeader.append(static_cast<char>(base));
+    return journalHeader;
+}
+
+void EditJournal::nodeAdded(int track, int envelope, unsigned int pos, float value)
+{
+    if (!isRecording())
+        return;
+
+    writePendingChanges();
+
+    QDataStream out(&commandRecords, QIODevice::WriteOnly | QIODevice::Append);
+    out.setVersion(13);
+    out << quint8(NodeAddedRecord) << qint8(track) << quint8(envelope) << quint32(pos) << value;
+}
+
+void EditJournal::nodeMoved(int track, int envelope, unsigned int oldPos, unsigned int newPos, float newValue)
+{
+    if (!isRecording())
+        return;
+
+    PendingNodeMove move = {track, envelope, oldPos, newPos, newValue};
+
+    // a node that's already moved during this command keeps where it started
+    QHash<quint64, PendingNodeMove>::iterator it = pendingNodeMoves.find(nodeKey(track, envelope, oldPos));
+    if (it != pendingNodeMoves.end())
+    {
+        move.oldPos = it->oldPos;
+        pendingNodeMoves.erase(it);
+    }
+
+    pendingNodeMoves.insert(nodeKey(track, envelope, newPos), move);
+}
+
+void EditJournal::nodeRemoved(int track, int envelope, unsigned int pos)
+{
+    if (!isRecording())
+        return;
+
+    writePendingChanges();
+
+    QDataStream out(&commandRecords, QIODevice::WriteOnly | QIODevice::Append);
+    out.setVersion(13);
+    out << quint8(NodeRemovedRecord) << qint8(track) << quint8(envelope) << quint32(pos);
+}
+
+void EditJournal::noteChanged(NoteID id, const NoteRecord &before)
+{
+    if (!isRecording())
+        return;
+
+    // only the first change in a command has the note as it was before the command
+    if (!pendingNoteChanges.contains(id))
+        pendingNoteChanges.insert(id, before);
+}
+
+void EditJournal::noteInserted(const NoteRecord &note)
+{
+    writePendingChanges();
+    writeNoteRecord(NoteInsertedRecord, note);
+}
+
+void EditJournal::noteRemoved(const NoteRecord &note)
+{
+    writePendingChanges();
+    writeNoteRecord(NoteRemovedRecord, note);
+}
+
+uint EditJournal::noteKey(int track, unsigned short laneIndex, double start)
+{
+    quint64 startBits;
+    memcpy(&startBits, &start, sizeof(startBits));
+    return qHash(startBits) ^ (laneIndex << 5) ^ track;
+}
+
+// replaces the journal (if any) with a new one that starts with the given frames
+bool EditJournal::open(const QString &projectFilePath, Base base, const QByteArray &frames)
+{
+    QSaveFile newJournal(journalFilePath(projectFilePath));
+    if (!newJournal.open(QIODevice::WriteOnly))
+        return false;
+
+    QByteArray journalHeader(header(base));
+    if (newJournal.write(journalHeader) != journalHeader.size() || newJournal.write(frames) != frames.size() || !newJournal.commit())
+        return false;
+
+    file.setFileName(journalFilePath(projectFilePath));
+    return file.open(QIODevice::WriteOnly | QIODevice::Append);
+}
+
+QString EditJournal::recoveryFilePath(const QString &projectFilePath, Base base)
+{
+    return projectFilePath + (base == RecoveryBaseA ? ".recovery-a" : ".recovery-b");
+}
+
+void EditJournal::removeFiles(const QString &projectFilePath, Base baseToKeep)
+{
+    if (baseToKeep != RecoveryBaseA)
+        QFile::remove(recoveryFilePath(projectFilePath, RecoveryBaseA));
+
+    if (baseToKeep != RecoveryBaseB)
+        QFile::remove(recoveryFilePath(projectFilePath, RecoveryBaseB));
+}
+
+bool EditJournal::replay(const QString &projectFilePath)
+{
+    QFile journal(journalFilePath(projectFilePath));
+    if (!journal.open(QIODevice::ReadOnly))
+        return false;
+
+    QByteArray contents(journal.readAll());
+    int length = intactLength(contents);
+
+    // an index of the notes, so that a record's note can be found without searching its whole track
+    replayedNotes.clear();
+    for (int track = 0; track < trackManager->numTracks(); ++track)
+    {
+        const std::vector<NoteID> &notes = sequencerScene->trackNotes(track);
+
+        for (size_t i = 0; i < notes.size(); ++i)
+        {
+            const NoteRecord &note = sequencerScene->note(notes[i]);
+            replayedNotes.insert(noteKey(track, note.laneIndex, note.start), notes[i]);
+        }
+    }
+
+    // replaying stops at the first record that doesn't fit the project, since the ones after it might depend on it
+    bool appliedEverything = true;
+    for (int pos = headerSize; pos < length && appliedEverything; pos += frameHeaderSize + frameSize(contents, pos))
+    {
+        QByteArray records(QByteArray::fromRawData(contents.constData() + pos + frameHeaderSize, frameSize(contents, pos)));
+        QDataStream in(records);
+        in.setVersion(13);
+
+        while (!in.atEnd() && appliedEverything)
+            appliedEverything = applyRecord(in);
+    }
+
+    replayedNotes.clear();
+    return appliedEverything;
+}
+
+void EditJournal::requestCompaction()
+{
+    if (!isRecording())
+        return;
+
+    compactionRequested = true;
+    commandNeedsBarrier = true;
+}
+
+// Starting and stopping happen when a project is opened or closed, which
+// waits for the project to be written anyway, so they wait for the writer
+// and then use the file themselves.
+void EditJournal::start(const QString &projectFilePath, bool continueExisting)
+{
+    stop(false);
+    waitForWrites();
+    commandRecords.clear();
+    pendingNoteChanges.clear();
+    pendingNodeMoves.clear();
+    unwrittenFrames.clear();
+    writeFailed = false;
+    compactionRequested = false;
+    commandNeedsBarrier = false;
+    this->projectFilePath = projectFilePath;
+
+    // an unfinished session's journal is rewritten without any frame that was cut off, so that new ones can follow
+    if (continueExisting)
+    {
+        QFile journal(journalFilePath(projectFilePath));
+        if (journal.open(QIODevice::ReadOnly))
+        {
+            QByteArray contents(journal.readAll());
+            int length = intactLength(contents);
+            journal.close();
+
+            if (length > 0 && open(projectFilePath, static_cast<Base>(contents.at(4)), contents.mid(headerSize, length - headerSize)))
+            {
+                recording = true;
+                base = static_cast<Base>(contents.at(4));
+                journalSize = length;
+                return;
+            }
+        }
+    }
+
+    if (open(projectFilePath, ProjectBase, QByteArray()))
+    {
+        recording = true;
+        base = ProjectBase;
+        journalSize = headerSize;
+        removeFiles(projectFilePath, ProjectBase);
+    }
+}
+
+void EditJournal::stop(bool discard)
+{
+    if (!isRecording())
+        return;
+
+    endCommand();
+    flush();
+    waitForWrites();
+    file.close();
+    recording = false;
+
+    if (discard)
+    {
+        QFile::remove(journalFilePath(projectFilePath));
+        removeFiles(projectFilePath, ProjectBase);
+    }
+}
+
+bool EditJournal::wantsCompaction() const
+{
+    return isRecording() && (compactionRequested || writeFailed || journalSize > compactionSize);
+}
+
+void EditJournal::switchJournal(const QString &oldProjectFilePath, const Rebase &rebase)
+{
+    file.close();
+
+    // Going back to the old journal isn't safe, since the next compaction
+    // could overwrite the copy it starts from, so there's no journal until
+    // the next one.
+    if (!open(rebase.projectFilePath, rebase.base, rebase.carriedFrames))
+    {
+        if (!oldProjectFilePath.isEmpty())
+            QFile::remove(journalFilePath(oldProjectFilePath));
+
+        writeFailed = true;
+        return;
+    }
+
+    writeFailed = false;
+
+    if (!oldProjectFilePath.isEmpty() && oldProjectFilePath != rebase.projectFilePath)
+    {
+        QFile::remove(journalFilePath(oldProjectFilePath));
+        removeFiles(oldProjectFilePath, ProjectBase);
+    }
+
+    removeFiles(rebase.projectFilePath, rebase.base); // the recovery files that are out of date now
+}
+
+void EditJournal::waitForWrites()
+{
+    writer->waitForDone();
+}
+
+void EditJournal::writePendingChanges()
+{
+    if (pendingNoteChanges.isEmpty() && pendingNodeMoves.isEmpty())
+        return;
+
+    QDataStream out(&commandRecords, QIODevice::WriteOnly | QIODevice::Append);
+    out.setVersion(13);
+
+    for (QHash<NoteID, NoteRecord>::const_iterator it = pendingNoteChanges.constBegin(); it != pendingNoteChanges.constEnd(); ++it)
+    {
+        const NoteRecord &before = it.value();
+        const NoteRecord &after = sequencerScene->note(it.key());
+
+        if (after.indexInTrack == -1)
+            continue; // taken out of the scene along with its track, which leaves a barrier instead
+
+        if (after.start == before.start && after.duration == before.duration && after.laneIndex == before.laneIndex && after.velocity == before.velocity)
+            continue; // back where it started
+
+        writeNoteRecord(NoteChangedRecord, before);
+        out << after.start << after.duration << quint16(after.laneIndex) << quint8(after.velocity);
+    }
+
+    pendingNoteChanges.clear();
+
+    if (pendingNodeMoves.size() == 1)
+    {
+        const PendingNodeMove &move = pendingNodeMoves.constBegin().value();
+        out << quint8(NodeMovedRecord) << qint8(move.track) << quint8(move.envelope) << quint32(move.oldPos) << quint32(move.newPos) << move.newValue;
+    }
+    else
+    {
+        // the nodes are all taken out before any are put back, so that none lands where another hasn't left yet
+        for (QHash<quint64, PendingNodeMove>::const_iterator it = pendingNodeMoves.constBegin(); it != pendingNodeMoves.constEnd(); ++it)
+            out << quint8(NodeRemovedRecord) << qint8(it->track) << quint8(it->envelope) << quint32(it->oldPos);
+
+        for (QHash<quint64, PendingNodeMove>::const_iterator it = pendingNodeMoves.constBegin(); it != pendingNodeMoves.constEnd(); ++it)
+            out << quint8(NodeAddedRecord) << qint8(it->track) << quint8(it->envelope) << quint32(it->newPos) << it->newValue;
+    }
+
+    pendingNodeMoves.clear();
+}
+
+void EditJournal::writeNoteRecord(RecordType type, const NoteRecord &note)
+{
+    if (!isRecording())
+        return;
+
+    QDataStream out(&commandRecords, QIODevice::WriteOnly | QIODevice::Append);
+    out.setVersion(13);
+    out << quint8(type) << quint8(note.track) << note.start << note.duration << quint16(note.laneIndex) << quint8(note.velocity);
+}
@@ -0,0 +1,145 @@
+#ifndef EDITJOURNAL_H
+#define EDITJOURNAL_H
+#include "notestore.h"
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMultiHash>
+#include <QtCore/QObject>
+#include <atomic>
+
+class QThreadPool;
+class QTimer;
+class SequencerScene;
+class TrackManagerDialog;
+
+// An append-only record of the edits made since the project was last saved,
+// kept next to it as <project>.hxp.journal so that they can be recovered if
+// Hex doesn't close properly. The sequencer and the track manager report
+// every change to the notes and nodes, and the changes made by one undo
+// command are written as one frame with a checksum, so a frame that was cut
+// off by a crash is left out. Frames are written in batches, with one fsync
+// per batch, on a thread of the journal's own so that a slow disk doesn't
+// hold up the UI. If a write fails, the journal is deleted rather than left
+// with a gap in it, and the next compaction starts a new one.
+//
+// Dragging notes or nodes around changes them once per mouse move, so the
+// changes to each one are held until the command ends (or something else
+// is recorded), and only where it started and where it ended up are written.
+//
+// Notes are identified by their values, since IDs don't survive a reload.
+// Changes to tracks, envelopes and project settings are too rare to be worth
+// their own records; they ask for a compaction instead, which writes the
+// whole project to a recovery file that the journal then starts over from.
+// Saving does the same thing, with the project file itself.
+
+class EditJournal : public QObject
+{
+public:
+    // The file that the journal starts from. There are two recovery files,
+    // used in turn, so that the one the journal starts from is never the one
+    // being overwritten.
+    enum Base {ProjectBase = 0, RecoveryBaseA = 1, RecoveryBaseB = 2};
+
+    EditJournal(SequencerScene *sequencerScene, TrackManagerDialog *trackManager, QObject *parent = 0);
+    ~EditJournal();
+
+    // recovery (recording must be stopped)
+    static QString baseFilePath(const QString &projectFilePath); // where an unfinished session's journal starts from, or an empty string if there isn't one
+    bool replay(const QString &projectFilePath); // applies an unfinished session's journal to the project as read from baseFilePath()
+
+    // recording
+    bool isRecording() const {return recording;}
+    void start(const QString &projectFilePath, bool continueExisting = false);
+    void stop(bool discard); // discarding deletes the journal and the recovery files
+    void endCommand(); // call whenever the undo stack's index changes
+    void requestCompaction(); // call when something changes that the journal doesn't record
+    bool wantsCompaction() const;
+
+    // Saving and compacting both write a copy of the project for the journal
+    // to start over from. Whatever is recorded while it's being written is
+    // carried over to the new journal.
+    QString beginRebase(const QString &newProjectFilePath, bool toRecoveryFile); // returns the file to write the copy to
+    void finishRebase(bool succeeded);
+
+    // edits, reported as they happen
+    void noteChanged(NoteID id, const NoteRecord &before);
+    void noteInserted(const NoteRecord &note);
+    void noteRemoved(const NoteRecord &note);
+    void nodeAdded(int track, int envelope, unsigned int pos, float value);
+    void nodeMoved(int track, int envelope, unsigned int oldPos, unsigned int newPos, float newValue);
+    void nodeRemoved(int track, int envelope, unsigned int pos);
+
+private:
+    enum RecordType
+    {
+        BarrierRecord = 0, // starts a frame that replaying stops at, because of a change that wasn't recorded
+        NoteInsertedRecord = 1,
+        NoteRemovedRecord = 2,
+        NoteChangedRecord = 3,
+        NodeAddedRecord = 4,
+        NodeMovedRecord = 5,
+        NodeRemovedRecord = 6
+    };
+
+    struct PendingNodeMove
+    {
+        int track;
+        int envelope;
+        unsigned int oldPos; // where it was when the command started
+        unsigned int newPos;
+        float newValue;
+    };
+
+    struct Rebase
+    {
+        bool inProgress;
+        QByteArray carriedFrames; // recorded while the copy is being written, to start the new journal with
+        QString projectFilePath;
+        Base base;
+    };
+
+    static const int flushIntervalMilliseconds = 2000;
+    static const qint64 compactionSize = 8 * 1024 * 1024;
+
+    static QString journalFilePath(const QString &projectFilePath) {return projectFilePath + ".journal";}
+    static QString recoveryFilePath(const QString &projectFilePath, Base base);
+    static void removeFiles(const QString &projectFilePath, Base baseToKeep);
+    static QByteArray header(Base base);
+
+    bool applyRecord(QDataStream &in);
+    NoteID findNote(int track, double start, double duration, unsigned short laneIndex, unsigned char velocity) const;
+    static quint64 nodeKey(int track, int envelope, unsigned int pos) {return (quint64(quint8(track)) << 40) | (quint64(quint8(envelope)) << 32) | pos;}
+    static uint noteKey(int track, unsigned short laneIndex, double start);
+    void flush();
+    bool open(const QString &projectFilePath, Base base, const QByteArray &frames);
+    void waitForWrites();
+
+    // these run on the writer's thread
+    void abandon();
+    void append(const QByteArray &frames);
+    void switchJournal(const QString &oldProjectFilePath, const Rebase &rebase);
+    void writeNoteRecord(RecordType type, const NoteRecord &note);
+    void writePendingChanges(); // before any other record, so that the records stay in order
+
+    SequencerScene *sequencerScene;
+    TrackManagerDialog *trackManager;
+    QTimer *flushTimer;
+    QThreadPool *writer; // one thread, so that the writes happen in order
+    QFile file; // only used by the writer, or while it's idle
+    std::atomic<bool> writeFailed;
+    bool recording;
+    QString projectFilePath;
+    Base base;
+    qint64 journalSize; // including the frames that haven't been written yet
+    QByteArray commandRecords; // the records of the command in progress
+    QHash<NoteID, NoteRecord> pendingNoteChanges; // each changed note as it was before the command changed it
+    QHash<quint64, PendingNodeMove> pendingNodeMoves; // by nodeKey() of where each node is now
+    QByteArray unwrittenFrames;
+    bool compactionRequested;
+    bool commandNeedsBarrier;
+    Rebase pendingRebase;
+    QMultiHash<uint, NoteID> replayedNotes; // every note in the scene, by noteKey(), while replaying
+};
+
+#endif // EDITJOURNAL_H
@@ -2,13 +2,19 @@
 #include "draghandlers.h"
 #include "envelopeview.h"
 #include "nodecommands.h"
+#include "qdatastreamoperators.h"
 #include "trackmanagerdialog.h"
 #include <QtGui/QPainter>
+#include <QtGui/QPolygonF>
 #include <QtWidgets/QGraphicsSceneMouseEvent>
 #include <QtWidgets/QInputDialog>
+#include <algorithm>
+#include <math.h>
+
+const int minPixelsPerNode = 3; // any closer together, and the envelope is drawn decimated and without its nodes
 
 EnvelopeScene::EnvelopeScene(BarLineDrawer *barLineDrawer, QUndoStack *undoStack, QWidget *view)
-    : AbstractSequencerScene(barLineDrawer, undoStack, view), m_nodeMover(0), m_envelope(0)
+    : AbstractSequencerScene(barLineDrawer, undoStack, view), m_nodeMover(0), m_envelope(0), nodeValueTreeEnvelope(0), nodeValueTreeRevision(0)
 {
     setSceneRect(0, 0, 100, 1);
 }
@@ -23,6 +29,7 @@ void EnvelopeScene::setMIDICCEnvelope(SimpleMap<unsigned int, float> *envelope,
 {
     clearSelectedNodes();
     m_envelope = envelope;
+    nodeValueTreeEnvelope = 0; // in case a new envelope is at an old one's address
     m_currentTrack = track;
     m_currentEnvelopeIndex = envelopeIndex;
     update();
@@ -43,6 +50,39 @@ void EnvelopeScene::addNodeAtClickPos(const QPointF &scenePos)
     // select node...
 }
 
+// Appends a polyline through the nodes from firstIndex to lastIndex with at
+// most four points per pixel column: the column's first, lowest, highest, and
+// last nodes. At this zoom level, it looks just like the full envelope.
+void EnvelopeScene::appendDecimatedEnvelope(QPolygonF &polyline, const QRectF &rect, int numColumns, int firstIndex, int lastIndex)
+{
+    updateNodeValueTree();
+
+    const unsigned int *xPositions = m_envelope->getKeyArray();
+    const float *yPositions = m_envelope->getValueArray();
+    double ticksPerColumn = rect.width() / numColumns;
+
+    polyline.append(QPointF(xPositions[firstIndex], yPositions[firstIndex]));
+
+    int i = firstIndex + 1;
+    for (int column = 0; column < numColumns && i < lastIndex; ++column)
+    {
+        double columnRight = rect.left() + (column + 1) * ticksPerColumn;
+        int columnEnd = (column == numColumns - 1) ? lastIndex : std::lower_bound(xPositions + i, xPositions + lastIndex, columnRight) - xPositions;
+
+        if (columnEnd == i) // no nodes in this column
+            continue;
+
+        float minimum, maximum;
+        nodeValueTree.query(i, columnEnd - 1, minimum, maximum);
+
+        double x = columnRight - ticksPerColumn * .5;
+        polyline << QPointF(x, yPositions[i]) << QPointF(x, minimum) << QPointF(x, maximum) << QPointF(x, yPositions[columnEnd - 1]);
+        i = columnEnd;
+    }
+
+    polyline.append(QPointF(xPositions[lastIndex], yPositions[lastIndex]));
+}
+
 void EnvelopeScene::clearSelectedNodes()
 {
     m_selectedNodeIndices.setSize(0);
@@ -53,31 +93,28 @@ void EnvelopeScene::contextMenuEvent(QGraphicsSceneContextMenuEvent *event)
     trackManager->executeEnvelopeContextMenu(event, nodeAt(event->scenePos(), static_cast<QGraphicsView*>(event->widget()->parent())->transform()));
 }
 
+// the nodes are copied as a column of positions and a column of values, so that pasting can read each column in one go
 bool EnvelopeScene::copyImplementation(QDataStream &stream)
 {
-    if (m_selectedNodeIndices.size() == 0)
-        return false;
+    int numNodes = m_selectedNodeIndices.size();
 
-    stream << m_selectedNodeIndices.size();
+    if (numNodes == 0)
+        return false;
 
     const unsigned int *xPositions = m_envelope->getKeyArray();
     const float *yPositions = m_envelope->getValueArray();
 
-    // find leftmost node's x position
-    unsigned int leftmostNodeXPos = xPositions[m_selectedNodeIndices[0]]; // default value...
-    for (int i = 0; i < m_selectedNodeIndices.size(); ++i)
-    {
-        if (xPositions[m_selectedNodeIndices[i]] < leftmostNodeXPos)
-            leftmostNodeXPos = xPositions[m_selectedNodeIndices[i]];
-    }
-    stream << leftmostNodeXPos;
-
-    // serialize the nodes
-    for (int i = 0; i < m_selectedNodeIndices.size(); ++i)
+    std::vector<quint32> positions(numNodes);
+    std::vector<float> values(numNodes);
+    for (int i = 0; i < numNodes; ++i)
     {
-        stream << xPositions[m_selectedNodeIndices[i]] << yPositions[m_selectedNodeIndices[i]];
+        positions[i] = xPositions[m_selectedNodeIndices[i]];
+        values[i] = yPositions[m_selectedNodeIndices[i]];
     }
 
+    stream << numNodes << *std::min_element(positions.begin(), positions.end());
+    writeRawColumn(stream, positions);
+    writeRawColumn(stream, values);
     return true;
 }
 
@@ -104,45 +141,48 @@ void EnvelopeScene::drawBackground(QPainter *painter, const QRectF &rect) // dra
 
     const unsigned int *xPositions = m_envelope->getKeyArray();
     const float *yPositions = m_envelope->getValueArray();
+    int numNodes = m_envelope->count();
     double rectRight = rect.right();
 
-    if (m_envelope->count() == 0 || xPositions[0] > rectRight) // if nothing to draw
+    if (numNodes == 0 || xPositions[0] > rectRight) // if nothing to draw
         return;
 
     painter->setRenderHint(QPainter::Antialiasing, true);
     painter->setPen(m_envelopePen);
 
-    int lastIndex = m_envelope->count() - 1;
-
-    // find the first index to draw
-    int firstIndexToDraw = 0;
-    while (xPositions[firstIndexToDraw] < rect.left())
-        ++firstIndexToDraw;
-    if (firstIndexToDraw > 0)
-        --firstIndexToDraw;
+    // draw from the last node before the rect to the first node after it
+    int firstIndexToDraw = qMax(static_cast<int>(std::lower_bound(xPositions, xPositions + numNodes, rect.left()) - xPositions) - 1, 0);
+    int lastIndexToDraw = qMin(static_cast<int>(std::upper_bound(xPositions, xPositions + numNodes, rectRight) - xPositions), numNodes - 1);
 
-    // find the last index to draw
-    int lastIndexToDraw = lastIndex;
-    while (xPositions[lastIndexToDraw] > rectRight)
-        --lastIndexToDraw;
-    if (lastIndexToDraw < lastIndex)
-        ++lastIndexToDraw;
-
-    int i = firstIndexToDraw;
+    // when there are more nodes than pixels, drawing every one of them is
+    // slow and looks no different, so the cost is kept proportional to the
+    // width of the view instead
+    int numColumns = static_cast<int>(ceil(rect.width() * painter->worldTransform().m11()));
+    bool nodesAreDense = (lastIndexToDraw - firstIndexToDraw) * minPixelsPerNode > numColumns;
 
     // ==================================================== DRAW THE LINES
-    QPointF fromPoint;
-    QPointF toPoint(xPositions[i], yPositions[i]);
-    while (i < lastIndexToDraw)
+    QPolygonF polyline;
+
+    if (nodesAreDense)
     {
-        fromPoint = toPoint;
-        ++i;
-        toPoint = QPointF(xPositions[i], yPositions[i]);
-        painter->drawLine(fromPoint, toPoint);
+        appendDecimatedEnvelope(polyline, rect, numColumns, firstIndexToDraw, lastIndexToDraw);
     }
-    painter->drawLine(toPoint, QPointF(rectRight, toPoint.y()));
+    else
+    {
+        polyline.reserve(lastIndexToDraw - firstIndexToDraw + 2);
+        for (int i = firstIndexToDraw; i <= lastIndexToDraw; ++i)
+            polyline.append(QPointF(xPositions[i], yPositions[i]));
+    }
+
+    if (polyline.last().x() < rectRight)
+        polyline.append(QPointF(rectRight, polyline.last().y()));
+
+    painter->drawPolyline(polyline);
     // ===================================================================
 
+    if (nodesAreDense) // the nodes would only be a smear at this zoom level
+        return;
+
     // adjust to draw partially offscreen nodes
     double rectLeft = rect.left() - 1;
     rectRight += 1;
@@ -150,7 +190,7 @@ void EnvelopeScene::drawBackground(QPainter *painter, const QRectF &rect) // dra
     // ========================================= DRAW THE UNSELECTED NODES
     ++lastIndexToDraw;
     painter->setPen(m_unselectedNodePen);
-    for (i = firstIndexToDraw; i < lastIndexToDraw; ++i)
+    for (int i = firstIndexToDraw; i < lastIndexToDraw; ++i)
     {
         QPointF point(xPositions[i], yPositions[i]);
 
@@ -349,20 +389,23 @@ int EnvelopeScene::nodeAt(const QPointF &point, const QTransform &viewTransform)
 
 QUndoCommand *EnvelopeScene::pasteCommand(QDataStream &stream, int numItems)
 {
-    m_selectedNodeIndices.setSize(0);
-    double leftmostCopiedNodeXPos;
+    quint32 leftmostCopiedNodeXPos;
+    std::vector<quint32> positions;
+    std::vector<float> values;
     stream >> leftmostCopiedNodeXPos;
 
-    double pastedNodeOffset = cursorPos() - leftmostCopiedNodeXPos;
+    if (!readRawColumn(stream, positions, numItems) || !readRawColumn(stream, values, numItems) || !stream.atEnd())
+        return 0;
+
+    m_selectedNodeIndices.setSize(0);
+    double pastedNodeOffset = cursorPos() - static_cast<double>(leftmostCopiedNodeXPos);
 
     SimpleVector<QPointF> nodesToPaste(numItems);
 
     for (int i = 0; i < numItems; ++i)
     {
-        unsigned int pos;
-        float value;
-        stream >> pos >> value;
-        pos += pastedNodeOffset;
+        unsigned int pos = positions[i] + pastedNodeOffset;
+        float value = values[i];
 
         while (m_envelope->contains(pos))
             pos += snapSize();
@@ -389,3 +432,13 @@ void EnvelopeScene::setNodeSelected(int index)
 {
     m_selectedNodeIndices.appendSafely(index);
 }
+
+void EnvelopeScene::updateNodeValueTree()
+{
+    if (nodeValueTreeEnvelope == m_envelope && nodeValueTreeRevision == m_envelope->revision())
+        return;
+
+    nodeValueTree.build(m_envelope->getValueArray(), m_envelope->count());
+    nodeValueTreeEnvelope = m_envelope;
+    nodeValueTreeRevision = m_envelope->revision();
+}
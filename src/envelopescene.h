@@ -1,10 +1,12 @@
 #ifndef ENVELOPESCENE_H
 #define ENVELOPESCENE_H
 #include "abstractsequencerscene.h"
+#include "minmaxtree.h"
 #include "simplemap.h"
 #include "simplevector.h"
 
 class NodeMover;
+class QPolygonF;
 class TrackManagerDialog;
 
 class EnvelopeScene : public AbstractSequencerScene
@@ -45,8 +47,10 @@ private:
     QUndoCommand *pasteCommand(QDataStream &stream, int numItems);
 
     // helper methods
+    void appendDecimatedEnvelope(QPolygonF &polyline, const QRectF &rect, int numColumns, int firstIndex, int lastIndex);
     double getValueFromUser(double currentVal0To1, double minVal, double maxVal, bool useFloatingPoint);
     int nodeAt(const QPointF &point, const QTransform &viewTransform); // returns index of node at the point, or -1 if there is no node there
+    void updateNodeValueTree();
 
     // these are initialized in the initializer list
     NodeMover *m_nodeMover;
@@ -58,6 +62,11 @@ private:
     QPen m_selectedNodePen;
     QPen m_unselectedNodePen;
     SimpleVector<int> m_selectedNodeIndices;
+
+    // the node values of nodeValueTreeEnvelope as of nodeValueTreeRevision, for drawing when zoomed out
+    MinMaxTree nodeValueTree;
+    const SimpleMap<unsigned int, float> *nodeValueTreeEnvelope;
+    unsigned int nodeValueTreeRevision;
 };
 
 #endif
@@ -20,8 +20,10 @@ namespace HexSettings
     const int latticeSettingsCommandID = 100;
     const int projectTimingSettingsCommandID = 101;
     const QEvent::Type doneRecordingNoteEventType = static_cast<QEvent::Type>(1001);
+    const QEvent::Type pressedButtonsChangedEventType = static_cast<QEvent::Type>(1002);
 
     const unsigned int maxPolyphony = 16;
+    const int maxNumTracks = 32; // includes tracks deleted during the session
 
     // timing variables
     const int sleepIntervalMilliseconds = 6;
@@ -29,6 +31,7 @@ namespace HexSettings
     const int numSleepIntervalsBetweenGUIUpdates = 8;
     const double envelopeResolutionMS = 24;
     const double oneOverEnvResolution = 1.0 / envelopeResolutionMS;
+    const int pressedButtonsUpdateIntervalMilliseconds = 16; // about once per frame
 
     inline void convertNoteLaneIndexToJK(int index, short int &j, short int &k)
     {
@@ -1,16 +1,30 @@
 #ifndef LATTICEDATA_H
 #define LATTICEDATA_H
+#include "atomicbitset.h"
 #include "hexsettings.h"
 #include "simplevector.h"
 #include <QtCore/QPointF>
 
+struct LanePosition
+{
+    static bool compare(const LanePosition &a, const LanePosition &b) {return a.y < b.y;}
+
+    double y;
+    unsigned int index;
+    bool isLight;
+};
+
+typedef AtomicBitset<HexSettings::numButtons> ButtonSet;
+
 struct LatticeData
 {
-    LatticeData() : darkIndices(HexSettings::numButtons), lightIndices(HexSettings::numButtons), pressedIndices(HexSettings::maxPolyphony) {}
+    LatticeData() : lanesSortedByY(HexSettings::numButtons) {}
 
-    SimpleVector<unsigned int> darkIndices;
-    SimpleVector<unsigned int> lightIndices;
-    SimpleVector<unsigned int> pressedIndices;
+    ButtonSet darkButtons;
+    ButtonSet lightButtons;
+    ButtonSet pressedButtons; // modified from the MIDI input thread
+    ButtonSet changedPressedButtons; // pressed or released since the scenes were last updated
+    SimpleVector<LanePosition> lanesSortedByY; // the light and dark lanes; kept sorted by LatticeManager::transformLattice()
     QPointF buttonPositions[HexSettings::numButtons];
     double periodSize;
 };
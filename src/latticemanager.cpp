@@ -1,10 +1,12 @@
 #include "latticemanager.h"
-#include "buttonshapecalculator.h"
 #include "latticedata.h"
 #include "latticescene.h"
 #include "midiportmanager.h"
 #include "projectsettingsdialog.h"
 #include "sequencerscene.h"
+#include "sortalgorithms.h"
+#include <QtCore/QCoreApplication>
+#include <QtCore/QTimer>
 
 LatticeManager::LatticeManager(LatticeScene *latticeScene, SequencerScene *sequencerScene, LatticeData *latticeData, MIDIPortManager *manager)
     : latticeScene(latticeScene),
@@ -12,8 +14,14 @@ LatticeManager::LatticeManager(LatticeScene *latticeScene, SequencerScene *seque
       latticeData(latticeData),
       midiPortManager(manager),
       transformMode(0),
-      midiOutputEnabled(true)
+      midiOutputEnabled(true),
+      visibleLanesChanged(true),
+      pressedButtonsTimer(new QTimer(this)),
+      pressedButtonsUpdatePending(false)
 {
+    pressedButtonsTimer->setSingleShot(true);
+    pressedButtonsTimer->setInterval(HexSettings::pressedButtonsUpdateIntervalMilliseconds);
+    connect(pressedButtonsTimer, &QTimer::timeout, this, &LatticeManager::updatePressedButtons);
 }
 
 LatticeManager::~LatticeManager()
@@ -22,12 +30,22 @@ LatticeManager::~LatticeManager()
 
 void LatticeManager::adjustButtonShapeAccordingToLayout()
 {
-    QTransform layoutRotation;
+    layoutRotation.reset();
     layoutRotation.rotateRadians(dt.getSnuggle());
     layoutAdjustedButtonPath = layoutRotation.map(untransformedButtonPath);
     layoutAdjustedButtonRect = layoutRotation.mapRect(untransformedButtonRect);
 }
 
+void LatticeManager::customEvent(QEvent *event)
+{
+    if (event->type() != HexSettings::pressedButtonsChangedEventType)
+        return;
+
+    // any other changes that come in before the timer fires are handled along with this one
+    if (!pressedButtonsTimer->isActive())
+        pressedButtonsTimer->start();
+}
+
 void LatticeManager::drawLattice(const LatticeSettings &latticeSettings)
 {
     dt.setAPSLayout(latticeSettings.apsLayout, latticeSettings.flipped);
@@ -36,8 +54,9 @@ void LatticeManager::drawLattice(const LatticeSettings &latticeSettings)
     int numDarkColumns = latticeSettings.numLargeSteps;
     float maxPeriods = latticeSettings.numPeriods * .5;
 
-    latticeData->darkIndices.setSize(0);
-    latticeData->lightIndices.setSize(0);
+    latticeData->darkButtons.clear();
+    latticeData->lightButtons.clear();
+    visibleLanesChanged = true;
 
     // calculate min/max values for columns
     short minKLight = numLightColumns / -2;
@@ -86,9 +105,9 @@ void LatticeManager::drawLatticeHelper(short k,
         if (columnIsVisible && pitch >= -maxPeriods && pitch <= maxPeriods)
         {
             if (columnIsLight)
-                latticeData->lightIndices.appendByValue(i);
+                latticeData->lightButtons.insert(i);
             else
-                latticeData->darkIndices.appendByValue(i);
+                latticeData->darkButtons.insert(i);
         }
 
         // this needs to be calculated whether drawn or not so that you can
@@ -143,30 +162,66 @@ void LatticeManager::setButtonPressed(short index, bool pressed)
     if (index < 0 || index >= HexSettings::numButtons)
         return;
 
-    if (pressed)
-        latticeData->pressedIndices.appendSafely(index);
-    else
-        latticeData->pressedIndices.removeValue(index);
+    bool changed = pressed ? latticeData->pressedButtons.insert(index) : latticeData->pressedButtons.remove(index);
 
-    latticeScene->update();
-    sequencerScene->update();
+    if (!changed)
+        return;
+
+    // This is usually called from the MIDI input thread, and the scenes can
+    // only be updated from the main thread. A fast player can press hundreds
+    // of buttons a second, so the changes are gathered up and the main thread
+    // repaints just those buttons and lanes once a frame.
+    latticeData->changedPressedButtons.insert(index);
+
+    if (!pressedButtonsUpdatePending.exchange(true))
+        QCoreApplication::postEvent(this, new QEvent(HexSettings::pressedButtonsChangedEventType));
 }
 
 void LatticeManager::setButtonScaleAndType(float scale, int type)
 {
-    ButtonShapeCalculator buttonShapeCalculator(scale, static_cast<ButtonShapeCalculator::Shape>(type));
-    untransformedButtonPath = buttonShapeCalculator.buttonPath();
-    untransformedButtonRect = buttonShapeCalculator.buttonBoundingRect();
+    buttonShape = ButtonShapeCalculator(scale, static_cast<ButtonShapeCalculator::Shape>(type));
+    untransformedButtonPath = buttonShape.buttonPath();
+    untransformedButtonRect = buttonShape.buttonBoundingRect();
 
     adjustButtonShapeAccordingToLayout();
 
-    latticeScene->setButtonPath(latticeTransform.map(layoutAdjustedButtonPath));
-    latticeScene->setButtonRect(latticeTransform.mapRect(layoutAdjustedButtonRect));
+    updateSceneButtonShape();
+    latticeScene->updateButtonGrid();
     updateSceneBoundingRects();
 
     latticeScene->update();
 }
 
+void LatticeManager::sortLanesByY()
+{
+    SimpleVector<LanePosition> &lanes = latticeData->lanesSortedByY;
+
+    if (visibleLanesChanged)
+    {
+        lanes.setSize(0);
+
+        for (int i = latticeData->lightButtons.first(); i != -1; i = latticeData->lightButtons.next(i))
+        {
+            LanePosition lane = {0, static_cast<unsigned int>(i), true};
+            lanes.append(lane);
+        }
+
+        for (int i = latticeData->darkButtons.first(); i != -1; i = latticeData->darkButtons.next(i))
+        {
+            LanePosition lane = {0, static_cast<unsigned int>(i), false};
+            lanes.append(lane);
+        }
+
+        visibleLanesChanged = false;
+    }
+
+    for (int i = 0; i < lanes.size(); ++i)
+        lanes[i].y = latticeData->buttonPositions[lanes[i].index].y();
+
+    // the previous order is usually almost correct, so insertion sort is nearly linear here
+    insertionSort(&lanes[0], lanes.size(), LanePosition::compare);
+}
+
 void LatticeManager::toTransformMode(int mode)
 {
     transformMode = mode;
@@ -188,29 +243,49 @@ void LatticeManager::transformLattice()
         break;
     }
 
-    latticeScene->setButtonPath(latticeTransform.map(layoutAdjustedButtonPath));
-    latticeScene->setButtonRect(latticeTransform.mapRect(layoutAdjustedButtonRect));
+    updateSceneButtonShape();
 
     for (int i = 0; i < HexSettings::numButtons; ++i)
     {
         latticeData->buttonPositions[i] = latticeTransform.map(untransformedPoints[i]);
     }
 
+    sortLanesByY();
+    latticeScene->updateButtonGrid();
+
     latticeScene->update();
-    sequencerScene->updateNotePositions();
+    sequencerScene->updateLanePositions(); // O(lanes), not O(notes)
+}
 
-    // need this in case there are no notes (i.e., nothing automatically updating sequencer)
-    sequencerScene->update();
+void LatticeManager::updatePressedButtons()
+{
+    pressedButtonsUpdatePending.store(false); // before taking the changes, so that a change made meanwhile posts another event
+    QRectF buttonRect(latticeScene->getButtonRect());
+
+    for (int i = latticeData->changedPressedButtons.first(); i != -1; i = latticeData->changedPressedButtons.next(i))
+    {
+        latticeData->changedPressedButtons.remove(i);
+        latticeScene->update(buttonRect.translated(latticeData->buttonPositions[i]));
+        sequencerScene->updateLane(i);
+    }
+}
+
+void LatticeManager::updateSceneButtonShape()
+{
+    latticeScene->setButtonPath(latticeTransform.map(layoutAdjustedButtonPath));
+    latticeScene->setButtonRect(latticeTransform.mapRect(layoutAdjustedButtonRect));
+    latticeScene->setButtonShape(buttonShape, layoutRotation * latticeTransform);
+    latticeScene->invalidateButtonSprites(); // only here, from transformLattice() and setButtonScaleAndType()
 }
 
 void LatticeManager::updateSceneBoundingRects()
 {
     // =================================== CALCULATE THE LATTICE BOUNDING RECT
-    QPolygonF latticeCenterPoints(latticeData->lightIndices.size() + latticeData->darkIndices.size());
-    for (int i = 0; i < latticeData->lightIndices.size(); ++i)
-        latticeCenterPoints.append(latticeData->buttonPositions[latticeData->lightIndices[i]]);
-    for (int i = 0; i < latticeData->darkIndices.size(); ++i)
-        latticeCenterPoints.append(latticeData->buttonPositions[latticeData->darkIndices[i]]);
+    QPolygonF latticeCenterPoints(latticeData->lightButtons.count() + latticeData->darkButtons.count());
+    for (int i = latticeData->lightButtons.first(); i != -1; i = latticeData->lightButtons.next(i))
+        latticeCenterPoints.append(latticeData->buttonPositions[i]);
+    for (int i = latticeData->darkButtons.first(); i != -1; i = latticeData->darkButtons.next(i))
+        latticeCenterPoints.append(latticeData->buttonPositions[i]);
 
     QPainterPath latticePath;
     latticePath.addPolygon(latticeCenterPoints);
@@ -1,12 +1,15 @@
 #ifndef LATTICEMANAGER_H
 #define LATTICEMANAGER_H
+#include "buttonshapecalculator.h"
 #include "dynamictonality.h"
 #include "hexsettings.h"
 #include <QtGui/QPainterPath>
 #include <QtGui/QTransform>
+#include <atomic>
 
 class LatticeScene;
 class MIDIPortManager;
+class QTimer;
 class SequencerScene;
 struct LatticeData;
 struct LatticeSettings;
@@ -31,12 +34,18 @@ public:
     int getTransformMode() const {return transformMode;}
     void setMIDIOutputEnabled(bool on) {midiOutputEnabled = on;}
 
+protected:
+    void customEvent(QEvent *event); // for pressed button changes
+
 private:
     void adjustButtonShapeAccordingToLayout();
     void constructorHelper(short k, short &i);
     void drawLatticeHelper(short k, short minKLight, short maxKLight, short minKVisible, short maxKVisible, float maxPeriods, short &i);
     void sendAlphaMIDI();
     void sendBetaMIDI();
+    void sortLanesByY();
+    void updatePressedButtons();
+    void updateSceneButtonShape();
 
     // these are initialized in the initializer list
     LatticeScene *latticeScene;
@@ -45,9 +54,14 @@ private:
     MIDIPortManager *midiPortManager;
     int transformMode;
     bool midiOutputEnabled;
+    bool visibleLanesChanged;
+    QTimer *pressedButtonsTimer;
+    std::atomic<bool> pressedButtonsUpdatePending;
 
     DynamicTonality dt;
+    ButtonShapeCalculator buttonShape;
     QTransform latticeTransform;
+    QTransform layoutRotation;
     QPainterPath layoutAdjustedButtonPath;
     QRectF layoutAdjustedButtonRect;
     QPainterPath untransformedButtonPath;
@@ -3,6 +3,7 @@
 #include "midieventhandler.h"
 #include <QtGui/QPainter>
 #include <QtWidgets/QGraphicsSceneMouseEvent>
+#include <math.h>
 
 LatticeScene::LatticeScene(LatticeData *latticeData, QObject *parent)
     : QGraphicsScene(parent),
@@ -14,39 +15,70 @@ LatticeScene::LatticeScene(LatticeData *latticeData, QObject *parent)
       lightButtonBrush(Qt::SolidPattern),
       lightLaneBrush(Qt::SolidPattern),
       pressedButtonBrush(Qt::SolidPattern),
+      buttonSpriteScaleX(0),
+      buttonSpriteScaleY(0),
+      buttonSpriteDevicePixelRatio(0),
+      buttonSpritesAreStale(true),
       pressedButtonsJ(16),
-      pressedButtonsK(16)
+      pressedButtonsK(16),
+      gridCellSize(1),
+      gridColumns(0),
+      gridRows(0),
+      gridCellStarts(maxGridCells + 1),
+      gridCellFill(maxGridCells),
+      gridEntries(HexSettings::numButtons)
 {
 }
 
+void LatticeScene::addButtonsToGrid(const ButtonSet &buttons, bool isLight)
+{
+    for (int i = buttons.first(); i != -1; i = buttons.next(i))
+    {
+        GridEntry entry = {static_cast<unsigned int>(i), isLight};
+        gridEntries[gridCellFill[gridCellAt(latticeData->buttonPositions[i])]++] = entry;
+    }
+}
+
 void LatticeScene::drawBackground(QPainter *painter, const QRectF &rect)
 {
-    // Since the optimization flag DontSavePainterState is set, I call this
-    // here so that the buttons don't need to call it in their paint() method.
-    painter->setPen(Qt::NoPen);
+    QTransform transform(painter->worldTransform());
+    qreal devicePixelRatio = painter->device()->devicePixelRatioF();
+
+    // the sprites only need to be redrawn when the buttons change or the view is zoomed
+    if (buttonSpritesAreStale ||
+        transform.m11() != buttonSpriteScaleX ||
+        transform.m22() != buttonSpriteScaleY ||
+        devicePixelRatio != buttonSpriteDevicePixelRatio)
+    {
+        renderButtonSprites(transform, devicePixelRatio);
+    }
 
     double halfButtonWidth = buttonRect.width() * .5;
     double halfButtonHeight = buttonRect.height() * .5;
     QRectF adjustedRect(rect.adjusted(-halfButtonWidth, -halfButtonHeight, halfButtonWidth, halfButtonHeight));
 
-    painter->setBrush(darkButtonBrush);
-    drawButtonSet(painter, adjustedRect, latticeData->darkIndices);
-    painter->setBrush(lightButtonBrush);
-    drawButtonSet(painter, adjustedRect, latticeData->lightIndices);
-    painter->setBrush(pressedButtonBrush);
-    drawButtonSet(painter, adjustedRect, latticeData->pressedIndices);
+    // the sprites are already at the view's scale, so they're blitted without any transform
+    // (since the optimization flag DontSavePainterState is set, the transform is restored by hand)
+    painter->setWorldTransform(QTransform());
+    drawButtonSet(painter, transform, adjustedRect, latticeData->darkButtons, buttonSprites[DarkButtonSprite]);
+    drawButtonSet(painter, transform, adjustedRect, latticeData->lightButtons, buttonSprites[LightButtonSprite]);
+    drawButtonSet(painter, transform, adjustedRect, latticeData->pressedButtons, buttonSprites[PressedButtonSprite]);
 
     // highlight center button
-    painter->setBrush(QBrush(QColor(255, 255, 255, 80), Qt::SolidPattern));
-    painter->drawPath(buttonPath);
+    QPointF center(transform.map(QPointF(0, 0)));
+    painter->drawPixmap(QPoint(qRound(center.x()), qRound(center.y())) + buttonSpriteOffset, buttonSprites[CenterButtonSprite]);
+    painter->setWorldTransform(transform);
 }
 
-void LatticeScene::drawButtonSet(QPainter *painter, const QRectF &rect, const SimpleVector<unsigned int> &indices)
+void LatticeScene::drawButtonSet(QPainter *painter, const QTransform &transform, const QRectF &rect, const ButtonSet &buttons, const QPixmap &sprite)
 {
-    for (int i = 0; i < indices.size(); ++i)
+    for (int i = buttons.first(); i != -1; i = buttons.next(i))
     {
-        if (rect.contains(latticeData->buttonPositions[indices[i]]))
-            painter->drawPath(buttonPath.translated(latticeData->buttonPositions[indices[i]]));
+        if (rect.contains(latticeData->buttonPositions[i]))
+        {
+            QPointF center(transform.map(latticeData->buttonPositions[i]));
+            painter->drawPixmap(QPoint(qRound(center.x()), qRound(center.y())) + buttonSpriteOffset, sprite);
+        }
     }
 }
 
@@ -70,28 +102,28 @@ void LatticeScene::drawForeground(QPainter *painter, const QRectF &rect)
     }
 
     painter->setBrush(darkLaneBrush);
-    drawLineSet(painter, rect, latticeData->darkIndices);
+    drawLineSet(painter, rect, latticeData->darkButtons);
     painter->setBrush(lightLaneBrush);
-    drawLineSet(painter, rect, latticeData->lightIndices);
+    drawLineSet(painter, rect, latticeData->lightButtons);
 }
 
-void LatticeScene::drawLineSet(QPainter *painter, const QRectF &rect, const SimpleVector<unsigned int> &indices)
+void LatticeScene::drawLineSet(QPainter *painter, const QRectF &rect, const ButtonSet &buttons)
 {
     // QRectF is implemented in terms of left/top/width/height, so it's faster to calculate these just once
     double rectRight = rect.right();
     double rectBottom = rect.bottom();
 
     // there is no benefit to using painter->drawRects instead of drawing them individually as I'm doing here
-    for (int i = 0; i < indices.size(); ++i)
+    for (int i = buttons.first(); i != -1; i = buttons.next(i))
     {
-        if (latticeData->buttonPositions[indices[i]].y() > rect.top() &&
-            latticeData->buttonPositions[indices[i]].y() < rectBottom &&
-            latticeData->buttonPositions[indices[i]].x() < rectRight)
+        if (latticeData->buttonPositions[i].y() > rect.top() &&
+            latticeData->buttonPositions[i].y() < rectBottom &&
+            latticeData->buttonPositions[i].x() < rectRight)
         {
-            painter->drawRect(QRectF(latticeData->buttonPositions[indices[i]].x(),             // left
-                                     latticeData->buttonPositions[indices[i]].y() - .0125,     // top
-                                     rectRight - latticeData->buttonPositions[indices[i]].x(), // width
-                                     .025));                                                   // height
+            painter->drawRect(QRectF(latticeData->buttonPositions[i].x(),             // left
+                                     latticeData->buttonPositions[i].y() - .0125,     // top
+                                     rectRight - latticeData->buttonPositions[i].x(), // width
+                                     .025));                                          // height
         }
     }
 }
@@ -149,21 +181,147 @@ void LatticeScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
     }
 }
 
-int LatticeScene::visibleButtonAt(const QPointF &point)
+int LatticeScene::gridCellAt(const QPointF &point) const
+{
+    // only valid for points within the grid
+    int column = static_cast<int>((point.x() - gridOrigin.x()) / gridCellSize);
+    int row = static_cast<int>((point.y() - gridOrigin.y()) / gridCellSize);
+    return row * gridColumns + column;
+}
+
+void LatticeScene::renderButtonSprites(const QTransform &transform, qreal devicePixelRatio)
 {
-    for (int i = 0; i < latticeData->lightIndices.size(); ++i)
+    // the view only scales and scrolls the lattice, so only its scale matters here
+    QPainterPath spritePath(QTransform::fromScale(transform.m11(), transform.m22()).map(buttonPath));
+    QRect spriteRect(spritePath.boundingRect().toAlignedRect().adjusted(-1, -1, 1, 1)); // room for the antialiased edges
+    QBrush brushes[numButtonSprites] = {darkButtonBrush, lightButtonBrush, pressedButtonBrush, QBrush(QColor(255, 255, 255, 80), Qt::SolidPattern)};
+
+    for (int i = 0; i < numButtonSprites; ++i)
     {
-        if (buttonRect.translated(latticeData->buttonPositions[latticeData->lightIndices[i]]).contains(point)
-                && buttonPath.translated(latticeData->buttonPositions[latticeData->lightIndices[i]]).contains(point))
-            return latticeData->lightIndices[i];
+        buttonSprites[i] = QPixmap(spriteRect.size() * devicePixelRatio);
+        buttonSprites[i].setDevicePixelRatio(devicePixelRatio);
+        buttonSprites[i].fill(Qt::transparent);
+
+        QPainter spritePainter(&buttonSprites[i]);
+        spritePainter.setRenderHint(QPainter::Antialiasing, true);
+        spritePainter.setPen(Qt::NoPen);
+        spritePainter.setBrush(brushes[i]);
+        spritePainter.translate(-spriteRect.topLeft());
+        spritePainter.drawPath(spritePath);
     }
 
-    for (int i = 0; i < latticeData->darkIndices.size(); ++i)
+    buttonSpriteOffset = spriteRect.topLeft();
+    buttonSpriteScaleX = transform.m11();
+    buttonSpriteScaleY = transform.m22();
+    buttonSpriteDevicePixelRatio = devicePixelRatio;
+    buttonSpritesAreStale = false;
+}
+
+void LatticeScene::updateButtonGrid()
+{
+    const ButtonSet *buttonSets[2] = {&latticeData->lightButtons, &latticeData->darkButtons};
+    double left = 0, top = 0, right = 0, bottom = 0;
+    bool foundButton = false;
+
+    for (int set = 0; set < 2; ++set)
     {
-        if (buttonRect.translated(latticeData->buttonPositions[latticeData->darkIndices[i]]).contains(point)
-                && buttonPath.translated(latticeData->buttonPositions[latticeData->darkIndices[i]]).contains(point))
-            return latticeData->darkIndices[i];
+        for (int i = buttonSets[set]->first(); i != -1; i = buttonSets[set]->next(i))
+        {
+            const QPointF &position = latticeData->buttonPositions[i];
+
+            if (!foundButton)
+            {
+                left = right = position.x();
+                top = bottom = position.y();
+                foundButton = true;
+            }
+
+            left = qMin(left, position.x());
+            right = qMax(right, position.x());
+            top = qMin(top, position.y());
+            bottom = qMax(bottom, position.y());
+        }
+    }
+
+    gridColumns = gridRows = 0;
+    gridEntries.setSize(0);
+
+    if (!foundButton)
+        return;
+
+    // A cell must be at least as large as a button so that only the
+    // neighboring cells need to be searched, but small buttons shouldn't
+    // make the grid larger than maxGridCells.
+    gridOrigin = QPointF(left, top);
+    gridCellSize = qMax(qMax(buttonRect.width(), buttonRect.height()), sqrt((right - left) * (bottom - top) / maxGridCells));
+
+    if (gridCellSize <= 0)
+        gridCellSize = 1;
+
+    for (;;)
+    {
+        gridColumns = static_cast<int>((right - left) / gridCellSize) + 1;
+        gridRows = static_cast<int>((bottom - top) / gridCellSize) + 1;
+
+        if (gridColumns * gridRows <= maxGridCells)
+            break;
+
+        gridCellSize *= 1.1; // rounding pushed the grid over its limit
+    }
+
+    // counting sort of the buttons into their cells
+    int numCells = gridColumns * gridRows;
+
+    for (int i = 0; i <= numCells; ++i)
+        gridCellStarts[i] = 0;
+
+    for (int set = 0; set < 2; ++set)
+    {
+        for (int i = buttonSets[set]->first(); i != -1; i = buttonSets[set]->next(i))
+            ++gridCellStarts[gridCellAt(latticeData->buttonPositions[i]) + 1];
+    }
+
+    for (int i = 0; i < numCells; ++i)
+    {
+        gridCellStarts[i + 1] += gridCellStarts[i];
+        gridCellFill[i] = gridCellStarts[i];
+    }
+
+    addButtonsToGrid(latticeData->lightButtons, true);
+    addButtonsToGrid(latticeData->darkButtons, false);
+    gridEntries.setSize(gridCellStarts[numCells]);
+}
+
+int LatticeScene::visibleButtonAt(const QPointF &point)
+{
+    if (gridColumns == 0)
+        return -1;
+
+    int column = static_cast<int>(floor((point.x() - gridOrigin.x()) / gridCellSize));
+    int row = static_cast<int>(floor((point.y() - gridOrigin.y()) / gridCellSize));
+    int lastColumn = qMin(column + 1, gridColumns - 1);
+    int lastRow = qMin(row + 1, gridRows - 1);
+    int darkButton = -1;
+
+    // light buttons take precedence, as before
+    for (int r = qMax(row - 1, 0); r <= lastRow; ++r)
+    {
+        for (int c = qMax(column - 1, 0); c <= lastColumn; ++c)
+        {
+            int cell = r * gridColumns + c;
+
+            for (int i = gridCellStarts[cell]; i < gridCellStarts[cell + 1]; ++i)
+            {
+                if (!buttonShape.contains(inverseButtonTransform.map(point - latticeData->buttonPositions[gridEntries[i].index])))
+                    continue;
+
+                if (gridEntries[i].isLight)
+                    return gridEntries[i].index;
+
+                darkButton = gridEntries[i].index;
+            }
+        }
     }
 
-    return -1;
+    return darkButton;
 }
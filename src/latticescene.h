@@ -1,11 +1,14 @@
 #ifndef LATTICESCENE_H
 #define LATTICESCENE_H
 #include <QtWidgets/QGraphicsScene>
+#include "buttonshapecalculator.h"
+#include "latticedata.h"
 #include "simplevector.h"
 #include <QtGui/QBrush>
+#include <QtGui/QPixmap>
+#include <QtGui/QTransform>
 
 class MIDIEventHandler;
-struct LatticeData;
 
 class LatticeScene : public QGraphicsScene
 {
@@ -18,17 +21,21 @@ public:
     // inline methods
     QRectF &getButtonRect() {return buttonRect;}
     QPainterPath &getButtonPath() {return buttonPath;}
+    void invalidateButtonSprites() {buttonSpritesAreStale = true;} // call whenever the button shape or transform changes
     QBrush &getDarkButtonBrush() {return darkButtonBrush;}
     QBrush &getLightButtonBrush() {return lightButtonBrush;}
     QBrush &getPressedButtonBrush() {return pressedButtonBrush;}
     void setButtonPath(const QPainterPath &path) {buttonPath = path;}
     void setButtonRect(const QRectF &rect) {buttonRect = rect;}
-    void setDarkButtonColor(const QColor &color) {darkButtonBrush.setColor(color);}
+    void setButtonShape(const ButtonShapeCalculator &shape, const QTransform &buttonTransform) {buttonShape = shape; inverseButtonTransform = buttonTransform.inverted();}
+    void setDarkButtonColor(const QColor &color) {darkButtonBrush.setColor(color); buttonSpritesAreStale = true;}
     void setDarkLaneColor(const QColor &color) {darkLaneBrush.setColor(color);}
-    void setLightButtonColor(const QColor &color) {lightButtonBrush.setColor(color);}
+    void setLightButtonColor(const QColor &color) {lightButtonBrush.setColor(color); buttonSpritesAreStale = true;}
     void setLightLaneColor(const QColor &color) {lightLaneBrush.setColor(color);}
     void setMIDIEventHandler(MIDIEventHandler *handler) {midiEventHandler = handler;}
-    void setPressedButtonColor(const QColor &color) {pressedButtonBrush.setColor(color);}
+    void setPressedButtonColor(const QColor &color) {pressedButtonBrush.setColor(color); buttonSpritesAreStale = true;}
+
+    void updateButtonGrid(); // call whenever the button positions, size, or visibility change
 
 protected:
     void drawBackground(QPainter *painter, const QRectF &rect);
@@ -37,8 +44,17 @@ protected:
     void mouseReleaseEvent(QGraphicsSceneMouseEvent *event);
 
 private:
-    void drawButtonSet(QPainter *painter, const QRectF &rect, const SimpleVector<unsigned int> &indices);
-    void drawLineSet(QPainter *painter, const QRectF &rect, const SimpleVector<unsigned int> &indices);
+    struct GridEntry
+    {
+        unsigned int index;
+        bool isLight;
+    };
+
+    void addButtonsToGrid(const ButtonSet &buttons, bool isLight);
+    int gridCellAt(const QPointF &point) const;
+    void drawButtonSet(QPainter *painter, const QTransform &transform, const QRectF &rect, const ButtonSet &buttons, const QPixmap &sprite);
+    void drawLineSet(QPainter *painter, const QRectF &rect, const ButtonSet &buttons);
+    void renderButtonSprites(const QTransform &transform, qreal devicePixelRatio);
     int visibleButtonAt(const QPointF &point);
 
     // these are initialized in the initializer list
@@ -52,6 +68,27 @@ private:
 
     QRectF buttonRect;
     QPainterPath buttonPath;
+    ButtonShapeCalculator buttonShape;
+    QTransform inverseButtonTransform;
+
+    // every button looks the same, so each kind is rasterized once and blitted, at the view's scale and pixel ratio
+    enum ButtonSprite {DarkButtonSprite, LightButtonSprite, PressedButtonSprite, CenterButtonSprite, numButtonSprites};
+    QPixmap buttonSprites[numButtonSprites];
+    QPoint buttonSpriteOffset; // from a button's center to its sprite's top left corner
+    double buttonSpriteScaleX;
+    double buttonSpriteScaleY;
+    qreal buttonSpriteDevicePixelRatio;
+    bool buttonSpritesAreStale;
+
+    // visible buttons bucketed by position; the buttons in cell i are gridEntries[gridCellStarts[i]] up to gridEntries[gridCellStarts[i + 1]]
+    static const int maxGridCells = 4096;
+    QPointF gridOrigin;
+    double gridCellSize;
+    int gridColumns;
+    int gridRows;
+    SimpleVector<int> gridCellStarts;
+    SimpleVector<int> gridCellFill;
+    SimpleVector<GridEntry> gridEntries;
     SimpleVector<short> pressedButtonsJ;
     SimpleVector<short> pressedButtonsK;
 };
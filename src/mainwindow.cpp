@@ -2,25 +2,38 @@
 #include "mainwindowstrings.h"
 #include "barlinecalculator.h"
 #include "barlinedrawer.h"
+#include "dynamictonality.h"
+#include "editjournal.h"
+#include "envelopecommands.h"
 #include "envelopeview.h"
+#include "hexsettings.h"
 #include "latticedata.h"
 #include "latticemanager.h"
 #include "latticescene.h"
 #include "midieventhandler.h"
 #include "midieventplayer.h"
 #include "midifilebuilder.h"
+#include "midifilereader.h"
 #include "midiportmanager.h"
+#include "playbacktimeline.h"
 #include "preferencesdialog.h"
+#include "projectfile.h"
 #include "projectsettingsdialog.h"
 #include "qdatastreamoperators.h"
+#include "sequencercommands.h"
 #include "sequencerscene.h"
 #include "sequencersplitterhandle.h"
 #include "trackmanagerdialog.h"
 #include "zoomhandler.h"
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QSaveFile>
 #include <QtCore/QSettings>
 #include <QtCore/QStandardPaths>
 #include <QtCore/QThread>
+#include <QtCore/QTimer>
 #include <QtGui/QCloseEvent>
+#include <QtGui/QScreen>
 #include <QtMultimedia/QSoundEffect>
 #include <QtWidgets/QApplication>
 #include <QtWidgets/QBoxLayout>
@@ -66,24 +79,24 @@ MainWindow::MainWindow(QWidget *parent)
 
     latticeView = new QGraphicsView;
     latticeView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
-    latticeView->setOptimizationFlags(QGraphicsView::DontAdjustForAntialiasing | QGraphicsView::DontSavePainterState);
-    latticeView->setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
+    latticeView->setOptimizationFlags(QGraphicsView::DontSavePainterState);
+    latticeView->setViewportUpdateMode(QGraphicsView::SmartViewportUpdate); // so that pressing a button repaints only that button
     latticeView->setRenderHint(QPainter::Antialiasing, true);
     latticeView->setResizeAnchor(QGraphicsView::AnchorViewCenter);
     latticeView->setFocusPolicy(Qt::NoFocus);
 
     sequencerView = new QGraphicsView;
     sequencerView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
-    sequencerView->setOptimizationFlags(QGraphicsView::DontAdjustForAntialiasing | QGraphicsView::DontSavePainterState);
-    sequencerView->setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
+    sequencerView->setOptimizationFlags(QGraphicsView::DontSavePainterState);
+    sequencerView->setViewportUpdateMode(QGraphicsView::SmartViewportUpdate); // so that cursor moves only repaint the cursor
     sequencerView->setDragMode(QGraphicsView::RubberBandDrag);
     sequencerView->setRubberBandSelectionMode(Qt::IntersectsItemBoundingRect);
 
     envelopeView = new EnvelopeView;
     envelopeView->setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
     envelopeView->setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
-    envelopeView->setOptimizationFlags(QGraphicsView::DontAdjustForAntialiasing | QGraphicsView::DontSavePainterState);
-    envelopeView->setViewportUpdateMode(QGraphicsView::FullViewportUpdate);
+    envelopeView->setOptimizationFlags(QGraphicsView::DontSavePainterState);
+    envelopeView->setViewportUpdateMode(QGraphicsView::SmartViewportUpdate);
     envelopeView->setDragMode(QGraphicsView::RubberBandDrag);
     envelopeView->setResizeAnchor(QGraphicsView::AnchorViewCenter); // prevents randomly moving left when resizing the window vertically
 
@@ -117,6 +130,28 @@ MainWindow::MainWindow(QWidget *parent)
     playbackThread = new QThread; // deleted in destructor
     midiEventPlayer = new MIDIEventPlayer(midiPortManager);
     midiEventPlayer->moveToThread(playbackThread);
+
+    // saving, and the journal of the edits since then
+    saveWatcher = new QFutureWatcher<bool>(this);
+    writingProject = false;
+    savingUndoIndex = 0;
+    lastSaveFailed = false;
+    writeQueued = false;
+    queuedWriteToRecoveryFile = false;
+    editJournal = new EditJournal(sequencerScene, trackManagerDialog, this);
+    sequencerScene->setJournal(editJournal);
+    trackManagerDialog->setJournal(editJournal);
+    compactionTimer = new QTimer(this);
+    compactionTimer->setSingleShot(true);
+    compactionTimer->setInterval(2000);
+    lastUndoIndex = 0;
+
+    // the cursor follows playback at the display's refresh rate, reading the player's timeline rather than waiting for signals
+    cursorTimer = new QTimer(this);
+    cursorTimer->setTimerType(Qt::PreciseTimer);
+    cursorTimer->setInterval(qMax(1, qRound(1000 / QGuiApplication::primaryScreen()->refreshRate())));
+    playbackStartTime = 0;
+    playbackCursorPos = 0;
     // =======================================================================
 
     // =============================================================== DIALOGS
@@ -236,6 +271,7 @@ MainWindow::MainWindow(QWidget *parent)
     actionSave->setShortcut(QKeySequence::Save);
     QAction *actionSaveAs = new QAction(tr("Save Project As"), this);
     actionSaveAs->setShortcut(QKeySequence::SaveAs);
+    QAction *actionImportMIDI = new QAction(tr("Import MIDI File"), this);
     QAction *actionExportMIDI = new QAction(tr("Export MIDI File"), this);
     QAction *actionOpenProjectSettingsDialog = new QAction(tr("Project Settings..."), this);
     actionOpenProjectSettingsDialog->setShortcut(QKeySequence("Ctrl+p"));
@@ -269,6 +305,9 @@ MainWindow::MainWindow(QWidget *parent)
     actionRotate->setData(1);
     QAction *actionShowPeriodShading = new QAction(tr("Period Shading"), this);
     actionShowPeriodShading->setCheckable(true);
+    QAction *actionBatchedTrackRendering = new QAction(tr("Draw Other Tracks in Batches"), this); // when off, every note in every track gets its own item
+    actionBatchedTrackRendering->setCheckable(true);
+    actionBatchedTrackRendering->setChecked(true); // the scene starts out batched
     QAction *actionVZoomIn = new QAction(tr("Vert. Zoom In"), this);
     actionVZoomIn->setShortcuts(QList<QKeySequence>()
         << QKeySequence(tr("Ctrl++"))
@@ -318,6 +357,7 @@ MainWindow::MainWindow(QWidget *parent)
         fileMenu->addAction(actionOpen);
         fileMenu->addAction(actionSave);
         fileMenu->addAction(actionSaveAs);
+        fileMenu->addAction(actionImportMIDI);
         fileMenu->addAction(actionExportMIDI);
         fileMenu->addSeparator();
         fileMenu->addAction(actionOpenProjectSettingsDialog);
@@ -339,6 +379,7 @@ MainWindow::MainWindow(QWidget *parent)
         viewMenu->addAction(actionRotate);
         viewMenu->addSeparator();
         viewMenu->addAction(actionShowPeriodShading);
+        viewMenu->addAction(actionBatchedTrackRendering);
         viewMenu->addSeparator();
         viewMenu->addAction(actionVZoomIn);
         viewMenu->addAction(actionVZoomOut);
@@ -406,6 +447,7 @@ MainWindow::MainWindow(QWidget *parent)
     connect(actionSave, &QAction::triggered, this, &MainWindow::onActionSave);
     connect(actionSaveAs, &QAction::triggered, this, &MainWindow::onActionSaveAs);
     connect(actionOpen, &QAction::triggered, this, &MainWindow::onActionOpen);
+    connect(actionImportMIDI, &QAction::triggered, this, &MainWindow::importMIDIFile);
     connect(actionExportMIDI, &QAction::triggered, this, &MainWindow::exportMIDIFile);
     connect(actionOpenProjectSettingsDialog, &QAction::triggered, projectSettingsDialog, &QDialog::show);
 
@@ -423,6 +465,7 @@ MainWindow::MainWindow(QWidget *parent)
         latticeScene->showPeriodShading = show;
         latticeScene->update();
     });
+    connect(actionBatchedTrackRendering, &QAction::toggled, sequencerScene, &SequencerScene::setBatchedTrackRendering);
     connect(actionVZoomIn, &QAction::triggered, zoomHandler, &ZoomHandler::zoomInLatticeVertically);
     connect(actionVZoomOut, &QAction::triggered, zoomHandler, &ZoomHandler::zoomOutLatticeVertically);
     connect(actionHZoomInLattice, &QAction::triggered, zoomHandler, &ZoomHandler::zoomInLatticeHorizontally);
@@ -461,7 +504,9 @@ MainWindow::MainWindow(QWidget *parent)
     connect(sequencerView->horizontalScrollBar(), &QAbstractSlider::valueChanged, [=] (int value) {
         envelopeView->horizontalScrollBar()->setValue(value);
         sequencerSplitterHandle->update();
+        updateVisibleSequencerTime();
     });
+    connect(sequencerView->horizontalScrollBar(), &QAbstractSlider::rangeChanged, [=](int, int){updateVisibleSequencerTime();}); // zoomed or resized
 
     // transport controls
     connect(actionRecord, &QAction::toggled, this, &MainWindow::onRecordButtonClicked);
@@ -476,6 +521,12 @@ MainWindow::MainWindow(QWidget *parent)
     connect(midiEventPlayer, &MIDIEventPlayer::beatChanged, this, &MainWindow::playBeatSound);
     connect(midiEventPlayer, &MIDIEventPlayer::measureChanged, this, &MainWindow::playMeasureSound);
     connect(midiEventPlayer, &MIDIEventPlayer::tickPositionChanged, this, &MainWindow::onTickPositionChangedWhilePlaying);
+    connect(cursorTimer, &QTimer::timeout, this, &MainWindow::updatePlaybackCursor);
+    connect(saveWatcher, &QFutureWatcher<bool>::finished, this, &MainWindow::onProjectWritten);
+    connect(compactionTimer, &QTimer::timeout, [=]() {
+        if (editJournal->wantsCompaction()) // a save in the meantime might have taken care of it
+            writeProject(currentFilePath, true);
+    });
     connect(sequencerScene, &AbstractSequencerScene::cursorMoved, midiEventPlayer, &MIDIEventPlayer::setTickPosition, Qt::DirectConnection);
     connect(envelopeScene, &AbstractSequencerScene::cursorMoved, midiEventPlayer, &MIDIEventPlayer::setTickPosition, Qt::DirectConnection);
     connect(sequencerScene, &AbstractSequencerScene::cursorMoved, envelopeScene, &AbstractSequencerScene::setCursorPos);
@@ -535,6 +586,7 @@ MainWindow::MainWindow(QWidget *parent)
     transformGroup->actions().at(settings.value("transformmode", 0).toInt())->trigger();
     latticeScene->showPeriodShading = settings.value("periodshading", true).toBool();
     actionShowPeriodShading->setChecked(latticeScene->showPeriodShading);
+    actionBatchedTrackRendering->setChecked(settings.value("batchedtrackrendering", true).toBool());
     // =======================================================================
 
 #ifdef Q_OS_WIN32
@@ -552,10 +604,16 @@ MainWindow::MainWindow(QWidget *parent)
 void MainWindow::onInitialShow()
 {
     latticeView->centerOn(0, 0);
+    updateVisibleSequencerTime();
 }
 
 MainWindow::~MainWindow()
 {
+    finishWritingProject(); // don't quit in the middle of writing the project
+    editJournal->stop(!lastSaveFailed); // Hex closed properly, so there's nothing to recover, unless the project couldn't be saved
+    sequencerScene->setJournal(0);
+    trackManagerDialog->setJournal(0);
+
     delete latticeManager; // must be deleted before sequencerScene because the destructor deletes buttons that may be in the scene
     delete undoStack;
     delete midiEventHandler;
@@ -590,6 +648,14 @@ void MainWindow::closeEvent(QCloseEvent *event)
            return;
         case QMessageBox::Save:
             onActionSaveAs();
+
+            // stay open if the project didn't get saved after all
+            finishWritingProject();
+            if (isWindowModified())
+            {
+                event->setAccepted(false);
+                return;
+            }
         // default is to descard
     }
 
@@ -610,10 +676,94 @@ void MainWindow::exportMIDIFile()
     builder.setTimeSignature(projectSettingsDialog->timeSigNum(), projectSettingsDialog->timeSigDen());
     builder.setTempo(projectSettingsDialog->tempoBPM());
     builder.setResolution(BarLineCalculator::ticksPerQuarterNote);
-    builder.setEvents(trackManagerDialog->gatherSequencerEvents(1. / projectSettingsDialog->tempoTicksPerMS()));
+
+    // the events are generated as they're written rather than gathered up first
+    double millisecondsPerTick = 1. / projectSettingsDialog->tempoTicksPerMS();
+    builder.addTrack(trackManagerDialog->globalEventSource(millisecondsPerTick));
+    for (int i = 0; i < trackManagerDialog->numTracks(); ++i)
+        builder.addTrack(trackManagerDialog->trackEventSource(i, millisecondsPerTick));
+
     builder.writeToFile(exportPath);
 }
 
+void MainWindow::finishWritingProject()
+{
+    // onProjectWritten() starts the queued write, if any, so this keeps going until there's nothing left
+    while (writingProject)
+    {
+        saveWatcher->waitForFinished();
+        onProjectWritten();
+    }
+}
+
+void MainWindow::importMIDIFile()
+{
+    int track = trackManagerDialog->currentTrack();
+    if (track == -1)
+        return;
+
+    QString importPath(QFileDialog::getOpenFileName(0, tr("Import MIDI File"), QDir::currentPath(), tr("MIDI File (*.mid *.midi)")));
+
+    if (importPath.isEmpty())
+        return;
+
+    MIDIFileReader reader;
+    if (!reader.read(importPath, BarLineCalculator::ticksPerQuarterNote))
+    {
+        QMessageBox::warning(this, tr("Import MIDI File"), tr("Couldn't read %1 as a standard MIDI file.").arg(importPath));
+        return;
+    }
+
+    // the pitches are laid out the same way as notes played in live
+    const std::vector<MIDIFileReader::Note> &notes = reader.notes();
+    SimpleVector<NoteID> importedNotes(notes.size());
+    int numNotesLeftOut = 0; // once the note store is full
+    for (size_t i = 0; i < notes.size(); ++i)
+    {
+        const MIDIFileReader::Note &note = notes[i];
+        short j = 0, k = 0;
+
+        switch (midiEventHandler->getMIDIInputType())
+        {
+        case MIDIEventHandler::Standard: DynamicTonality::captureJKFromPianoMIDI(note.pitch, j, k); break;
+        case MIDIEventHandler::AXiS: DynamicTonality::captureJKFromAxis(note.pitch, j, k); break;
+        case MIDIEventHandler::Relayer: DynamicTonality::captureJKFromRelayer(note.channel, note.pitch, j, k); break;
+        default: continue;
+        }
+
+        latticeManager->getDT()->convertWickiJKToLayoutJK(j, k);
+
+        if (j < HexSettings::minJ || j > HexSettings::maxJ || k < HexSettings::minK || k > HexSettings::maxK) // off the edge of the lattice
+            continue;
+
+        NoteID id = sequencerScene->createNote(note.start, note.duration, HexSettings::convertJKToNoteLaneIndex(j, k), note.velocity, track);
+        if (id == invalidNoteID)
+        {
+            numNotesLeftOut = static_cast<int>(notes.size() - i); // the rest won't fit either
+            break;
+        }
+
+        importedNotes.append(id);
+    }
+
+    if (numNotesLeftOut > 0)
+        QMessageBox::warning(this, tr("Import MIDI File"), tr("The project can't hold any more notes, so the import was cut short: the last %1 notes in the file were left out.").arg(numNotesLeftOut));
+
+    if (importedNotes.size() == 0 && reader.numEnvelopes() == 0)
+        return;
+
+    // the notes go in with one command, and the lot is undone in one step
+    undoStack->beginMacro(tr("Import MIDI File"));
+
+    if (importedNotes.size() > 0)
+        sequencerScene->pushUndoCommand(new AddNotesCommand(importedNotes, sequencerScene));
+
+    for (int i = 0; i < reader.numEnvelopes(); ++i)
+        sequencerScene->pushUndoCommand(new AddEnvelopeCommand(trackManagerDialog, track, trackManagerDialog->numMIDICCEnvelopes(track), reader.envelopeData(i)));
+
+    undoStack->endMacro();
+}
+
 void MainWindow::keyPressEvent(QKeyEvent *event)
 {
     if (event->isAutoRepeat() || event->modifiers() != Qt::NoModifier)
@@ -702,7 +852,8 @@ void MainWindow::onPlayButtonClicked(bool on)
 {
     if (!on)
     {
-        midiEventPlayer->stop();
+        cursorTimer->stop();
+        midiEventPlayer->stop(); // sets the final cursor position through tickPositionChanged()
         actionRecord->setChecked(false);
     }
     else
@@ -710,7 +861,10 @@ void MainWindow::onPlayButtonClicked(bool on)
         midiEventPlayer->setTempo(projectSettingsDialog->tempoTicksPerMS());
         midiEventPlayer->setEvents(trackManagerDialog->gatherSequencerEvents(1. / projectSettingsDialog->tempoTicksPerMS()));
         latticeManager->sendMIDIData();
+        playbackStartTime = PlaybackTimeline::now();
+        playbackCursorPos = sequencerScene->cursorPos();
         playbackThread->start(QThread::HighPriority);
+        cursorTimer->start();
     }
 }
 
@@ -724,6 +878,48 @@ void MainWindow::onRecordButtonClicked(bool recording)
     actionPlay->setChecked(recording);
 }
 
+void MainWindow::onProjectWritten()
+{
+    if (!writingProject)
+        return; // already handled by finishWritingProject()
+
+    writingProject = false;
+    bool succeeded = saveWatcher->result();
+    editJournal->finishRebase(succeeded);
+    QString failedFilePath(succeeded ? QString() : savingFilePath);
+
+    // the project is only clean once it's actually on disk, and only as of when it was copied
+    if (!savingFilePath.isEmpty())
+    {
+        lastSaveFailed = !succeeded;
+
+        if (succeeded && undoStack->index() == savingUndoIndex)
+            undoStack->setClean();
+        else
+            undoStack->resetClean(); // whatever was clean before isn't what's in the file now
+
+        setWindowModified(!undoStack->isClean());
+        actionSave->setEnabled(!undoStack->isClean());
+    }
+
+    // the next write takes its snapshot now, so it has everything done in the meantime
+    if (writeQueued)
+    {
+        writeQueued = false;
+
+        // the copy that was just written may have been all the compaction the journal needed
+        if (!queuedWriteToRecoveryFile || editJournal->wantsCompaction())
+            writeProject(queuedWriteFilePath, queuedWriteToRecoveryFile);
+    }
+
+    if (failedFilePath.isEmpty())
+        return; // a failed compaction leaves the old journal, which is still good
+
+    QMessageBox::warning(this,
+                         tr("Save Failed"),
+                         tr("The project couldn't be saved to ") + failedFilePath);
+}
+
 void MainWindow::onStopButtonClicked()
 {
     if (actionPlay->isChecked()) // stop
@@ -750,16 +946,34 @@ void MainWindow::onUndoStackIndexChanged()
     setWindowModified(!undoStack->isClean());
     actionSave->setEnabled(!undoStack->isClean());
 
+    // the same index later on doesn't necessarily mean the same project (e.g., undo, then something new)
+    if (writingProject)
+        savingUndoIndex = -1;
+
     if (actionPlay->isChecked())
     {
         midiEventPlayer->setTempo(projectSettingsDialog->tempoTicksPerMS());
         midiEventPlayer->setEvents(trackManagerDialog->gatherSequencerEvents(1. / projectSettingsDialog->tempoTicksPerMS()));
     }
+
+    updateJournal();
 }
 
 void MainWindow::open(const QString &filePath)
 {
-    QFile file(filePath);
+    finishWritingProject(); // it might be this file that's being written
+    compactionTimer->stop();
+    editJournal->stop(!lastSaveFailed); // the user has already chosen whether to save the project that was open, but if that failed, its journal has the changes
+
+    // a journal left next to the project means that Hex didn't close properly while it was open
+    QString recoveryBasePath(EditJournal::baseFilePath(filePath));
+    bool recovering = !recoveryBasePath.isEmpty()
+            && QMessageBox::question(this,
+                                     tr("Recover Changes"),
+                                     tr("Hex didn't close properly while this project was open. Do you want to recover the changes that weren't saved?"),
+                                     QMessageBox::Yes | QMessageBox::No) == QMessageBox::Yes;
+
+    QFile file(recovering ? recoveryBasePath : filePath);
 
     if (!file.open(QIODevice::ReadOnly))
     {
@@ -776,7 +990,7 @@ void MainWindow::open(const QString &filePath)
 
     int fileFormat;
     in >> fileFormat;
-    if (fileFormat > 1)
+    if (fileFormat > ProjectFile::formatVersion)
     {
         QMessageBox::warning(this,
                              tr("Version Problem"),
@@ -785,6 +999,54 @@ void MainWindow::open(const QString &filePath)
         return;
     }
 
+    if (fileFormat < 2)
+        readProjectVersion1(in);
+    else if (!readProjectVersion2(file.fileName()))
+    {
+        QMessageBox::warning(this,
+                             tr("File Problem"),
+                             tr("This file is damaged and can't be opened: ") + filePath);
+        return;
+    }
+
+    rewind();
+    updateWindowTitle();
+
+    if (filePath != currentFilePath)
+        return; // the blank project that File > New starts from isn't journaled
+
+    if (recovering)
+    {
+        if (!editJournal->replay(filePath))
+            QMessageBox::warning(this,
+                                 tr("Recover Changes"),
+                                 tr("Some of the changes couldn't be recovered."));
+
+        undoStack->resetClean(); // the recovered changes aren't saved yet
+        setWindowModified(true);
+        actionSave->setEnabled(true);
+    }
+
+    // a recovered journal is kept until there's a copy of the project with its changes
+    editJournal->start(filePath, recovering);
+    if (recovering)
+        writeProject(filePath, true);
+}
+
+void MainWindow::playBeatSound()
+{
+    if (actionToggleMetronomeEnabled->isChecked())
+        beatSound->play();
+}
+
+void MainWindow::playMeasureSound()
+{
+    if (actionToggleMetronomeEnabled->isChecked())
+        measureSound->play();
+}
+
+void MainWindow::readProjectVersion1(QDataStream &in)
+{
     // ========================================== RESTORE LATTICE SETUP DIALOG
     LatticeSettings savedLatticeSettings;
     in >> savedLatticeSettings;
@@ -809,21 +1071,46 @@ void MainWindow::open(const QString &filePath)
     // =======================================================================
 
     trackManagerDialog->restoreData(in);
-
-    rewind();
-    updateWindowTitle();
 }
 
-void MainWindow::playBeatSound()
+bool MainWindow::readProjectVersion2(const QString &filePath)
 {
-    if (actionToggleMetronomeEnabled->isChecked())
-        beatSound->play();
-}
+    ProjectFileReader file;
+    if (!file.open(filePath))
+        return false;
 
-void MainWindow::playMeasureSound()
-{
-    if (actionToggleMetronomeEnabled->isChecked())
-        measureSound->play();
+    // everything is read and checked before anything is changed
+    QByteArray latticeChunk(file.chunk(ProjectFile::LatticeChunk));
+    QDataStream latticeIn(latticeChunk);
+    latticeIn.setVersion(13);
+
+    LatticeSettings savedLatticeSettings;
+    double alpha, beta; // alpha won't get used in current versions of Hex
+    latticeIn >> savedLatticeSettings >> alpha >> beta;
+
+    QByteArray timingChunk(file.chunk(ProjectFile::TimingChunk));
+    QDataStream timingIn(timingChunk);
+    timingIn.setVersion(13);
+
+    qint32 gridInterval;
+    bool snapToGrid;
+    TimingSettings savedProjectTimingSettings;
+    timingIn >> gridInterval >> snapToGrid >> savedProjectTimingSettings;
+
+    if (latticeIn.status() != QDataStream::Ok || timingIn.status() != QDataStream::Ok
+            || gridInterval < 0 || gridInterval >= gridGroup->actions().size())
+        return false;
+
+    if (!trackManagerDialog->restoreChunks(file))
+        return false;
+
+    projectSettingsDialog->setLatticeSettings(savedLatticeSettings);
+    gridGroup->actions().at(gridInterval)->setChecked(true);
+    actionSnapToGrid->setChecked(snapToGrid);
+    projectSettingsDialog->setTimingSettings(savedProjectTimingSettings);
+    latticeManager->setAlpha(alpha);
+    betaSpinBox->setValue(beta);
+    return true;
 }
 
 void MainWindow::rewind()
@@ -843,24 +1130,7 @@ void MainWindow::save()
     if (!currentFilePath.endsWith(".hxp", Qt::CaseInsensitive))
         currentFilePath.append(".hxp");
 
-    QFile file(currentFilePath);
-    if (!file.open(QIODevice::WriteOnly)) // opens file for writing
-        return;
-
-    QDataStream out(&file);
-    out.setVersion(13);
-
-    out << int(1); // file format
-    out << projectSettingsDialog->getCurrentLatticeSettings();
-    out << gridGroup->checkedAction()->data().toInt();
-    out << actionSnapToGrid->isChecked();
-    out << projectSettingsDialog->getCurrentTimingSettings();
-    out << latticeManager->getDT()->period() << latticeManager->getDT()->generator();
-
-    trackManagerDialog->saveData(out);
-
-    undoStack->setClean();
-    setWindowModified(false);
+    writeProject(currentFilePath, false); // the undo stack is marked clean once it's written
     updateWindowTitle();
 
     QFileInfo currentFileInfo(currentFilePath);
@@ -906,6 +1176,7 @@ void MainWindow::setMetronomeVersion(int version)
 
 int MainWindow::showUnsavedFileWarning()
 {
+    finishWritingProject(); // a save that's still being written might yet fail
     if (!isWindowModified())
         return QMessageBox::Discard;
 
@@ -914,6 +1185,48 @@ int MainWindow::showUnsavedFileWarning()
                                 QMessageBox::Save);
 }
 
+// ends the journal's frame for whatever was just done or undone
+void MainWindow::updateJournal()
+{
+    // settings changes aren't journaled, so the journal starts over from a copy of the project instead
+    int index = undoStack->index();
+    int first = (index == lastUndoIndex) ? index - 1 : qMin(index, lastUndoIndex); // the index stays put when a command merges
+    for (int i = qMax(first, 0); i < qMax(index, lastUndoIndex); ++i)
+    {
+        const QUndoCommand *command = undoStack->command(i);
+        if (command && (command->id() == HexSettings::latticeSettingsCommandID || command->id() == HexSettings::projectTimingSettingsCommandID))
+            editJournal->requestCompaction();
+    }
+    lastUndoIndex = index;
+
+    editJournal->endCommand();
+
+    // the first request starts the timer, and the ones that come before it fires are covered by the same compaction
+    if (editJournal->wantsCompaction() && !compactionTimer->isActive())
+        compactionTimer->start();
+}
+
+void MainWindow::updatePlaybackCursor()
+{
+    qint64 publishedAt;
+    double pos = midiEventPlayer->timeline().currentTick(&publishedAt);
+
+    if (publishedAt < playbackStartTime)
+        return; // still the position from the last time it played
+
+    // The player moves a fixed number of ticks per sleep, and sleeps tend to
+    // run a little long, so a newly published position is often slightly
+    // behind the extrapolated one. The cursor waits through those small steps
+    // back (but not real jumps, like looping) instead of jittering.
+    double maxStepBack = 2 * HexSettings::sleepIntervalMilliseconds * projectSettingsDialog->tempoTicksPerMS();
+
+    if (pos < playbackCursorPos && playbackCursorPos - pos < maxStepBack)
+        return;
+
+    playbackCursorPos = pos;
+    onTickPositionChangedWhilePlaying(pos);
+}
+
 void MainWindow::updateProjectTiming()
 {
     BarLineCalculator calculator;
@@ -928,6 +1241,8 @@ void MainWindow::updateProjectTiming()
 
     // update bar line spacings
     barLineDrawer->setLineSpacings(calculator.getMeasureLength(), calculator.getBeatLength(), calculator.getGridLength());
+    sequencerScene->invalidateBackgroundCache();
+    envelopeScene->invalidateBackgroundCache();
     sequencerSplitterHandle->setMeasureLengthTicks(calculator.getMeasureLength());
     midiEventPlayer->setBeatAndMeasureLength(calculator.getBeatLength(), calculator.getMeasureLength());
 
@@ -935,6 +1250,13 @@ void MainWindow::updateProjectTiming()
     envelopeScene->setLength(calculator.getSequencerLength());
 }
 
+void MainWindow::updateVisibleSequencerTime()
+{
+    // the sequencer scene only keeps note items for what's on screen
+    QRectF visibleRect(sequencerView->mapToScene(sequencerView->viewport()->rect()).boundingRect());
+    sequencerScene->setVisibleTimeWindow(visibleRect.left(), visibleRect.right(), sequencerView->transform().m11());
+}
+
 void MainWindow::updateWindowTitle()
 {
     QString projectTitle(currentFilePath.section('/', -1)); // remove path
@@ -942,6 +1264,64 @@ void MainWindow::updateWindowTitle()
     setWindowTitle(QString("Hex - %1[*]").arg(projectTitle));
 }
 
+// Only copying happens here, on the GUI thread. The encoding, compressing and
+// writing happen on another thread, so writing doesn't freeze the UI. Saving
+// and compacting the journal both come through here, since the journal starts
+// over from whatever copy of the project was written last.
+void MainWindow::writeProject(const QString &projectFilePath, bool toRecoveryFile)
+{
+    // One at a time, so that an older one can't finish last. Rather than wait
+    // for the one being written, the newest request is queued, and a save
+    // takes the place of a compaction, since it rebases the journal too.
+    if (writingProject)
+    {
+        if (!writeQueued || !toRecoveryFile)
+        {
+            queuedWriteFilePath = projectFilePath;
+            queuedWriteToRecoveryFile = toRecoveryFile;
+        }
+
+        writeQueued = true;
+        return;
+    }
+
+    QString filePath(editJournal->beginRebase(projectFilePath, toRecoveryFile));
+    savingFilePath = toRecoveryFile ? QString() : projectFilePath;
+    savingUndoIndex = undoStack->index();
+    writingProject = true;
+
+    // ======================================================= TAKE A SNAPSHOT
+    QByteArray latticeChunk;
+    QDataStream latticeOut(&latticeChunk, QIODevice::WriteOnly);
+    latticeOut.setVersion(13);
+    latticeOut << projectSettingsDialog->getCurrentLatticeSettings();
+    latticeOut << latticeManager->getDT()->period() << latticeManager->getDT()->generator();
+
+    QByteArray timingChunk;
+    QDataStream timingOut(&timingChunk, QIODevice::WriteOnly);
+    timingOut.setVersion(13);
+    timingOut << qint32(gridGroup->checkedAction()->data().toInt());
+    timingOut << actionSnapToGrid->isChecked();
+    timingOut << projectSettingsDialog->getCurrentTimingSettings();
+
+    TrackManagerDialog::Snapshot tracks(trackManagerDialog->snapshot());
+
+    // ============================================ WRITE IN THE BACKGROUND
+    saveWatcher->setFuture(QtConcurrent::run([filePath, latticeChunk, timingChunk, tracks]() {
+        ProjectFileWriter writer;
+        writer.addChunk(ProjectFile::LatticeChunk, 0, latticeChunk);
+        writer.addChunk(ProjectFile::TimingChunk, 0, timingChunk);
+        TrackManagerDialog::saveChunks(tracks, writer);
+
+        // the project is only replaced once the whole file has been written
+        QSaveFile file(filePath);
+        if (!file.open(QIODevice::WriteOnly) || !writer.write(&file))
+            return false;
+
+        return file.commit();
+    }));
+}
+
 void MainWindow::writeSettings()
 {
     QSettings settings(QCoreApplication::applicationDirPath() + "/support/settings.ini", QSettings::IniFormat);
@@ -960,6 +1340,7 @@ void MainWindow::writeSettings()
     // save lattice properties
     settings.setValue("transformmode", latticeManager->getTransformMode());
     settings.setValue("periodshading", latticeScene->showPeriodShading);
+    settings.setValue("batchedtrackrendering", sequencerScene->batchedTrackRendering());
 
     // save metronome state
     settings.setValue("metronomeenabled", actionToggleMetronomeEnabled->isChecked());
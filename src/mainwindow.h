@@ -4,6 +4,7 @@
 
 class AbstractSequencerScene;
 class BarLineDrawer;
+class EditJournal;
 class EnvelopeScene;
 class EnvelopeView;
 class LatticeManager;
@@ -15,18 +16,21 @@ class PreferencesDialog;
 class ProjectSettingsDialog;
 class QAction;
 class QActionGroup;
+class QDataStream;
 class QDoubleSpinBox;
 class QGraphicsView;
 class QSlider;
 class QSoundEffect;
 class QSplitter;
 class QThread;
+class QTimer;
 class QUndoStack;
 class SequencerScene;
 class SequencerSplitterHandle;
 class TrackManagerDialog;
 class ZoomHandler;
 struct LatticeData;
+template <typename T> class QFutureWatcher;
 
 class MainWindow : public QMainWindow
 {
@@ -38,6 +42,7 @@ public:
     ~MainWindow();
     void alignLatticeWithSequencer();
     void exportMIDIFile();
+    void importMIDIFile();
     void onActionNew();
     void onActionOpen();
     void onActionSave();
@@ -45,12 +50,14 @@ public:
     void onBetaChangedWhilePlaying(double beta);
     void onPlayButtonClicked(bool on);
     void onRecordButtonClicked(bool recording);
+    void onProjectWritten();
     void onStopButtonClicked();
     void onTickPositionChangedWhilePlaying(double pos);
     void onUndoStackIndexChanged();
     void playBeatSound();
     void playMeasureSound();
     void setMetronomeVersion(int version);
+    void updatePlaybackCursor();
     void updateProjectTiming();
 
     // inline methods
@@ -66,12 +73,18 @@ protected:
     void keyReleaseEvent(QKeyEvent *event);
 
 private:
+    void finishWritingProject(); // waits for the project being written in the background, if any, and for the write queued after it
     void open(const QString &filePath);
+    void readProjectVersion1(QDataStream &in);
+    bool readProjectVersion2(const QString &filePath); // returns false if the file is damaged
     int showUnsavedFileWarning();
     void rewind();
     void save();
     AbstractSequencerScene *sequencerWithFocus() const;
+    void updateJournal();
+    void updateVisibleSequencerTime();
     void updateWindowTitle();
+    void writeProject(const QString &projectFilePath, bool toRecoveryFile);
     void writeSettings();
 
     // these are initialized in the initializer list
@@ -118,6 +131,20 @@ private:
     QSplitter *latSeqSplitter;
     QSplitter *seqEnvSplitter;
     QThread *playbackThread;
+    QTimer *cursorTimer; // moves the cursor once per frame while playing
+    QFutureWatcher<bool> *saveWatcher; // the project being written in the background, if any
+    bool writingProject;
+    QString savingFilePath; // empty when the journal is being compacted
+    int savingUndoIndex; // the undo stack's index when the project being saved was copied, or -1 if it's changed since
+    bool lastSaveFailed; // the journal is kept then, since it has the only copy of the changes
+    bool writeQueued; // to start once the one being written finishes
+    QString queuedWriteFilePath;
+    bool queuedWriteToRecoveryFile;
+    EditJournal *editJournal;
+    QTimer *compactionTimer; // so that a burst of changes the journal doesn't record leads to one compaction
+    int lastUndoIndex;
+    qint64 playbackStartTime;
+    double playbackCursorPos;
     ZoomHandler *zoomHandler;
     QByteArray seqEnvSplitterState;
 };
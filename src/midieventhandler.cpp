@@ -130,7 +130,7 @@ void MIDIEventHandler::startRecording(SequencerScene *scene)
 {
     sequencerScene = scene;
     recording = true;
-    recordedNotes = SimpleVector<QGraphicsItem*>(200);
+    recordedNotes = SimpleVector<NoteID>(200);
 }
 
 void MIDIEventHandler::stopRecording()
@@ -143,6 +143,6 @@ void MIDIEventHandler::stopRecording()
         sequencerScene->pushUndoCommand(addNotesCommand);
     }
 
-    recordedNotes = SimpleVector<QGraphicsItem*>();
+    recordedNotes = SimpleVector<NoteID>();
     sequencerScene = NULL;
 }
@@ -1,9 +1,9 @@
 #ifndef MIDIEVENTHANDLER_H
 #define MIDIEVENTHANDLER_H
+#include "notestore.h"
 #include "notestruct.h"
 #include "simplevector.h"
 #include <QtCore/QObject>
-#include <QtWidgets/QGraphicsItem>
 
 class QKeyEvent;
 class LatticeManager;
@@ -40,7 +40,7 @@ private:
     MIDIInputType midiInputType;
 
     SimpleVector<NoteStruct> heldNotes;
-    SimpleVector<QGraphicsItem*> recordedNotes;
+    SimpleVector<NoteID> recordedNotes;
 };
 
 #endif
@@ -77,7 +77,7 @@ void MIDIEventPlayer::play()
             ++currentEventIndex;
         }
 
-        // check if it's time to update the GUI
+        // check if it's time to update the GUI (the cursor isn't updated here; the GUI reads the timeline instead)
         if (sleepIntervalCounter >= HexSettings::numSleepIntervalsBetweenGUIUpdates)
         {
             if (betaHasChangedSinceLastGUIUpdate)
@@ -86,7 +86,6 @@ void MIDIEventPlayer::play()
                 betaHasChangedSinceLastGUIUpdate = false;
             }
 
-            emit tickPositionChanged(tickPosition);
             sleepIntervalCounter = 0;
         }
         else
@@ -120,6 +119,8 @@ void MIDIEventPlayer::play()
         // check if the loop end has been reached
         if (loopEnabled && playWasStartedBeforeLoopEnd && tickPosition > loopEnd)
             setTickPosition(loopStart);
+
+        m_timeline.publish(tickPosition, ticksPerSleepInterval / HexSettings::sleepIntervalMilliseconds);
     }
 }
 
@@ -233,6 +234,7 @@ void MIDIEventPlayer::start()
 
     playPreviousEnvelopeEvents();
 
+    m_timeline.publish(tickPosition, ticksPerSleepInterval / HexSettings::sleepIntervalMilliseconds);
     play(); // enter a recursive play loop
 }
 
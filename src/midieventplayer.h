@@ -1,6 +1,7 @@
 #ifndef MIDIEVENTPLAYER_H
 #define MIDIEVENTPLAYER_H
 #include <QtCore/QObject>
+#include "playbacktimeline.h"
 #include "sequencerevent.h"
 #include "simplevector.h"
 
@@ -24,13 +25,14 @@ public:
     // inline
     void disableLoop() {loopEnabled = false;}
     void temporarilyDisableBetaOutput() {betaOutputEnabled = false;}
+    const PlaybackTimeline &timeline() const {return m_timeline;} // the GUI polls this for the cursor position while playing
 
 signals:
     void beatChanged();
     void betaChanged(double beta);
     void finished();
     void measureChanged();
-    void tickPositionChanged(double ticks);
+    void tickPositionChanged(double ticks); // only emitted when playback stops
 
 private:
     void allNotesOff();
@@ -59,6 +61,7 @@ private:
     double nextMeasureTime;
     float lastBetaValue;
     bool betaHasChangedSinceLastGUIUpdate;
+    PlaybackTimeline m_timeline;
 };
 
 #endif
@@ -1,24 +1,16 @@
 #include "midifilebuilder.h"
 #include "dynamictonality.h"
-#include "simplevector.h"
-#include <QtCore/QDataStream>
+#include "miditrackencoder.h"
+#include "sequencereventsource.h"
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtCore/QFile>
 
 #define CONTROL_CHANGE 0xb0
-#define END_OF_TRACK 0x2f
-#define META_EVENT 0xff
 #define NOTE_OFF 0x80
 #define NOTE_ON 0x90
-#define TEMPO 0x51
-#define TIME_SIGNATURE 0x58
 
 MIDIFileBuilder::MIDIFileBuilder()
     :
-      m_dataStream(0),
-      m_eventVectors(NULL),
-      m_numBytesWritten(0),
-      m_numTracks(0),
-      m_previousStatus(0),
       m_tempoMicrosecsPerQuarterNote(1000000),
       m_ticksPerQuarterNote(480),
       m_timeSigDenom(2), // expressed as exponent of 2
@@ -28,286 +20,130 @@ MIDIFileBuilder::MIDIFileBuilder()
 
 MIDIFileBuilder::~MIDIFileBuilder()
 {
-    if (m_eventVectors != NULL)
-        delete [] m_eventVectors;
+    for (size_t i = 0; i < m_tracks.size(); ++i)
+        delete m_tracks[i];
 }
 
-void MIDIFileBuilder::setTimeSignature(int numerator, int denominator)
-{
-    m_timeSigNumer = numerator;
-
-    // convert denominator to exponent of 2
-    switch (denominator)
-    {
-        case 1: m_timeSigDenom = 0; break;
-        case 2: m_timeSigDenom = 1; break;
-        case 4: m_timeSigDenom = 2; break;
-        case 8: m_timeSigDenom = 3; break;
-        case 16: m_timeSigDenom = 4; break;
-        case 32: m_timeSigDenom = 5; break;
-    }
-}
-
-void MIDIFileBuilder::setTempo(double tempoBPM)
+void MIDIFileBuilder::addTrack(SequencerEventSource *events)
 {
-    m_tempoMicrosecsPerQuarterNote = 60000000 / tempoBPM;
+    m_tracks.push_back(events);
 }
 
-void MIDIFileBuilder::setResolution(int ticksPerQuarterNote)
+QByteArray MIDIFileBuilder::encodeTrack(int track) const
 {
-    m_ticksPerQuarterNote = ticksPerQuarterNote;
-}
+    SequencerEventSource *events = m_tracks[track];
 
-void MIDIFileBuilder::setEvents(const SimpleVector<SequencerEvent> &events)
-{
-    if (m_eventVectors != NULL)
-        delete [] m_eventVectors;
+    // a typical event takes about four bytes, but each DT envelope event becomes three MIDI CC events
+    QByteArray chunk;
+    MIDITrackEncoder encoder(chunk, events->estimatedCount() * (track == conductorTrack ? 12 : 4));
 
-    // ======================================================= FIND NUM TRACKS
-    int highestTrack = 0;
-    for (int i = 0; i < events.size(); ++i)
-    {
-        switch (events[i].type)
-        {
-        case SequencerEvent::MIDICC:
-        case SequencerEvent::MIDINoteOn:
-        case SequencerEvent::MIDINoteOff:
-            if (events[i].midiData.track > highestTrack)
-                highestTrack = events[i].midiData.track;
-            break;
-        default: // there shouldn't be any other types
-            break;
-        }
-    }
-
-    m_numTracks = highestTrack + 1;
-    m_eventVectors = new std::vector<SequencerEvent>[m_numTracks];
-    // =======================================================================
-
-    // ================================ SEPARATE EVENTS INTO DIFFERENT VECTORS
-    for (int i = 0; i < events.size(); ++i)
-    {
-        switch (events[i].type)
-        {
-        case SequencerEvent::Period:
-        case SequencerEvent::Generator:
-        case SequencerEvent::Harmonicity:
-        case SequencerEvent::JI:
-            for (int j = 0; j < m_numTracks; ++j) // the DT envelopes get sent to all tracks
-            {
-                m_eventVectors[j].push_back(events[i]);
-            }
-            break;
-        case SequencerEvent::MIDICC:
-        case SequencerEvent::MIDINoteOn:
-        case SequencerEvent::MIDINoteOff:
-        case SequencerEvent::MIDIOther:
-            m_eventVectors[events[i].midiData.track].push_back(events[i]);
-            break;
-        default: break;
-        }
-    }
-    // =======================================================================
-
-    // ================================================ CONVERT TO DELTA TICKS
-    for (int i = 0; i < m_numTracks; ++i)
+    // ==================================================== WRITE TRACK EVENTS
+    if (track == conductorTrack)
     {
-        unsigned int prevTicks = 0;
-        for (unsigned int j = 0; j < m_eventVectors[i].size(); ++j)
-        {
-            unsigned int temp = m_eventVectors[i][j].ticks;
-            m_eventVectors[i][j].ticks -= prevTicks;
-            prevTicks = temp;
-        }
+        encoder.writeTempo(0, m_tempoMicrosecsPerQuarterNote);
+        encoder.writeTimeSignature(0, m_timeSigNumer, m_timeSigDenom, 24, 8);
     }
-    // =======================================================================
-
-}
-
-void MIDIFileBuilder::writeToFile(const QString& fileName) // writes to file
-{
-    QFile file(fileName);
-    file.open(QIODevice::WriteOnly);
-    QDataStream ds(&file);
-    m_dataStream = &ds;
 
-    // write header
-    m_previousStatus = 0;
-    write4Bytes(0x4d546864); // SMF header prefix
-    write4Bytes(6); // represents the 4-byte size of the header (this never changes in a SMF)
-    write2Bytes(0); // 0 is format
-    write2Bytes(m_numTracks);
-    write2Bytes(m_ticksPerQuarterNote);
+    SequencerEvent event;
+    unsigned int previousTicks = 0;
+    events->rewind();
 
-    // write tracks
-    m_previousStatus = 0;
-    for (int i = 0; i < m_numTracks; ++i)
+    while (events->next(event))
     {
-        writeTrack(i);
-    }
-
-    file.close();
-}
-
-void MIDIFileBuilder::writeTrack(int track)
-{
-    quint32 trackHeader;
-    quint32 trackLength;
-    qint64 offset;
-    qint64 placeMarker;
-
-    m_previousStatus = 0;
-    trackHeader = 0x4d54726b; // track prefix
-    trackLength = 0; // track length (will change later???)
-    offset = m_dataStream->device()->pos();
-    write4Bytes(trackHeader);
-    write4Bytes(trackLength);
-    m_numBytesWritten = 0;
-
-    // ==================================================== WRITE TRACK EVENTS
-    writeTempo(0, m_tempoMicrosecsPerQuarterNote);
-    writeTimeSignature(0, m_timeSigNumer, m_timeSigDenom, 24, 8);
+        unsigned int deltaTicks = event.ticks - previousTicks;
+        previousTicks = event.ticks;
 
-    for (unsigned int i = 0; i < m_eventVectors[track].size(); ++i)
-    {
-        switch (m_eventVectors[track][i].type)
+        switch (event.type)
         {
         case SequencerEvent::Period:
             unsigned char cc50, cc51, cc52;
-            DynamicTonality::captureMIDICCValues(m_eventVectors[track][i].value, cc50, cc51, cc52);
-            writeMidiEvent(m_eventVectors[track][i].ticks, CONTROL_CHANGE, 0, 50, cc50);
-            writeMidiEvent(0,                              CONTROL_CHANGE, 0, 51, cc51);
-            writeMidiEvent(0,                              CONTROL_CHANGE, 0, 52, cc52);
+            DynamicTonality::captureMIDICCValues(event.value, cc50, cc51, cc52);
+            encoder.writeMidiEvent(deltaTicks, CONTROL_CHANGE, 0, 50, cc50);
+            encoder.writeMidiEvent(0,          CONTROL_CHANGE, 0, 51, cc51);
+            encoder.writeMidiEvent(0,          CONTROL_CHANGE, 0, 52, cc52);
             break;
         case SequencerEvent::Generator:
             unsigned char cc20, cc21, cc22;
-            DynamicTonality::captureMIDICCValues(m_eventVectors[track][i].value, cc20, cc21, cc22);
-            writeMidiEvent(m_eventVectors[track][i].ticks, CONTROL_CHANGE, 0, 20, cc20);
-            writeMidiEvent(0,                              CONTROL_CHANGE, 0, 21, cc21);
-            writeMidiEvent(0,                              CONTROL_CHANGE, 0, 22, cc22);
+            DynamicTonality::captureMIDICCValues(event.value, cc20, cc21, cc22);
+            encoder.writeMidiEvent(deltaTicks, CONTROL_CHANGE, 0, 20, cc20);
+            encoder.writeMidiEvent(0,          CONTROL_CHANGE, 0, 21, cc21);
+            encoder.writeMidiEvent(0,          CONTROL_CHANGE, 0, 22, cc22);
             break;
         case SequencerEvent::MIDICC:
-            writeMidiEvent(m_eventVectors[track][i].ticks, CONTROL_CHANGE, m_eventVectors[track][i].midiData.byte1 - 175, m_eventVectors[track][i].midiData.byte2, m_eventVectors[track][i].midiData.byte3);
+            encoder.writeMidiEvent(deltaTicks, CONTROL_CHANGE, event.midiData.byte1 - 175, event.midiData.byte2, event.midiData.byte3);
             break;
         case SequencerEvent::MIDINoteOn:
-            writeMidiEvent(m_eventVectors[track][i].ticks, NOTE_ON, m_eventVectors[track][i].midiData.byte1 - 143, m_eventVectors[track][i].midiData.byte2, m_eventVectors[track][i].midiData.byte3);
+            encoder.writeMidiEvent(deltaTicks, NOTE_ON, event.midiData.byte1 - 143, event.midiData.byte2, event.midiData.byte3);
             break;
         case SequencerEvent::MIDINoteOff:
-            writeMidiEvent(m_eventVectors[track][i].ticks, NOTE_ON, m_eventVectors[track][i].midiData.byte1 - 143, m_eventVectors[track][i].midiData.byte2, 0);
+            encoder.writeMidiEvent(deltaTicks, NOTE_ON, event.midiData.byte1 - 143, event.midiData.byte2, 0);
             break;
         default: // there shouldn't be any others
+            previousTicks -= deltaTicks; // nothing was written, so the next event's delta time includes this one's
             break;
         }
     }
-
-    writeMetaEvent(0, END_OF_TRACK);
     // =======================================================================
 
-    placeMarker = m_dataStream->device()->pos();
-    m_dataStream->device()->seek(offset);
-    trackLength = m_numBytesWritten;
-    write4Bytes(trackHeader);
-    write4Bytes(trackLength);
-    m_dataStream->device()->seek(placeMarker);
+    encoder.finish();
+    return chunk;
 }
 
-void MIDIFileBuilder::writeMetaEvent(long deltaTicks, int type, int data)
-{
-    writeVarLen(deltaTicks);
-    writeByte(META_EVENT);
-    writeByte(type);
-    writeByte(1);
-    writeByte(data);
-    m_previousStatus = META_EVENT;
-}
-
-void MIDIFileBuilder::writeMetaEvent(long deltaTicks, int type)
+void MIDIFileBuilder::setTimeSignature(int numerator, int denominator)
 {
-    writeVarLen(deltaTicks);
-    writeByte(META_EVENT);
-    writeByte(type);
-    writeByte(0);
-    m_previousStatus = META_EVENT;
-}
+    m_timeSigNumer = numerator;
 
-void MIDIFileBuilder::writeMidiEvent(long deltaTicks, int type, int chan, int b1)
-{
-    writeVarLen(deltaTicks);
-    quint8 c = type | chan;
-    if (m_previousStatus != c) // check if we can omit status byte ("running status")
+    // convert denominator to exponent of 2
+    switch (denominator)
     {
-        m_previousStatus = c;
-        writeByte(c);
+        case 1: m_timeSigDenom = 0; break;
+        case 2: m_timeSigDenom = 1; break;
+        case 4: m_timeSigDenom = 2; break;
+        case 8: m_timeSigDenom = 3; break;
+        case 16: m_timeSigDenom = 4; break;
+        case 32: m_timeSigDenom = 5; break;
     }
-    writeByte(b1);
-}
-
-void MIDIFileBuilder::writeMidiEvent(long deltaTicks, int type, int chan, int b1, int b2)
-{
-    writeMidiEvent(deltaTicks, type, chan, b1);
-    writeByte(b2);
-}
-
-void MIDIFileBuilder::writeTempo(long deltaTicks, long tempoMicrosecondsPerQuarterNote)
-{
-    writeVarLen(deltaTicks);
-    writeByte(META_EVENT);
-    writeByte(TEMPO);
-    writeByte(3); // number of bytes to follow
-    writeByte((tempoMicrosecondsPerQuarterNote >> 16) & 0xff);
-    writeByte((tempoMicrosecondsPerQuarterNote >> 8) & 0xff);
-    writeByte(tempoMicrosecondsPerQuarterNote & 0xff);
-    m_previousStatus = META_EVENT;
 }
 
-void MIDIFileBuilder::writeTimeSignature(long deltaTicks, int num, int den, int cc = 24, int bb = 8)
+void MIDIFileBuilder::setTempo(double tempoBPM)
 {
-    writeVarLen(deltaTicks);
-    writeByte(META_EVENT);
-    writeByte(TIME_SIGNATURE);
-    writeByte(4); // number of bytes to follow
-    writeByte(num & 0xff);
-    writeByte(den & 0xff); // denominator is exponent power of 2
-    writeByte(cc & 0xff); // cc is number of MIDI clocks in a metronome click (24 should be OK)
-    writeByte(bb & 0xff); // bb is number of 32nd notes per quarter note (usually 8)
-    m_previousStatus = META_EVENT;
+    m_tempoMicrosecsPerQuarterNote = 60000000 / tempoBPM;
 }
 
-void MIDIFileBuilder::writeByte(quint8 value) // puts a single byte into the stream
+void MIDIFileBuilder::setResolution(int ticksPerQuarterNote)
 {
-    *m_dataStream << value;
-    m_numBytesWritten++;
+    m_ticksPerQuarterNote = ticksPerQuarterNote;
 }
 
-void MIDIFileBuilder::write2Bytes(quint16 data)
+void MIDIFileBuilder::writeToFile(const QString& fileName) // writes to file
 {
-    writeByte((data >> 8) & 0xff);
-    writeByte(data & 0xff);
-}
+    QFile file(fileName);
+    file.open(QIODevice::WriteOnly);
 
-void MIDIFileBuilder::write4Bytes(quint32 data)
-{
-    writeByte((data >> 24) & 0xff);
-    writeByte((data >> 16) & 0xff);
-    writeByte((data >> 8) & 0xff);
-    writeByte(data & 0xff);
-}
+    // The tracks are independent, so each one is encoded on a worker thread
+    // into its own buffer, and the buffers are written to the file in order.
+    std::vector<QFuture<QByteArray> > chunks;
+    chunks.reserve(m_tracks.size());
 
-void MIDIFileBuilder::writeVarLen(quint64 value)
-{
-    quint64 buffer = value & 0x7f;
-    while ((value >>= 7) > 0)
+    for (size_t i = 0; i < m_tracks.size(); ++i)
     {
-        buffer <<= 8;
-        buffer |= 0x80;
-        buffer += (value & 0x7f);
+        chunks.push_back(QtConcurrent::run([this, i]() {return encodeTrack(i);}));
     }
-    while (true)
+
+    // write header
+    int numTracks = m_tracks.size();
+    const char header[14] = {'M', 'T', 'h', 'd',
+                             0, 0, 0, 6, // the size of the rest of the header (this never changes in a SMF)
+                             0, 1, // format 1: the tracks play at once, and the first one has the tempo and such
+                             char(numTracks >> 8), char(numTracks),
+                             char(m_ticksPerQuarterNote >> 8), char(m_ticksPerQuarterNote)};
+    file.write(header, sizeof(header));
+
+    // write tracks
+    for (size_t i = 0; i < chunks.size(); ++i)
     {
-        writeByte(buffer & 0xff);
-        if (buffer & 0x80)
-            buffer >>= 8;
-        else
-            break;
+        file.write(chunks[i].result());
     }
+
+    file.close();
 }
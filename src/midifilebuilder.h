@@ -1,12 +1,10 @@
 #ifndef MIDIFILEBUILDER_H
 #define MIDIFILEBUILDER_H
-#include "sequencerevent.h"
+#include <QtCore/QByteArray>
 #include <QtCore/QObject>
 #include <vector>
 
-class QDataStream;
-template <class SequencerEvent>
-class SimpleVector;
+class SequencerEventSource;
 
 class MIDIFileBuilder
 {
@@ -16,29 +14,18 @@ public:
     void setTimeSignature(int numerator, int denominator);
     void setTempo(double tempoBPM);
     void setResolution(int ticksPerQuarterNote);
-    void setEvents(const SimpleVector<SequencerEvent> &events);
+    void addTrack(SequencerEventSource *events); // takes ownership of events
     void writeToFile(const QString& fileName);
 
 private:
-    void writeTrack(int track);
+    QByteArray encodeTrack(int track) const; // the whole chunk; different tracks can be encoded in parallel
 
-    void writeMetaEvent(long deltaTicks, int type, int data);
-    void writeMetaEvent(long deltaTicks, int type);
-    void writeMidiEvent(long deltaTicks, int type, int chan, int b1);
-    void writeMidiEvent(long deltaTicks, int type, int chan, int b1, int b2);
-    void writeTempo(long deltaTicks, long m_tempoMicrosecsPerQuarterNote);
-    void writeTimeSignature(long deltaTicks, int num, int den, int cc, int bb);
+    // The file's first track is the conductor track, with the tempo, time
+    // signature, and DT envelopes, which apply to every track. Each of the
+    // sequencer's tracks is the file track after it.
+    static const int conductorTrack = 0;
 
-    void writeByte(quint8 value);
-    void write2Bytes(quint16 data);
-    void write4Bytes(quint32 data);
-    void writeVarLen(quint64 value);
-
-    QDataStream *m_dataStream;
-    std::vector<SequencerEvent> *m_eventVectors;
-    quint64 m_numBytesWritten;
-    int m_numTracks;
-    int m_previousStatus;
+    std::vector<SequencerEventSource*> m_tracks; // the events of each file track, including the conductor track
     int m_tempoMicrosecsPerQuarterNote;
     int m_ticksPerQuarterNote;
     int m_timeSigDenom;
@@ -0,0 +1,366 @@
+#include "midifilereader.h"
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtCore/QFile>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#define CONTROL_CHANGE 0xb0
+#define NOTE_OFF 0x80
+#define NOTE_ON 0x90
+
+static quint32 readBigEndian(const uchar *data, int numBytes)
+{
+    quint32 value = 0;
+
+    for (int i = 0; i < numBytes; ++i)
+        value = (value << 8) | data[i];
+
+    return value;
+}
+
+// returns false if the quantity runs off the end of the track or is longer than four bytes
+static bool readVariableLength(const uchar *data, quint32 length, quint32 &pos, quint32 &value)
+{
+    value = 0;
+
+    for (int i = 0; i < 4; ++i)
+    {
+        if (pos >= length)
+            return false;
+
+        uchar byte = data[pos++];
+        value = (value << 7) | (byte & 0x7f);
+
+        if (!(byte & 0x80))
+            return true;
+    }
+
+    return false;
+}
+
+// ###########################################################################
+// ###########################################################################
+
+// a decoding error just ends the track early, keeping whatever came before it
+void MIDIFileReader::decodeTrack(TrackData &track, double tickScale)
+{
+    struct HeldNote
+    {
+        quint64 start;
+        unsigned char velocity;
+    };
+
+    // notes that are on, by channel * 128 + pitch; a stack so that repeated
+    // note ons are paired with note offs last in, first out
+    std::vector<std::vector<HeldNote> > heldNotes(16 * 128);
+    track.controllers.resize(16 * 128);
+
+    const uchar *data = track.data;
+    quint32 pos = 0;
+    quint64 tick = 0;
+    uchar runningStatus = 0;
+
+    while (pos < track.length)
+    {
+        quint32 deltaTicks;
+        if (!readVariableLength(data, track.length, pos, deltaTicks) || pos >= track.length)
+            break;
+
+        tick += deltaTicks;
+
+        uchar status = data[pos];
+        if (status & 0x80)
+            ++pos;
+        else if (runningStatus != 0)
+            status = runningStatus;
+        else
+            break;
+
+        if (status == 0xff) // meta event
+        {
+            if (pos >= track.length)
+                break;
+
+            uchar type = data[pos++];
+            quint32 eventLength;
+            if (!readVariableLength(data, track.length, pos, eventLength) || eventLength > track.length - pos)
+                break;
+
+            pos += eventLength;
+
+            if (type == 0x2f) // end of track
+                break;
+
+            continue;
+        }
+
+        if (status == 0xf0 || status == 0xf7) // sysex
+        {
+            runningStatus = 0;
+
+            quint32 eventLength;
+            if (!readVariableLength(data, track.length, pos, eventLength) || eventLength > track.length - pos)
+                break;
+
+            pos += eventLength;
+            continue;
+        }
+
+        if (status >= 0xf0) // system common and real time messages don't belong in files
+            break;
+
+        runningStatus = status;
+
+        uchar type = status & 0xf0;
+        int numDataBytes = (type == 0xc0 || type == 0xd0) ? 1 : 2;
+        if (track.length - pos < static_cast<quint32>(numDataBytes))
+            break;
+
+        uchar channel = status & 0x0f;
+        uchar byte1 = data[pos] & 0x7f;
+        uchar byte2 = numDataBytes == 2 ? data[pos + 1] & 0x7f : 0;
+        pos += numDataBytes;
+
+        if (type == NOTE_ON && byte2 != 0)
+        {
+            HeldNote held = {tick, byte2};
+            heldNotes[channel * 128 + byte1].push_back(held);
+        }
+        else if (type == NOTE_OFF || type == NOTE_ON)
+        {
+            std::vector<HeldNote> &held = heldNotes[channel * 128 + byte1];
+            if (held.empty())
+                continue;
+
+            Note note = {held.back().start * tickScale, (tick - held.back().start) * tickScale, channel, byte1, held.back().velocity};
+            track.notes.push_back(note);
+            held.pop_back();
+        }
+        else if (type == CONTROL_CHANGE)
+        {
+            ControllerChange change = {tick, byte2};
+            track.controllers[channel * 128 + byte1].push_back(change);
+        }
+    }
+
+    // end any notes that are still on where the track ends
+    for (int i = 0; i < 16 * 128; ++i)
+    {
+        for (size_t n = 0; n < heldNotes[i].size(); ++n)
+        {
+            const HeldNote &held = heldNotes[i][n];
+            Note note = {held.start * tickScale, (tick - held.start) * tickScale,
+                         static_cast<unsigned char>(i / 128), static_cast<unsigned char>(i % 128), held.velocity};
+            track.notes.push_back(note);
+        }
+    }
+}
+
+EnvelopeData MIDIFileReader::envelopeData(int index) const
+{
+    const Envelope &envelope = m_envelopes[index];
+    int count = static_cast<int>(envelope.ticks.size());
+
+    unsigned int *keys = new unsigned int[count];
+    float *values = new float[count];
+    std::copy(envelope.ticks.begin(), envelope.ticks.end(), keys);
+    std::copy(envelope.values.begin(), envelope.values.end(), values);
+
+    // the envelope's channel is one based, like the rest of the sequencer's
+    EnvelopeData data = {static_cast<unsigned char>(envelope.channel + 1), envelope.ccNumber, SimpleMap<unsigned int, float>(keys, values, count)};
+    return data;
+}
+
+bool MIDIFileReader::read(const QString &fileName, int ticksPerQuarterNote)
+{
+    m_notes.clear();
+    m_envelopes.clear();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 fileSize = file.size();
+    if (fileSize < 14 || fileSize > 0xffffffff)
+        return false;
+
+    const uchar *data = file.map(0, fileSize);
+    if (!data)
+        return false;
+
+    quint32 length = static_cast<quint32>(fileSize);
+
+    // ========================================================== READ HEADER
+    quint32 headerLength = readBigEndian(data + 4, 4);
+    if (memcmp(data, "MThd", 4) != 0 || headerLength < 6 || headerLength > length - 8)
+        return false;
+
+    int format = readBigEndian(data + 8, 2);
+    int numTracks = readBigEndian(data + 10, 2);
+    int division = readBigEndian(data + 12, 2);
+    if (format > 1 || numTracks == 0 || division == 0 || (division & 0x8000)) // no format 2 or SMPTE time
+        return false;
+
+    double tickScale = static_cast<double>(ticksPerQuarterNote) / division;
+
+    // ========================================================= FIND TRACKS
+    // chunks that aren't tracks are skipped, as the standard asks
+    std::vector<TrackData> tracks;
+    tracks.reserve(numTracks);
+
+    for (quint32 pos = 8 + headerLength; pos <= length - 8 && static_cast<int>(tracks.size()) < numTracks;)
+    {
+        quint32 chunkLength = std::min(readBigEndian(data + pos + 4, 4), length - pos - 8); // cut off truncated files
+
+        if (memcmp(data + pos, "MTrk", 4) == 0)
+        {
+            tracks.push_back(TrackData());
+            tracks.back().data = data + pos + 8;
+            tracks.back().length = chunkLength;
+        }
+
+        pos += 8 + chunkLength;
+    }
+
+    if (tracks.empty())
+        return false;
+
+    // ======================================================= DECODE TRACKS
+    QtConcurrent::blockingMap(tracks, [tickScale](TrackData &track) {decodeTrack(track, tickScale);});
+
+    // ===================================================== GATHER RESULTS
+    size_t numNotes = 0;
+    for (size_t t = 0; t < tracks.size(); ++t)
+        numNotes += tracks[t].notes.size();
+
+    m_notes.reserve(numNotes);
+    for (size_t t = 0; t < tracks.size(); ++t)
+        m_notes.insert(m_notes.end(), tracks[t].notes.begin(), tracks[t].notes.end());
+
+    // a format 1 file can spread one controller across several tracks
+    for (int i = 0; i < 16 * 128; ++i)
+    {
+        std::vector<ControllerChange> changes;
+        int numTracksWithChanges = 0;
+
+        for (size_t t = 0; t < tracks.size(); ++t)
+        {
+            const std::vector<ControllerChange> &trackChanges = tracks[t].controllers[i];
+            if (trackChanges.empty())
+                continue;
+
+            changes.insert(changes.end(), trackChanges.begin(), trackChanges.end());
+            ++numTracksWithChanges;
+        }
+
+        if (changes.empty())
+            continue;
+
+        if (numTracksWithChanges > 1)
+            std::stable_sort(changes.begin(), changes.end(),
+                             [](const ControllerChange &first, const ControllerChange &second) {return first.tick < second.tick;});
+
+        m_envelopes.push_back(Envelope());
+        m_envelopes.back().channel = i / 128;
+        m_envelopes.back().ccNumber = i % 128;
+        reducePoints(changes, tickScale, m_envelopes.back());
+    }
+
+    return true;
+}
+
+// Turns a controller's changes into envelope nodes, leaving out the ones that
+// a straight line between their neighbours gets within half a step of. Flat
+// runs go first since they're the bulk of most files and cost nothing to find;
+// what's left goes through Ramer-Douglas-Peucker.
+void MIDIFileReader::reducePoints(const std::vector<ControllerChange> &changes, double tickScale, Envelope &envelope)
+{
+    const float tolerance = 0.5f / 127;
+
+    // =========================================== RESCALE, ONE CHANGE PER TICK
+    std::vector<unsigned int> ticks;
+    std::vector<float> values;
+    ticks.reserve(changes.size());
+    values.reserve(changes.size());
+
+    for (size_t i = 0; i < changes.size(); ++i)
+    {
+        unsigned int tick = static_cast<unsigned int>(floor(changes[i].tick * tickScale + 0.5));
+        float value = changes[i].value / 127.0f;
+
+        if (!ticks.empty() && ticks.back() == tick) // the last change at a tick wins
+            values.back() = value;
+        else
+        {
+            ticks.push_back(tick);
+            values.push_back(value);
+        }
+    }
+
+    // ================================================== DROP FLAT RUNS
+    size_t numKept = 1;
+    for (size_t i = 1; i < ticks.size(); ++i)
+    {
+        bool isLast = i + 1 == ticks.size();
+        if (!isLast && values[i] == values[numKept - 1] && values[i] == values[i + 1])
+            continue;
+
+        ticks[numKept] = ticks[i];
+        values[numKept] = values[i];
+        ++numKept;
+    }
+
+    ticks.resize(numKept);
+    values.resize(numKept);
+
+    // ===================================================== SIMPLIFY
+    std::vector<bool> keep(numKept, false);
+    keep.front() = true;
+    keep.back() = true;
+
+    std::vector<std::pair<size_t, size_t> > spans;
+    if (numKept > 2)
+        spans.push_back(std::make_pair(size_t(0), numKept - 1));
+
+    while (!spans.empty())
+    {
+        size_t first = spans.back().first;
+        size_t last = spans.back().second;
+        spans.pop_back();
+
+        double slope = static_cast<double>(values[last] - values[first]) / (ticks[last] - ticks[first]);
+        size_t farthest = first;
+        double farthestDistance = 0;
+
+        for (size_t i = first + 1; i < last; ++i)
+        {
+            double distance = fabs(values[i] - (values[first] + slope * (ticks[i] - ticks[first])));
+            if (distance > farthestDistance)
+            {
+                farthest = i;
+                farthestDistance = distance;
+            }
+        }
+
+        if (farthestDistance <= tolerance)
+            continue;
+
+        keep[farthest] = true;
+
+        if (farthest - first > 1)
+            spans.push_back(std::make_pair(first, farthest));
+
+        if (last - farthest > 1)
+            spans.push_back(std::make_pair(farthest, last));
+    }
+
+    for (size_t i = 0; i < numKept; ++i)
+    {
+        if (!keep[i])
+            continue;
+
+        envelope.ticks.push_back(ticks[i]);
+        envelope.values.push_back(values[i]);
+    }
+}
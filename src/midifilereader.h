@@ -0,0 +1,62 @@
+#ifndef MIDIFILEREADER_H
+#define MIDIFILEREADER_H
+#include "envelopedata.h"
+#include <QtCore/QString>
+#include <vector>
+
+// Reads the notes and controller changes from a standard MIDI file (format 0
+// or 1). The file is memory mapped and its tracks are decoded in parallel,
+// straight out of the mapping, so nothing is copied except the results.
+//
+// Tempo changes are ignored and times are just rescaled to the requested
+// resolution, since a project only has the one tempo.
+
+class MIDIFileReader
+{
+public:
+    struct Note
+    {
+        double start;
+        double duration;
+        unsigned char channel; // 0 to 15
+        unsigned char pitch;
+        unsigned char velocity;
+    };
+
+    bool read(const QString &fileName, int ticksPerQuarterNote); // returns false if the file can't be read
+
+    const std::vector<Note> &notes() const {return m_notes;}
+    int numEnvelopes() const {return static_cast<int>(m_envelopes.size());}
+    EnvelopeData envelopeData(int index) const;
+
+private:
+    struct ControllerChange
+    {
+        quint64 tick;
+        unsigned char value;
+    };
+
+    struct TrackData
+    {
+        const uchar *data;
+        quint32 length;
+        std::vector<Note> notes;
+        std::vector<std::vector<ControllerChange> > controllers; // indexed by channel * 128 + controller number
+    };
+
+    struct Envelope
+    {
+        unsigned char channel;
+        unsigned char ccNumber;
+        std::vector<unsigned int> ticks;
+        std::vector<float> values;
+    };
+
+    static void decodeTrack(TrackData &track, double tickScale);
+    static void reducePoints(const std::vector<ControllerChange> &changes, double tickScale, Envelope &envelope);
+
+    std::vector<Note> m_notes;
+    std::vector<Envelope> m_envelopes;
+};
+
+#endif // MIDIFILEREADER_H
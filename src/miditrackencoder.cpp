@@ -0,0 +1,105 @@
+#include "miditrackencoder.h"
+#include <algorithm>
+
+#define END_OF_TRACK 0x2f
+#define META_EVENT 0xff
+#define TEMPO 0x51
+#define TIME_SIGNATURE 0x58
+
+MIDITrackEncoder::MIDITrackEncoder(QByteArray &chunk, int estimatedSize)
+    : chunk(chunk),
+      numBytesWritten(0),
+      previousStatus(0)
+{
+    chunk.resize(headerSize + std::max(estimatedSize, maxEventSize));
+
+    uchar *out = reserve(headerSize);
+    *out++ = 'M'; *out++ = 'T'; *out++ = 'r'; *out++ = 'k';
+    *out++ = 0; *out++ = 0; *out++ = 0; *out++ = 0; // the length, which isn't known yet
+    commit(out);
+}
+
+void MIDITrackEncoder::finish()
+{
+    writeMetaEvent(0, END_OF_TRACK);
+    chunk.resize(numBytesWritten);
+
+    // the length goes right after "MTrk"
+    quint32 trackLength = numBytesWritten - headerSize;
+    chunk[4] = char(trackLength >> 24);
+    chunk[5] = char(trackLength >> 16);
+    chunk[6] = char(trackLength >> 8);
+    chunk[7] = char(trackLength);
+}
+
+uchar *MIDITrackEncoder::reserve(int numBytes)
+{
+    if (numBytesWritten + numBytes > chunk.size())
+        chunk.resize(std::max(2 * chunk.size(), numBytesWritten + numBytes));
+
+    return reinterpret_cast<uchar*>(chunk.data()) + numBytesWritten;
+}
+
+void MIDITrackEncoder::writeMetaEvent(quint32 deltaTicks, int type)
+{
+    uchar *out = writeVarLen(reserve(maxEventSize), deltaTicks);
+    *out++ = META_EVENT;
+    *out++ = type;
+    *out++ = 0; // number of bytes to follow
+    commit(out);
+    previousStatus = META_EVENT;
+}
+
+void MIDITrackEncoder::writeMidiEvent(quint32 deltaTicks, int type, int chan, int b1, int b2)
+{
+    uchar *out = writeVarLen(reserve(maxEventSize), deltaTicks);
+    quint8 status = type | chan;
+
+    if (previousStatus != status) // check if we can omit status byte ("running status")
+    {
+        previousStatus = status;
+        *out++ = status;
+    }
+
+    *out++ = b1;
+    *out++ = b2;
+    commit(out);
+}
+
+void MIDITrackEncoder::writeTempo(quint32 deltaTicks, quint32 tempoMicrosecondsPerQuarterNote)
+{
+    uchar *out = writeVarLen(reserve(maxEventSize), deltaTicks);
+    *out++ = META_EVENT;
+    *out++ = TEMPO;
+    *out++ = 3; // number of bytes to follow
+    *out++ = (tempoMicrosecondsPerQuarterNote >> 16) & 0xff;
+    *out++ = (tempoMicrosecondsPerQuarterNote >> 8) & 0xff;
+    *out++ = tempoMicrosecondsPerQuarterNote & 0xff;
+    commit(out);
+    previousStatus = META_EVENT;
+}
+
+void MIDITrackEncoder::writeTimeSignature(quint32 deltaTicks, int num, int den, int cc, int bb)
+{
+    uchar *out = writeVarLen(reserve(maxEventSize), deltaTicks);
+    *out++ = META_EVENT;
+    *out++ = TIME_SIGNATURE;
+    *out++ = 4; // number of bytes to follow
+    *out++ = num & 0xff;
+    *out++ = den & 0xff; // denominator is exponent power of 2
+    *out++ = cc & 0xff; // cc is number of MIDI clocks in a metronome click (24 should be OK)
+    *out++ = bb & 0xff; // bb is number of 32nd notes per quarter note (usually 8)
+    commit(out);
+    previousStatus = META_EVENT;
+}
+
+uchar *MIDITrackEncoder::writeVarLen(uchar *out, quint32 value)
+{
+    // seven bits per byte, most significant first, with the high bit set on all but the last
+    if (value >= (1u << 28)) *out++ = ((value >> 28) & 0x7f) | 0x80;
+    if (value >= (1u << 21)) *out++ = ((value >> 21) & 0x7f) | 0x80;
+    if (value >= (1u << 14)) *out++ = ((value >> 14) & 0x7f) | 0x80;
+    if (value >= (1u << 7)) *out++ = ((value >> 7) & 0x7f) | 0x80;
+    *out++ = value & 0x7f;
+    return out;
+}
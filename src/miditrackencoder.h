@@ -0,0 +1,38 @@
+#ifndef MIDITRACKENCODER_H
+#define MIDITRACKENCODER_H
+#include <QtCore/QByteArray>
+
+// Encodes one track of a standard MIDI file, chunk header and all, straight
+// into a byte array, which is sized from an estimate up front and doubled
+// whenever it runs out. Delta times and running status are encoded in place.
+//
+// A chunk's length comes before its events, but isn't known until the end,
+// so the chunk header is written with a length of zero and finish() fills it
+// in.
+
+class MIDITrackEncoder
+{
+public:
+    MIDITrackEncoder(QByteArray &chunk, int estimatedSize); // the estimate doesn't include the chunk header
+    void finish(); // ends the track, trims the chunk to what was written, and fills in its length
+
+    void writeMetaEvent(quint32 deltaTicks, int type);
+    void writeMidiEvent(quint32 deltaTicks, int type, int chan, int b1, int b2);
+    void writeTempo(quint32 deltaTicks, quint32 tempoMicrosecondsPerQuarterNote);
+    void writeTimeSignature(quint32 deltaTicks, int num, int den, int cc = 24, int bb = 8);
+
+private:
+    static const int headerSize = 8;
+    static const int maxEventSize = 16; // the largest event written here, with a five byte delta time
+
+    // reserve() returns where to write the next numBytes bytes; commit() takes the position after the last one written
+    uchar *reserve(int numBytes);
+    void commit(uchar *end) {numBytesWritten = end - reinterpret_cast<uchar*>(chunk.data());}
+    static uchar *writeVarLen(uchar *out, quint32 value);
+
+    QByteArray &chunk; // its size is the capacity, and numBytesWritten is how much of it is used
+    int numBytesWritten;
+    int previousStatus;
+};
+
+#endif
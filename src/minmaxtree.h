@@ -0,0 +1,62 @@
+#ifndef MINMAXTREE_H
+#define MINMAXTREE_H
+#include <QtCore/QtGlobal>
+#include <vector>
+
+// The smallest and largest of any range of values in O(log n), e.g., for
+// drawing a dense envelope one pixel column at a time. It's a bottom-up
+// segment tree: the values are the leaves at [n, 2n), and node i covers
+// nodes 2i and 2i + 1. Building it is O(n).
+
+class MinMaxTree
+{
+public:
+    MinMaxTree() : size(0) {}
+
+    void build(const float *values, int count)
+    {
+        size = count;
+        minima.resize(2 * count);
+        maxima.resize(2 * count);
+
+        for (int i = 0; i < count; ++i)
+            minima[count + i] = maxima[count + i] = values[i];
+
+        for (int i = count - 1; i > 0; --i)
+        {
+            minima[i] = qMin(minima[2 * i], minima[2 * i + 1]);
+            maxima[i] = qMax(maxima[2 * i], maxima[2 * i + 1]);
+        }
+    }
+
+    // first and last are inclusive, and first must not be greater than last
+    void query(int first, int last, float &minimum, float &maximum) const
+    {
+        minimum = minima[size + first];
+        maximum = maxima[size + first];
+
+        for (first += size, last += size + 1; first < last; first >>= 1, last >>= 1)
+        {
+            if (first & 1)
+            {
+                minimum = qMin(minimum, minima[first]);
+                maximum = qMax(maximum, maxima[first]);
+                ++first;
+            }
+
+            if (last & 1)
+            {
+                --last;
+                minimum = qMin(minimum, minima[last]);
+                maximum = qMax(maximum, maxima[last]);
+            }
+        }
+    }
+
+private:
+    int size;
+    std::vector<float> minima;
+    std::vector<float> maxima;
+};
+
+#endif
@@ -1,24 +1,35 @@
 #include "nodecommands.h"
 #include "trackmanagerdialog.h"
+#include <algorithm>
 
 AddRemoveNodesCommand::AddRemoveNodesCommand(int track, int envelope, const SimpleVector<QPointF> &nodes, TrackManagerDialog *dialog)
-    : track(track), envelope(envelope), nodes(nodes), trackManager(dialog)
-{}
-
-void AddRemoveNodesCommand::addTheNodes()
+    : track(track), envelope(envelope), trackManager(dialog)
 {
+    std::vector<QPointF> sortedNodes(nodes.size());
     for (int i = 0; i < nodes.size(); ++i)
+        sortedNodes[i] = nodes[i];
+
+    std::stable_sort(sortedNodes.begin(), sortedNodes.end(), [](const QPointF &a, const QPointF &b) {return a.x() < b.x();});
+
+    positions.reserve(sortedNodes.size());
+    values.reserve(sortedNodes.size());
+    for (size_t i = 0; i < sortedNodes.size(); ++i)
     {
-        trackManager->addNode(track, envelope, nodes[i].x(), nodes[i].y());
+        positions.push_back(sortedNodes[i].x());
+        values.push_back(sortedNodes[i].y());
     }
 }
 
+void AddRemoveNodesCommand::addTheNodes()
+{
+    if (!positions.empty())
+        trackManager->addNodes(track, envelope, &positions[0], &values[0], positions.size());
+}
+
 void AddRemoveNodesCommand::removeTheNodes()
 {
-    for (int i = 0; i < nodes.size(); ++i)
-    {
-        trackManager->removeNode(track, envelope, nodes[i].x());
-    }
+    if (!positions.empty())
+        trackManager->removeNodes(track, envelope, &positions[0], positions.size());
 }
 
 AddNodesCommand::AddNodesCommand(int track, int envelope, const SimpleVector<QPointF> &nodes, TrackManagerDialog *dialog)
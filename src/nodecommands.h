@@ -3,6 +3,7 @@
 #include <QtWidgets/QUndoCommand>
 #include "simplevector.h"
 #include <QtCore/QPointF>
+#include <vector>
 
 class TrackManagerDialog;
 
@@ -15,7 +16,8 @@ protected:
 
 private:
     int track, envelope;
-    SimpleVector<QPointF> nodes;
+    std::vector<unsigned int> positions; // sorted, so that the nodes can be added or removed all at once
+    std::vector<float> values;
     TrackManagerDialog *trackManager;
 };
 
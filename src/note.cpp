@@ -1,17 +1,22 @@
 #include "note.h"
 #include "draghandlers.h"
+#include "latticedata.h"
 #include "sequencerscene.h"
 #include <QtGui/QPainter>
 #include <QtWidgets/QGraphicsSceneHoverEvent>
 #include <QtWidgets/QGraphicsView>
 
-Note::Note(float length, unsigned char velocity, unsigned short int laneIndex, int track)
-    : bRect(QRectF(0, -.05, length, .1)), laneIndex(laneIndex), velocity(velocity), dragHandler(0), m_track(track)
+Note::Note(NoteID id, const LatticeData *latticeData)
+    : latticeData(latticeData), m_width(0), m_laneIndex(0), m_id(id), m_listIndex(-1), dragHandler(0)
 {
     setAcceptedMouseButtons(Qt::LeftButton);
     setAcceptHoverEvents(true);
     setFlag(ItemIsSelectable, true);
-    setZValue(-laneIndex);
+}
+
+QRectF Note::boundingRect() const
+{
+    return QRectF(0, latticeData->buttonPositions[m_laneIndex].y() - .05, m_width, .1);
 }
 
 NoteDragHandler *Note::createNoteDragger(QGraphicsSceneMouseEvent *event)
@@ -29,10 +34,10 @@ NoteDragHandler *Note::createNoteDragger(QGraphicsSceneMouseEvent *event)
 }
 
 bool Note::hoveredOnRightOfNote(double xPos, double xScale) const
-{ return xPos > bRect.right() - 8 / xScale; }
+{ return xPos > m_width - 8 / xScale; }
 
 bool Note::hoveredOnTopOfNote(double yPos, double yScale) const
-{ return yPos < bRect.top() + 3 / yScale; }
+{ return yPos < latticeData->buttonPositions[m_laneIndex].y() - .05 + 3 / yScale; }
 
 void Note::hoverLeaveEvent(QGraphicsSceneHoverEvent *)
 { setCursor(QCursor()); }
@@ -46,6 +51,15 @@ void Note::hoverMoveEvent(QGraphicsSceneHoverEvent *event)
     else setCursor(QCursor());
 }
 
+QVariant Note::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    // the record holds the selection, so keep it in sync when Qt changes it (e.g., with the rubber band)
+    if (change == ItemSelectedHasChanged && m_id != invalidNoteID && scene() != NULL)
+        static_cast<SequencerScene*>(scene())->setNoteSelected(m_id, value.toBool());
+
+    return QGraphicsItem::itemChange(change, value);
+}
+
 void Note::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 {
     if (dragHandler != NULL)
@@ -55,7 +69,7 @@ void Note::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 void Note::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
     // ensure press was actually intended for this note
-    if (m_track != static_cast<SequencerScene*>(scene())->currentTrack())
+    if (record().track != static_cast<SequencerScene*>(scene())->currentTrack())
     {
         event->ignore();
         return;
@@ -69,7 +83,7 @@ void Note::mousePressEvent(QGraphicsSceneMouseEvent *event)
     {
         if (!isSelected())
         {
-            scene()->clearSelection();
+            static_cast<SequencerScene*>(scene())->deselectAll();
             setSelected(true);
         }
 
@@ -89,28 +103,63 @@ void Note::mouseReleaseEvent(QGraphicsSceneMouseEvent *)
 
 void Note::paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *)
 {
-    if (static_cast<SequencerScene*>(scene())->currentTrack() == m_track)
+    const NoteRecord &note = record();
+
+    if (static_cast<SequencerScene*>(scene())->currentTrack() == note.track)
     {
         painter->setPen((isSelected() ? static_cast<SequencerScene*>(scene())->getSelectedNotePen()
                                       : static_cast<SequencerScene*>(scene())->getUnselectedNotePen()));
 
-        painter->setBrush(static_cast<SequencerScene*>(scene())->getActiveNoteBrush(velocity));
+        painter->setBrush(static_cast<SequencerScene*>(scene())->getActiveNoteBrush(note.velocity));
     }
     else
     {
         painter->setPen(Qt::NoPen);
-        painter->setBrush(static_cast<SequencerScene*>(scene())->getInactiveNoteBrush(velocity));
+        painter->setBrush(static_cast<SequencerScene*>(scene())->getInactiveNoteBrush(note.velocity));
     }
 
-    painter->drawRect(bRect);
+    painter->drawRect(boundingRect());
+}
+
+const NoteRecord &Note::record() const
+{
+    return static_cast<SequencerScene*>(scene())->note(m_id);
+}
+
+void Note::setEditable(bool editable)
+{
+    setAcceptedMouseButtons(editable ? Qt::LeftButton : 0);
+    setAcceptHoverEvents(editable);
+    setFlag(ItemIsSelectable, editable);
+}
+
+void Note::setLaneIndex(unsigned short laneIndex)
+{
+    if (laneIndex == m_laneIndex)
+        return;
+
+    prepareGeometryChange();
+    m_laneIndex = laneIndex;
+}
+
+void Note::setWidth(double width)
+{
+    if (width == m_width)
+        return;
+
+    prepareGeometryChange();
+    m_width = width;
 }
 
 bool Note::selectedNotesAreInTheSameLane() const
 {
-    SimpleVector<QGraphicsItem*> selectedItems(scene()->selectedItems());
-    for (int i = 0; i < selectedItems.size(); ++i)
+    // not all of the selected notes necessarily have items, so this asks the scene
+    SimpleVector<NoteID> selectedNotes(static_cast<SequencerScene*>(scene())->selectedNotes());
+    unsigned short laneIndex = record().laneIndex;
+
+    for (int i = 0; i < selectedNotes.size(); ++i)
     {
-        if (laneIndex != static_cast<Note*>(selectedItems[i])->getLaneIndex())
+        if (laneIndex != static_cast<SequencerScene*>(scene())->note(selectedNotes[i]).laneIndex)
             return false;
     }
 
@@ -1,26 +1,37 @@
 #ifndef NOTE_H
 #define NOTE_H
+#include "notestore.h"
 #include <QtWidgets/QGraphicsItem>
 
 class NoteDragHandler;
+struct LatticeData;
 
+// The graphics item for a note in the SequencerScene. The note's data lives
+// in the scene's NoteStore; the item only draws it and handles the mouse.
+// Items are pooled by the scene and handed from note to note as the view
+// scrolls, so only the notes near the visible part of the scene have one.
+// The item sits at y = 0 and takes its lane's y from the lattice whenever
+// it's painted or hit tested, so retuning the lattice doesn't move it; the
+// scene only calls updateLanePosition() so that Qt re-indexes its bounds.
 class Note : public QGraphicsItem
 {
 public:
-    Note(float length, unsigned char velocity, unsigned short laneIndex, int track);
+    Note(NoteID id, const LatticeData *latticeData);
+    QRectF boundingRect() const;
     void paint(QPainter *painter, const QStyleOptionGraphicsItem *, QWidget *);
+    void setEditable(bool editable); // only notes in the current track can be clicked and selected
+    void setLaneIndex(unsigned short laneIndex);
+    void setWidth(double width);
+    void updateLanePosition() {prepareGeometryChange();} // call when the lattice moves the note lanes
 
     // inline methods
-    QRectF boundingRect() const {return bRect;}
-    unsigned short int getLaneIndex() const {return laneIndex;}
-    unsigned char getVelocity() const {return velocity;}
-    void setLaneIndex(short index) {laneIndex = index; setZValue(-index);}
-    void setTrack(int track) {m_track = track;}
-    void setVelocity(unsigned char vel) {velocity = vel; update();}
-    void setWidth(double width) {prepareGeometryChange(); bRect.setWidth(width);}
-    int track() const {return m_track;}
+    NoteID id() const {return m_id;}
+    int listIndex() const {return m_listIndex;}
+    void setId(NoteID id) {m_id = id;}
+    void setListIndex(int index) {m_listIndex = index;} // position in the scene's list of note items
 
 protected:
+    QVariant itemChange(GraphicsItemChange change, const QVariant &value);
     void hoverLeaveEvent(QGraphicsSceneHoverEvent *);
     void hoverMoveEvent(QGraphicsSceneHoverEvent *event);
     void mousePressEvent(QGraphicsSceneMouseEvent *event);
@@ -31,13 +42,15 @@ private:
     NoteDragHandler *createNoteDragger(QGraphicsSceneMouseEvent *event);
     bool hoveredOnRightOfNote(double xPos, double xScale) const;
     bool hoveredOnTopOfNote(double yPos, double yScale) const;
+    const NoteRecord &record() const;
     bool selectedNotesAreInTheSameLane() const;
 
-    QRectF bRect;
-    unsigned short laneIndex;
-    unsigned char velocity;
+    const LatticeData *latticeData;
+    double m_width;
+    unsigned short m_laneIndex;
+    NoteID m_id;
+    int m_listIndex;
     NoteDragHandler *dragHandler;
-    int m_track;
 };
 
 #endif
@@ -1,12 +1,11 @@
 #include "notesequencegenerator.h"
 #include "dynamictonality.h"
 #include "hexsettings.h"
-#include "note.h"
 #include "sequencerevent.h"
 #include "sortalgorithms.h"
 #include "simplevector.h"
 
-NoteSequenceGenerator::NoteSequenceGenerator(const SimpleVector<QGraphicsItem*> &notes)
+NoteSequenceGenerator::NoteSequenceGenerator(const NoteStore &store, const SimpleVector<NoteID> &notes)
     : m_eventArray(0), m_numEvents(0)
 {
     if (notes.size() == 0)
@@ -17,10 +16,10 @@ NoteSequenceGenerator::NoteSequenceGenerator(const SimpleVector<QGraphicsItem*>
     // convert notes to events
     for (int i = 0; i < notes.size(); ++i)
     {
-        Note *note = static_cast<Note*>(notes[i]);
+        const NoteRecord &note = store[notes[i]];
 
         short int j, k;
-        HexSettings::convertNoteLaneIndexToJK(note->getLaneIndex(), j, k);
+        HexSettings::convertNoteLaneIndexToJK(note.laneIndex, j, k);
 
         unsigned char channel, number;
         if (!DynamicTonality::captureMIDIFromJK(j, k, channel, number))
@@ -28,10 +27,10 @@ NoteSequenceGenerator::NoteSequenceGenerator(const SimpleVector<QGraphicsItem*>
 
         channel += 143;
 
-        m_eventArray[m_numEvents].setData(SequencerEvent::MIDINoteOn, note->pos().x(), channel, number, note->getVelocity(), note->track());
+        m_eventArray[m_numEvents].setData(SequencerEvent::MIDINoteOn, note.start, channel, number, note.velocity, note.track);
         ++m_numEvents;
 
-        m_eventArray[m_numEvents].setData(SequencerEvent::MIDINoteOff, note->pos().x() + note->boundingRect().width(), channel, number, 0, note->track());
+        m_eventArray[m_numEvents].setData(SequencerEvent::MIDINoteOff, note.start + note.duration, channel, number, 0, note.track);
         ++m_numEvents;
     }
 
@@ -1,16 +1,14 @@
 #ifndef NOTESEQUENCEGENERATOR_H
 #define NOTESEQUENCEGENERATOR_H
 
-template <class QGraphicsItem>
-class SimpleVector;
+#include "notestore.h"
 
-class QGraphicsItem;
 struct SequencerEvent;
 
 class NoteSequenceGenerator
 {
 public:
-    NoteSequenceGenerator(const SimpleVector<QGraphicsItem*> &notes);
+    NoteSequenceGenerator(const NoteStore &store, const SimpleVector<NoteID> &notes);
 
     // inline methods
     SequencerEvent *eventArray() const {return m_eventArray;}
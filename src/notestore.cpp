@@ -0,0 +1,107 @@
+#include "notestore.h"
+#include <algorithm>
+
+NoteIDList::NoteIDList(SimpleVector<NoteID> ids)
+    : m_size(ids.size())
+{
+    if (m_size == 0)
+        return;
+
+    std::sort(&ids[0], &ids[0] + m_size);
+
+    // count the runs first so that exactly enough memory is allocated
+    int numRanges = 1;
+    for (int i = 1; i < m_size; ++i)
+    {
+        if (ids[i] != ids[i - 1] + 1)
+            ++numRanges;
+    }
+
+    ranges = SimpleVector<Range>(numRanges);
+    Range range = {ids[0], 1};
+
+    for (int i = 1; i < m_size; ++i)
+    {
+        if (ids[i] == ids[i - 1] + 1)
+        {
+            ++range.count;
+        }
+        else
+        {
+            ranges.append(range);
+            range.first = ids[i];
+            range.count = 1;
+        }
+    }
+
+    ranges.append(range);
+}
+
+// ###########################################################################
+// ###########################################################################
+
+NoteStore::NoteStore()
+{
+}
+
+void NoteStore::clear()
+{
+    freeSlots.clear();
+
+    for (int i = noteSlots.size() - 1; i >= 0; --i)
+    {
+        if (noteSlots[i].used)
+        {
+            noteSlots[i].used = false;
+            noteSlots[i].generation = (noteSlots[i].generation + 1) & generationMask;
+        }
+
+        freeSlots.append(i);
+    }
+}
+
+bool NoteStore::contains(NoteID id) const
+{
+    int slot = id & slotMask;
+    return slot < noteSlots.size() && noteSlots.at(slot).used && noteSlots.at(slot).generation == (id >> slotBits);
+}
+
+NoteID NoteStore::create(double start, double duration, unsigned short laneIndex, unsigned char velocity, int track)
+{
+    int slot;
+
+    if (freeSlots.isEmpty())
+    {
+        // the last slot would make invalidNoteID a valid ID
+        if (noteSlots.size() == static_cast<int>(slotMask))
+            return invalidNoteID;
+
+        slot = noteSlots.size();
+        Slot newSlot;
+        newSlot.generation = 0;
+        noteSlots.append(newSlot);
+    }
+    else
+    {
+        slot = freeSlots.last();
+        freeSlots.removeLast();
+    }
+
+    Slot &s = noteSlots[slot];
+    NoteRecord record = {start, duration, laneIndex, velocity, track, -1, 0, false};
+    s.record = record;
+    s.used = true;
+
+    return (s.generation << slotBits) | slot;
+}
+
+void NoteStore::release(NoteID id)
+{
+    if (!contains(id))
+        return;
+
+    Slot &s = noteSlots[id & slotMask];
+    s.used = false;
+    s.generation = (s.generation + 1) & generationMask;
+    freeSlots.append(id & slotMask);
+}
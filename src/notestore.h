@@ -0,0 +1,108 @@
+#ifndef NOTESTORE_H
+#define NOTESTORE_H
+#include "simplevector.h"
+#include <QtCore/QVector>
+#include <vector>
+
+class Note;
+
+// The slot index is in the low bits and the slot's generation is in the high
+// bits, so an ID that outlives its note (e.g., in an old undo command) can be
+// recognized as stale instead of referring to whatever reuses the slot.
+typedef unsigned int NoteID;
+const NoteID invalidNoteID = 0xFFFFFFFF;
+
+struct NoteRecord
+{
+    double start;
+    double duration;
+    unsigned short laneIndex;
+    unsigned char velocity;
+    int track;
+    int indexInTrack; // position in the scene's list of notes for this track, or -1 if not in the scene
+    Note *item;       // the note's graphics item, if it has one (only notes near the visible part of the scene have one)
+    bool selected;    // kept here rather than in the item, since items come and go as the view scrolls
+};
+
+// ###########################################################################
+// ###########################################################################
+
+// a sorted list of IDs stored as runs of consecutive IDs, which is how undo
+// commands keep track of their notes
+class NoteIDList
+{
+public:
+    NoteIDList() : m_size(0) {}
+    NoteIDList(SimpleVector<NoteID> ids); // ids need not be sorted
+
+    template <class Function>
+    void forEach(Function function) const // visits the IDs in ascending order
+    {
+        for (int i = 0; i < ranges.size(); ++i)
+        {
+            for (int j = 0; j < ranges[i].count; ++j)
+                function(ranges[i].first + j);
+        }
+    }
+
+    // inline methods
+    NoteID first() const {return (m_size == 0) ? invalidNoteID : ranges[0].first;}
+    int numRanges() const {return ranges.size();}
+    int size() const {return m_size;}
+
+private:
+    struct Range
+    {
+        NoteID first;
+        int count;
+    };
+
+    SimpleVector<Range> ranges;
+    int m_size;
+};
+
+// ###########################################################################
+// ###########################################################################
+
+class NoteStore
+{
+public:
+    NoteStore();
+    void clear(); // invalidates every ID
+    bool contains(NoteID id) const;
+    NoteID create(double start, double duration, unsigned short laneIndex, unsigned char velocity, int track);
+    void release(NoteID id); // does nothing if the ID is stale
+
+    // inline methods; the ID must be valid
+    NoteRecord &operator[](NoteID id) {return noteSlots[id & slotMask].record;}
+    const NoteRecord &operator[](NoteID id) const {return noteSlots.at(id & slotMask).record;}
+
+private:
+    static const int slotBits = 22; // about four million notes
+    static const NoteID slotMask = (1 << slotBits) - 1;
+    static const unsigned int generationMask = 0xFFFFFFFF >> slotBits;
+
+    struct Slot
+    {
+        NoteRecord record;
+        unsigned int generation;
+        bool used;
+    };
+
+    QVector<Slot> noteSlots;
+    QVector<int> freeSlots;
+};
+
+// ###########################################################################
+// ###########################################################################
+
+// Some notes, along with a copy of the store they're in. The store's slots
+// are implicitly shared, so taking one is cheap (until the scene's store is
+// next changed) and the copy can be read from another thread.
+struct NoteSnapshot
+{
+    NoteStore store;
+    std::vector<NoteID> ids;
+};
+
+#endif
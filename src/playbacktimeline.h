@@ -0,0 +1,68 @@
+#ifndef PLAYBACKTIMELINE_H
+#define PLAYBACKTIMELINE_H
+#include <QtCore/QtGlobal>
+#include <atomic>
+#include <chrono>
+
+// Where playback was at a given moment and how fast it's moving, published
+// by the playback thread and read by the GUI without locks or signals. It's
+// a seqlock: the writer makes the sequence number odd while it writes, and a
+// reader tries again if it saw an odd number or the number changed while it
+// was reading. There must only be one writer.
+class PlaybackTimeline
+{
+public:
+    PlaybackTimeline()
+        : sequence(0), timestamp(0), tick(0), ticksPerNanosecond(0)
+    {}
+
+    static qint64 now() // nanoseconds on a monotonic clock
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // the tick playback should be at right now, extrapolated from the last published position
+    double currentTick(qint64 *publishedAt = 0) const
+    {
+        unsigned int sequenceBefore, sequenceAfter;
+        qint64 publishedTimestamp;
+        double publishedTick, publishedTicksPerNanosecond;
+
+        do
+        {
+            sequenceBefore = sequence.load(std::memory_order_acquire);
+            publishedTimestamp = timestamp.load(std::memory_order_relaxed);
+            publishedTick = tick.load(std::memory_order_relaxed);
+            publishedTicksPerNanosecond = ticksPerNanosecond.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            sequenceAfter = sequence.load(std::memory_order_relaxed);
+        }
+        while (sequenceBefore != sequenceAfter || (sequenceBefore & 1) != 0);
+
+        if (publishedAt != NULL)
+            *publishedAt = publishedTimestamp;
+
+        return publishedTick + (now() - publishedTimestamp) * publishedTicksPerNanosecond;
+    }
+
+    void publish(double currentTick, double ticksPerMillisecond)
+    {
+        unsigned int currentSequence = sequence.load(std::memory_order_relaxed);
+        sequence.store(currentSequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        timestamp.store(now(), std::memory_order_relaxed);
+        tick.store(currentTick, std::memory_order_relaxed);
+        ticksPerNanosecond.store(ticksPerMillisecond * 1.0e-6, std::memory_order_relaxed);
+
+        sequence.store(currentSequence + 2, std::memory_order_release);
+    }
+
+private:
+    std::atomic<unsigned int> sequence;
+    std::atomic<qint64> timestamp;
+    std::atomic<double> tick;
+    std::atomic<double> ticksPerNanosecond;
+};
+
+#endif
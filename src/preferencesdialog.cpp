@@ -400,22 +400,22 @@ void PreferencesDialog::setEnvelopeColor(const QColor &color)
 void PreferencesDialog::setGridLinesColor(const QColor &color)
 {
     mainWindow->barLineDrawer->setGridLineColor(color);
-    mainWindow->sequencerScene->update();
-    mainWindow->envelopeScene->update();
+    mainWindow->sequencerScene->invalidateBackgroundCache();
+    mainWindow->envelopeScene->invalidateBackgroundCache();
 }
 
 void PreferencesDialog::setBeatLinesColor(const QColor &color)
 {
     mainWindow->barLineDrawer->setBeatLineColor(color);
-    mainWindow->sequencerScene->update();
-    mainWindow->envelopeScene->update();
+    mainWindow->sequencerScene->invalidateBackgroundCache();
+    mainWindow->envelopeScene->invalidateBackgroundCache();
 }
 
 void PreferencesDialog::setBarLinesColor(const QColor &color)
 {
     mainWindow->barLineDrawer->setBarLineColor(color);
-    mainWindow->sequencerScene->update();
-    mainWindow->envelopeScene->update();
+    mainWindow->sequencerScene->invalidateBackgroundCache();
+    mainWindow->envelopeScene->invalidateBackgroundCache();
 }
 
 void PreferencesDialog::setCursorColor(const QColor &color)
@@ -0,0 +1,129 @@
+#include "projectfile.h"
+#include <QtCore/QDataStream>
+#include <QtCore/QIODevice>
+
+#define COMPRESSED_CHUNK 0x1
+
+static const int fileHeaderSize = 8; // format and number of chunks
+static const int tableEntrySize = 24;
+
+// ###########################################################################
+// ####################################################### PROJECT FILE WRITER
+
+void ProjectFileWriter::addChunk(ProjectFile::ChunkType type, int index, const QByteArray &data, bool compress)
+{
+    Chunk chunk = {static_cast<quint32>(type), index, compress ? COMPRESSED_CHUNK : 0u, compress ? qCompress(data) : data};
+    chunks.push_back(chunk);
+}
+
+bool ProjectFileWriter::write(QIODevice *device) const
+{
+    QDataStream out(device);
+    out.setVersion(13);
+
+    out << qint32(ProjectFile::formatVersion) << quint32(chunks.size());
+
+    // the chunks go right after the table, in the same order
+    quint64 offset = fileHeaderSize + tableEntrySize * chunks.size();
+    for (size_t i = 0; i < chunks.size(); ++i)
+    {
+        out << chunks[i].type << chunks[i].index << chunks[i].flags << offset << quint32(chunks[i].data.size());
+        offset += chunks[i].data.size();
+    }
+
+    for (size_t i = 0; i < chunks.size(); ++i)
+        out.writeRawData(chunks[i].data.constData(), chunks[i].data.size());
+
+    return out.status() == QDataStream::Ok;
+}
+
+// ###########################################################################
+// ####################################################### PROJECT FILE READER
+
+QByteArray ProjectFileReader::chunk(ProjectFile::ChunkType type, int index) const
+{
+    int i = findChunk(type, index);
+    if (i == -1)
+        return QByteArray();
+
+    const char *chunkData = reinterpret_cast<const char*>(data + table[i].offset);
+
+    if (table[i].flags & COMPRESSED_CHUNK)
+        return qUncompress(reinterpret_cast<const uchar*>(chunkData), table[i].size);
+
+    return QByteArray::fromRawData(chunkData, table[i].size);
+}
+
+void ProjectFileReader::close()
+{
+    table.clear();
+
+    if (data)
+        file.unmap(const_cast<uchar*>(data));
+
+    data = 0;
+    file.close();
+}
+
+int ProjectFileReader::findChunk(ProjectFile::ChunkType type, int index) const
+{
+    for (size_t i = 0; i < table.size(); ++i)
+    {
+        if (table[i].type == static_cast<quint32>(type) && table[i].index == index)
+            return i;
+    }
+
+    return -1;
+}
+
+bool ProjectFileReader::open(const QString &filePath)
+{
+    close();
+
+    file.setFileName(filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 fileSize = file.size();
+    if (fileSize < fileHeaderSize)
+    {
+        close();
+        return false;
+    }
+
+    data = file.map(0, fileSize);
+    if (!data)
+    {
+        close();
+        return false;
+    }
+
+    QByteArray header = QByteArray::fromRawData(reinterpret_cast<const char*>(data), fileSize);
+    QDataStream in(header);
+    in.setVersion(13);
+
+    qint32 format;
+    quint32 numChunks;
+    in >> format >> numChunks;
+
+    if (format != ProjectFile::formatVersion || numChunks > (fileSize - fileHeaderSize) / tableEntrySize)
+    {
+        close();
+        return false;
+    }
+
+    table.resize(numChunks);
+    for (quint32 i = 0; i < numChunks; ++i)
+    {
+        TableEntry &entry = table[i];
+        in >> entry.type >> entry.index >> entry.flags >> entry.offset >> entry.size;
+
+        if (entry.offset > static_cast<quint64>(fileSize) || entry.size > fileSize - entry.offset)
+        {
+            close();
+            return false;
+        }
+    }
+
+    return true;
+}
@@ -0,0 +1,91 @@
+#ifndef PROJECTFILE_H
+#define PROJECTFILE_H
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <vector>
+
+class QIODevice;
+
+// Version 2 of the .hxp format. Like version 1, it starts with the format
+// number (a QDataStream int), so older versions of Hex know to refuse it.
+// After that comes a table of chunks and then the chunks themselves, each a
+// separate QDataStream payload that's usually qCompress()ed. A chunk is found
+// by its type and index (the track, for per-track chunks), so it can be read
+// without reading anything else.
+//
+//    int format, quint32 numChunks
+//    numChunks * {quint32 type, qint32 index, quint32 flags, quint64 offset, quint32 size}
+//    chunk data
+
+namespace ProjectFile
+{
+    const int formatVersion = 2;
+
+    enum ChunkType
+    {
+        LatticeChunk = 1,    // lattice settings, alpha and beta
+        TimingChunk = 2,     // grid, snap and project timing settings
+        GlobalEnvelopesChunk = 3,
+        TrackChunk = 4,      // one per track: name, output port and type
+        TrackEnvelopesChunk = 5,
+        TrackNotesChunk = 6  // one per track: the notes as columns (see SequencerScene::noteChunk())
+    };
+
+    // note times are stored as fixed point, in 1/256ths of a tick
+    const double tickScale = 256;
+}
+
+// ###########################################################################
+// ###########################################################################
+
+class ProjectFileWriter
+{
+public:
+    void addChunk(ProjectFile::ChunkType type, int index, const QByteArray &data, bool compress = true);
+    bool write(QIODevice *device) const; // returns false if anything couldn't be written
+
+private:
+    struct Chunk
+    {
+        quint32 type;
+        qint32 index;
+        quint32 flags;
+        QByteArray data;
+    };
+
+    std::vector<Chunk> chunks;
+};
+
+// ###########################################################################
+// ###########################################################################
+
+// Maps the whole file and reads just the chunk table; chunks are only decoded
+// when asked for. Uncompressed chunks aren't copied, so what chunk() returns
+// must not outlive the reader.
+class ProjectFileReader
+{
+public:
+    ProjectFileReader() : data(0) {}
+    bool open(const QString &filePath); // returns false if it isn't a readable version 2 file
+    QByteArray chunk(ProjectFile::ChunkType type, int index = 0) const; // empty if there's no such chunk
+    bool hasChunk(ProjectFile::ChunkType type, int index = 0) const {return findChunk(type, index) != -1;}
+
+private:
+    struct TableEntry
+    {
+        quint32 type;
+        qint32 index;
+        quint32 flags;
+        quint64 offset;
+        quint32 size;
+    };
+
+    void close(); // so that a file that can't be read isn't left open and mapped
+    int findChunk(ProjectFile::ChunkType type, int index) const;
+
+    QFile file;
+    const uchar *data;
+    std::vector<TableEntry> table;
+};
+
+#endif // PROJECTFILE_H
@@ -1,9 +1,12 @@
 #ifndef QDATASTREAMOPERATORS_H
 #define QDATASTREAMOPERATORS_H
+#include <QtCore/QDataStream>
+#include <QtCore/QIODevice>
+#include <limits>
+#include <vector>
 
 struct LatticeSettings;
 struct TimingSettings;
-class QDataStream;
 
 QDataStream &operator<<(QDataStream &out, const LatticeSettings &settings);
 
@@ -13,4 +16,28 @@ QDataStream &operator<<(QDataStream &out, const TimingSettings &settings);
 
 QDataStream &operator>>(QDataStream &in, TimingSettings &settings);
 
+// Raw columns are in this machine's byte order, so they're only for data
+// that stays on it, like the clipboard. Each column is one copy.
+template <class T>
+void writeRawColumn(QDataStream &out, const std::vector<T> &column)
+{
+    if (!column.empty())
+        out.writeRawData(reinterpret_cast<const char*>(&column[0]), column.size() * sizeof(T));
+}
+
+template <class T>
+bool readRawColumn(QDataStream &in, std::vector<T> &column, int count)
+{
+    // the count comes from the data, so it's checked before anything is allocated
+    if (count < 0 || in.device() == NULL || count > in.device()->bytesAvailable() / qint64(sizeof(T)))
+        return false;
+
+    qint64 numBytes = qint64(count) * qint64(sizeof(T));
+    if (numBytes > std::numeric_limits<int>::max())
+        return false;
+
+    column.resize(count);
+    return count == 0 || in.readRawData(reinterpret_cast<char*>(&column[0]), int(numBytes)) == numBytes;
+}
+
 #endif
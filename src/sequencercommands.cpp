@@ -1,50 +1,52 @@
 #include "sequencercommands.h"
-#include "note.h"
 #include "sequencerscene.h"
 
-AddRemoveNotesCommand::AddRemoveNotesCommand(const SimpleVector<QGraphicsItem *> &notes, QGraphicsScene *scene)
-    : notes(notes), scene(scene)
+AddRemoveNotesCommand::AddRemoveNotesCommand(const NoteIDList &notes, SequencerScene *scene, bool notesAreInScene)
+    : notes(notes), scene(scene), notesAreInScene(notesAreInScene)
 {
 }
 
-void AddRemoveNotesCommand::addTheNotes()
+AddRemoveNotesCommand::~AddRemoveNotesCommand()
 {
-    if (notes[0]->scene() == scene) // prevents annoying warning message if items are already in the scene
+    if (notesAreInScene)
         return;
 
-    for (int i = 0; i < notes.size(); ++i)
-    {
-        scene->addItem(notes[i]);
-    }
+    notes.forEach([this](NoteID id) {scene->releaseNote(id);});
 }
 
-void AddRemoveNotesCommand::deleteTheNotes()
+void AddRemoveNotesCommand::addTheNotes()
 {
-    if (notes[0]->scene() != NULL)
-        return;
+    // all at once, since inserting them one at a time is slow for big pastes
+    std::vector<NoteID> ids;
+    ids.reserve(notes.size());
+    notes.forEach([&ids](NoteID id) {ids.push_back(id);});
 
-    for (int i = 0; i < notes.size(); ++i)
-    {
-        delete notes[i];
-    }
+    scene->insertNotes(ids); // does nothing for notes already in the scene
+    notesAreInScene = true;
 }
 
 void AddRemoveNotesCommand::removeTheNotes()
 {
-    for (int i = 0; i < notes.size(); ++i)
-    {
-        scene->removeItem(notes[i]);
-    }
+    notes.forEach([this](NoteID id) {scene->removeNote(id);});
+    notesAreInScene = false;
 }
 
-AddNotesCommand::AddNotesCommand(const SimpleVector<QGraphicsItem *> &notes, QGraphicsScene *scene)
-    : AddRemoveNotesCommand(notes, scene)
+AddNotesCommand::AddNotesCommand(const NoteIDList &notes, SequencerScene *scene, bool selectNotes)
+    : AddRemoveNotesCommand(notes, scene, false), selectNotes(selectNotes)
 {
     setText((notes.size() == 1) ? QObject::tr("Add Note") : QObject::tr("Add Notes"));
 }
 
-DeleteNotesCommand::DeleteNotesCommand(const SimpleVector<QGraphicsItem *> &notes)
-    : AddRemoveNotesCommand(notes, notes[0]->scene())
+void AddNotesCommand::redo()
+{
+    addTheNotes();
+
+    if (selectNotes)
+        notes.forEach([this](NoteID id) {scene->setNoteSelected(id, true);});
+}
+
+DeleteNotesCommand::DeleteNotesCommand(const NoteIDList &notes, SequencerScene *scene)
+    : AddRemoveNotesCommand(notes, scene, true)
 {
     setText((notes.size() == 1) ? QObject::tr("Delete Note") : QObject::tr("Delete Notes"));
 }
@@ -52,111 +54,107 @@ DeleteNotesCommand::DeleteNotesCommand(const SimpleVector<QGraphicsItem *> &note
 // ###########################################################################
 // ###########################################################################
 
-ChangeNoteVelocitiesCommand::ChangeNoteVelocitiesCommand(const SimpleVector<QGraphicsItem *> &notes,
-                                                         const SimpleVector<unsigned char> &initialVelocities)
+ChangeNoteVelocitiesCommand::ChangeNoteVelocitiesCommand(const NoteIDList &notes,
+                                                         const SimpleVector<unsigned char> &initialVelocities,
+                                                         unsigned char newVelocity,
+                                                         SequencerScene *scene)
     : notesToChange(notes),
       oldVelocities(initialVelocities),
-      newVelocity(static_cast<Note*>(notesToChange[0])->getVelocity())
+      newVelocity(newVelocity),
+      scene(scene)
 {
     setText((notesToChange.size() == 1) ? "Change Note Velocity" : "Change Note Velocities");
 }
 
 void ChangeNoteVelocitiesCommand::undo()
 {
-    for (int i = 0; i < notesToChange.size(); ++i)
-    {
-        static_cast<Note*>(notesToChange[i])->setVelocity(oldVelocities[i]);
-    }
+    int i = 0;
+    notesToChange.forEach([this, &i](NoteID id) {scene->setNoteVelocity(id, oldVelocities[i++]);});
 }
 
 void ChangeNoteVelocitiesCommand::redo()
 {
-    for (int i = 0; i < notesToChange.size(); ++i)
-    {
-        static_cast<Note*>(notesToChange[i])->setVelocity(newVelocity);
-    }
+    notesToChange.forEach([this](NoteID id) {scene->setNoteVelocity(id, newVelocity);});
 }
 
 // ###########################################################################
 // ###########################################################################
 
-MoveNotesCommand::MoveNotesCommand(const SimpleVector<QGraphicsItem*> &notes,
-                                   const SimpleVector<float> &initialPositions,
-                                   unsigned short int initialNoteLaneIndex)
+MoveNotesCommand::MoveNotesCommand(const NoteIDList &notes, double xOffset,
+                                   unsigned short int initialNoteLaneIndex, unsigned short int newNoteLaneIndex,
+                                   SequencerScene *scene)
     : notesToMove(notes),
-      oldPositions(initialPositions),
-      newPositions(notesToMove.size()),
+      xOffset(xOffset),
       oldNoteLaneIndex(initialNoteLaneIndex),
-      newNoteLaneIndex(static_cast<Note*>(notes[0])->getLaneIndex())
+      newNoteLaneIndex(newNoteLaneIndex),
+      scene(scene),
+      firstRedo(true)
 {
     setText((notesToMove.size() == 1) ? "Move Note" : "Move Notes");
-
-    for (int i = 0; i < notesToMove.size(); ++i)
-    {
-        newPositions.appendByValue(notesToMove[i]->x());
-    }
 }
 
-void MoveNotesCommand::undo() {moveTheNotes(oldPositions, oldNoteLaneIndex);}
-void MoveNotesCommand::redo() {moveTheNotes(newPositions, newNoteLaneIndex);}
+void MoveNotesCommand::undo() {moveTheNotes(-xOffset, oldNoteLaneIndex);}
 
-void MoveNotesCommand::moveTheNotes(const SimpleVector<float> &positions, unsigned short int noteLaneIndex)
+void MoveNotesCommand::redo()
 {
-    for (int i = 0; i < notesToMove.size(); ++i)
-    {
-        notesToMove[i]->setX(positions[i]);
-        static_cast<Note*>(notesToMove[i])->setLaneIndex(noteLaneIndex);
-    }
+    if (firstRedo)
+        firstRedo = false;
+    else
+        moveTheNotes(xOffset, newNoteLaneIndex);
+}
 
-    static_cast<SequencerScene*>(notesToMove[0]->scene())->updateNotePositions();
+void MoveNotesCommand::moveTheNotes(double offset, unsigned short int noteLaneIndex)
+{
+    notesToMove.forEach([this, offset, noteLaneIndex](NoteID id) {
+        scene->setNoteStart(id, scene->note(id).start + offset);
+        scene->setNoteLaneIndex(id, noteLaneIndex);
+    });
 }
 
 // ###########################################################################
 // ###########################################################################
 
-MoveNotesHorizontallyCommand::MoveNotesHorizontallyCommand(const SimpleVector<QGraphicsItem*> &notes, const SimpleVector<float> &initialPositions)
-    : notesToMove(notes), oldPositions(initialPositions), newPositions(notesToMove.size())
+MoveNotesHorizontallyCommand::MoveNotesHorizontallyCommand(const NoteIDList &notes, double xOffset, SequencerScene *scene)
+    : notesToMove(notes), xOffset(xOffset), scene(scene), firstRedo(true)
 {
     setText((notesToMove.size() == 1) ? "Move Note" : "Move Notes");
-
-    for (int i = 0; i < notesToMove.size(); ++i)
-    {
-        newPositions.appendByValue(notesToMove[i]->pos().x());
-    }
 }
 
-void MoveNotesHorizontallyCommand::undo() {moveTheNotes(oldPositions);}
-void MoveNotesHorizontallyCommand::redo() {moveTheNotes(newPositions);}
+void MoveNotesHorizontallyCommand::undo() {moveTheNotes(-xOffset);}
+
+void MoveNotesHorizontallyCommand::redo()
+{
+    if (firstRedo)
+        firstRedo = false;
+    else
+        moveTheNotes(xOffset);
+}
 
-void MoveNotesHorizontallyCommand::moveTheNotes(const SimpleVector<float> &positions)
+void MoveNotesHorizontallyCommand::moveTheNotes(double offset)
 {
-    for (int i = 0; i < notesToMove.size(); ++i)
-    {
-        notesToMove[i]->setX(positions[i]);
-    }
+    notesToMove.forEach([this, offset](NoteID id) {scene->setNoteStart(id, scene->note(id).start + offset);});
 }
 
 // ###########################################################################
 // ###########################################################################
 
-ResizeNotesCommand::ResizeNotesCommand(const SimpleVector<QGraphicsItem *> &notes, const SimpleVector<float> &initialLengths)
-    : notesToResize(notes), oldLengths(initialLengths), newLengths(notesToResize.size())
+ResizeNotesCommand::ResizeNotesCommand(const NoteIDList &notes, double lengthDifference, SequencerScene *scene)
+    : notesToResize(notes), lengthDifference(lengthDifference), scene(scene), firstRedo(true)
 {
     setText((notesToResize.size() == 1) ? "Resize Note" : "Resize Notes");
-
-    for (int i = 0; i < notesToResize.size(); ++i)
-    {
-        newLengths.appendByValue(notesToResize.at(i)->boundingRect().width());
-    }
 }
 
-void ResizeNotesCommand::undo() {resizeTheNotes(oldLengths);}
-void ResizeNotesCommand::redo() {resizeTheNotes(newLengths);}
+void ResizeNotesCommand::undo() {resizeTheNotes(-lengthDifference);}
+
+void ResizeNotesCommand::redo()
+{
+    if (firstRedo)
+        firstRedo = false;
+    else
+        resizeTheNotes(lengthDifference);
+}
 
-void ResizeNotesCommand::resizeTheNotes(const SimpleVector<float> &lengths)
+void ResizeNotesCommand::resizeTheNotes(double difference)
 {
-    for (int i = 0; i < notesToResize.size(); ++i)
-    {
-        static_cast<Note *>(notesToResize[i])->setWidth(lengths[i]);
-    }
+    notesToResize.forEach([this, difference](NoteID id) {scene->setNoteDuration(id, scene->note(id).duration + difference);});
 }
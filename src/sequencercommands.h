@@ -1,10 +1,10 @@
 #ifndef UNDOCOMMANDS_H
 #define UNDOCOMMANDS_H
 #include <QtWidgets/QUndoCommand>
+#include "notestore.h"
 #include "simplevector.h"
 
-class QGraphicsItem;
-class QGraphicsScene;
+class SequencerScene;
 
 // ###########################################################################
 // ###########################################################################
@@ -12,29 +12,34 @@ class QGraphicsScene;
 class AddRemoveNotesCommand : public QUndoCommand // abstract base class for adding or removing notes
 {
 protected:
-    AddRemoveNotesCommand(const SimpleVector<QGraphicsItem*> &notes, QGraphicsScene *scene);
+    AddRemoveNotesCommand(const NoteIDList &notes, SequencerScene *scene, bool notesAreInScene);
+    ~AddRemoveNotesCommand();
     void addTheNotes();
-    void deleteTheNotes();
     void removeTheNotes();
 
+    NoteIDList notes;
+    SequencerScene *scene;
+
 private:
-    SimpleVector<QGraphicsItem*> notes;
-    QGraphicsScene *scene;
+    // whichever command last took the notes out of the scene owns their IDs
+    bool notesAreInScene;
 };
 
 class AddNotesCommand : public AddRemoveNotesCommand
 {
 public:
-    AddNotesCommand(const SimpleVector<QGraphicsItem*> &notes, QGraphicsScene *scene);
-    ~AddNotesCommand() {deleteTheNotes();}
-    void redo() {addTheNotes();}
+    AddNotesCommand(const NoteIDList &notes, SequencerScene *scene, bool selectNotes = false);
+    void redo();
     void undo() {removeTheNotes();}
+
+private:
+    bool selectNotes;
 };
 
 class DeleteNotesCommand : public AddRemoveNotesCommand
 {
 public:
-    DeleteNotesCommand(const SimpleVector<QGraphicsItem*> &notes);
+    DeleteNotesCommand(const NoteIDList &notes, SequencerScene *scene);
     void redo() {removeTheNotes();}
     void undo() {addTheNotes();}
 };
@@ -45,34 +50,41 @@ public:
 class ChangeNoteVelocitiesCommand : public QUndoCommand
 {
 public:
-    ChangeNoteVelocitiesCommand(const SimpleVector<QGraphicsItem *> &notes, const SimpleVector<unsigned char> &initialVelocities);
+    // initialVelocities are in ascending ID order
+    ChangeNoteVelocitiesCommand(const NoteIDList &notes, const SimpleVector<unsigned char> &initialVelocities, unsigned char newVelocity, SequencerScene *scene);
     void undo();
     void redo();
 
 private:
-    SimpleVector<QGraphicsItem *> notesToChange;
+    NoteIDList notesToChange;
     SimpleVector<unsigned char> oldVelocities;
     unsigned char newVelocity;
+    SequencerScene *scene;
 };
 
 // ###########################################################################
 // ###########################################################################
 
+// The following commands are created after the notes have been dragged, so
+// the first call to redo() doesn't do anything.
+
 class MoveNotesCommand : public QUndoCommand
 {
 public:
-    MoveNotesCommand(const SimpleVector<QGraphicsItem *> &notes,
-                     const SimpleVector<float> &initialPositions,
-                     unsigned short int initialNoteLaneIndex);
+    MoveNotesCommand(const NoteIDList &notes, double xOffset,
+                     unsigned short int initialNoteLaneIndex, unsigned short int newNoteLaneIndex,
+                     SequencerScene *scene);
     void undo();
     void redo();
 
 private:
-    void moveTheNotes(const SimpleVector<float> &positions, unsigned short int noteLaneIndex);
-    SimpleVector<QGraphicsItem*> notesToMove;
-    SimpleVector<float> oldPositions;
-    SimpleVector<float> newPositions;
+    void moveTheNotes(double offset, unsigned short int noteLaneIndex);
+
+    NoteIDList notesToMove;
+    double xOffset;
     unsigned short int oldNoteLaneIndex, newNoteLaneIndex;
+    SequencerScene *scene;
+    bool firstRedo;
 };
 
 // ###########################################################################
@@ -81,16 +93,17 @@ private:
 class MoveNotesHorizontallyCommand : public QUndoCommand
 {
 public:
-    MoveNotesHorizontallyCommand(const SimpleVector<QGraphicsItem *> &notes, const SimpleVector<float> &initialPositions);
+    MoveNotesHorizontallyCommand(const NoteIDList &notes, double xOffset, SequencerScene *scene);
     void undo();
     void redo();
 
 private:
-    void moveTheNotes(const SimpleVector<float> &positions);
+    void moveTheNotes(double offset);
 
-    SimpleVector<QGraphicsItem*> notesToMove;
-    SimpleVector<float> oldPositions;
-    SimpleVector<float> newPositions;
+    NoteIDList notesToMove;
+    double xOffset;
+    SequencerScene *scene;
+    bool firstRedo;
 };
 
 // ###########################################################################
@@ -99,16 +112,17 @@ private:
 class ResizeNotesCommand : public QUndoCommand
 {
 public:
-    ResizeNotesCommand(const SimpleVector<QGraphicsItem *> &notes, const SimpleVector<float> &initialLengths);
+    ResizeNotesCommand(const NoteIDList &notes, double lengthDifference, SequencerScene *scene);
     void undo();
     void redo();
 
 private:
-    void resizeTheNotes(const SimpleVector<float> &lengths);
+    void resizeTheNotes(double difference);
 
-    SimpleVector<QGraphicsItem*> notesToResize;
-    SimpleVector<float> oldLengths;
-    SimpleVector<float> newLengths;
+    NoteIDList notesToResize;
+    double lengthDifference;
+    SequencerScene *scene;
+    bool firstRedo;
 };
 
 #endif
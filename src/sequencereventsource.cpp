@@ -0,0 +1,245 @@
+#include "sequencereventsource.h"
+#include "dynamictonality.h"
+#include "hexsettings.h"
+#include <algorithm>
+
+// std::push_heap() and std::pop_heap() keep the largest element first, so this puts the earliest event first
+static bool isLaterEvent(const SequencerEvent &first, const SequencerEvent &second)
+{
+    return SequencerEvent::compareEvents(second, first);
+}
+
+// ###########################################################################
+// ###################################################### NOTE EVENT SOURCE
+
+NoteEventSource::NoteEventSource(const NoteStore &store, const std::vector<NoteID> &notes)
+    : store(store), notesByStart(notes), nextNote(0)
+{
+    std::sort(notesByStart.begin(), notesByStart.end(), [&store](NoteID a, NoteID b) {return store[a].start < store[b].start;});
+}
+
+bool NoteEventSource::next(SequencerEvent &event)
+{
+    // find the next note that DT can convert
+    SequencerEvent noteOn;
+    SequencerEvent noteOff;
+    bool hasNoteOn = false;
+
+    while (nextNote < notesByStart.size() && !hasNoteOn)
+    {
+        const NoteRecord &note = store[notesByStart[nextNote]];
+
+        short int j, k;
+        HexSettings::convertNoteLaneIndexToJK(note.laneIndex, j, k);
+
+        unsigned char channel, number;
+        if (DynamicTonality::captureMIDIFromJK(j, k, channel, number))
+        {
+            channel += 143;
+            noteOn.setData(SequencerEvent::MIDINoteOn, note.start, channel, number, note.velocity, note.track);
+            noteOff.setData(SequencerEvent::MIDINoteOff, note.start + note.duration, channel, number, 0, note.track);
+            hasNoteOn = true;
+        }
+        else
+        {
+            ++nextNote; // ignore notes that DT can't convert
+        }
+    }
+
+    // a note off that comes first
+    if (!pendingNoteOffs.empty() && (!hasNoteOn || SequencerEvent::compareEvents(pendingNoteOffs.front(), noteOn)))
+    {
+        std::pop_heap(pendingNoteOffs.begin(), pendingNoteOffs.end(), isLaterEvent);
+        event = pendingNoteOffs.back();
+        pendingNoteOffs.pop_back();
+        return true;
+    }
+
+    if (!hasNoteOn)
+        return false;
+
+    ++nextNote;
+    pendingNoteOffs.push_back(noteOff);
+    std::push_heap(pendingNoteOffs.begin(), pendingNoteOffs.end(), isLaterEvent);
+    event = noteOn;
+    return true;
+}
+
+void NoteEventSource::rewind()
+{
+    nextNote = 0;
+    pendingNoteOffs.clear();
+}
+
+// ###########################################################################
+// ################################################## ENVELOPE EVENT SOURCE
+
+EnvelopeEventSource::EnvelopeEventSource(const SimpleMap<unsigned int, float> *nodes, double millisecondsPerTick, SequencerEvent::Type eventType)
+    : nodes(nodes),
+      millisecondsPerTick(millisecondsPerTick),
+      ticksPerMillisecond(1. / millisecondsPerTick),
+      eventType(eventType),
+      isMIDICC(false),
+      ccType(0),
+      channel(0),
+      track(0)
+{
+    rewind();
+}
+
+EnvelopeEventSource::EnvelopeEventSource(const SimpleMap<unsigned int, float> *nodes,
+                                         double millisecondsPerTick,
+                                         unsigned char ccType,
+                                         unsigned char channel,
+                                         unsigned char track,
+                                         SequencerEvent::Type eventType)
+    : nodes(nodes),
+      millisecondsPerTick(millisecondsPerTick),
+      ticksPerMillisecond(1. / millisecondsPerTick),
+      eventType(eventType),
+      isMIDICC(true),
+      ccType(ccType),
+      channel(channel + 175),
+      track(track)
+{
+    rewind();
+}
+
+// one event per step of each ramp, though a MIDI CC ramp can't have more than one per CC value
+int EnvelopeEventSource::estimatedCount() const
+{
+    const unsigned int *keys = nodes->getKeyArray();
+    const float *values = nodes->getValueArray();
+    int count = (nodes->count() > 0) ? 1 : 0; // the last node
+
+    for (int i = 0; i < nodes->count() - 1; ++i)
+    {
+        if (values[i] == values[i + 1])
+            continue;
+
+        double numSteps = (keys[i + 1] - keys[i]) * millisecondsPerTick / HexSettings::envelopeResolutionMS + 1.;
+        count += int(isMIDICC ? std::min(numSteps, 128.) : numSteps);
+    }
+
+    return count;
+}
+
+bool EnvelopeEventSource::next(SequencerEvent &event)
+{
+    const unsigned int *keys = nodes->getKeyArray();
+    const float *values = nodes->getValueArray();
+    int lastNode = nodes->count() - 1;
+
+    while (segment < lastNode)
+    {
+        double startMS = keys[segment] * millisecondsPerTick;
+        double endMS = keys[segment + 1] * millisecondsPerTick;
+
+        if (values[segment] == values[segment + 1] || msPos > endMS) // on to the next ramp
+        {
+            ++segment;
+            msPos = endMS;
+            continue;
+        }
+
+        // linear interpolation (weighted average)
+        double amountValuesJ = (msPos - startMS) / (endMS - startMS);
+        double interpolatedValue = amountValuesJ * values[segment + 1] + (1. - amountValuesJ) * values[segment];
+        unsigned int ticks = msPos * ticksPerMillisecond;
+        msPos += HexSettings::envelopeResolutionMS;
+
+        if (setEvent(event, ticks, interpolatedValue))
+            return true;
+    }
+
+    if (segment == lastNode) // the last node (or first if there's only one)
+    {
+        ++segment;
+
+        if (isMIDICC)
+            event.setData(eventType, keys[lastNode], channel, ccType, static_cast<unsigned char>(values[lastNode] * 127. + .5), track);
+        else
+            event.setData(eventType, keys[lastNode], values[lastNode] * 1200.f);
+
+        return true;
+    }
+
+    return false;
+}
+
+void EnvelopeEventSource::rewind()
+{
+    segment = 0;
+    msPos = (nodes->count() == 0) ? 0 : nodes->getKeyArray()[0] * millisecondsPerTick;
+    previousCCValue = -1;
+}
+
+bool EnvelopeEventSource::setEvent(SequencerEvent &event, unsigned int ticks, double value)
+{
+    if (!isMIDICC)
+    {
+        event.setData(eventType, ticks, static_cast<float>(value * 1200.));
+        return true;
+    }
+
+    unsigned char finalValue = static_cast<unsigned char>(value * 127. + .5); // rounds
+
+    if (finalValue == previousCCValue) // don't send duplicate values
+        return false;
+
+    previousCCValue = finalValue;
+    event.setData(eventType, ticks, channel, ccType, finalValue, track);
+    return true;
+}
+
+// ###########################################################################
+// ################################################### SEQUENCER EVENT MERGER
+
+SequencerEventMerger::~SequencerEventMerger()
+{
+    for (size_t i = 0; i < sources.size(); ++i)
+        delete sources[i];
+}
+
+void SequencerEventMerger::addSource(SequencerEventSource *source)
+{
+    sources.push_back(source);
+    nextEvents.push_back(SequencerEvent());
+    hasNextEvent.push_back(source->next(nextEvents.back()));
+}
+
+int SequencerEventMerger::estimatedCount() const
+{
+    int count = 0;
+    for (size_t i = 0; i < sources.size(); ++i)
+        count += sources[i]->estimatedCount();
+
+    return count;
+}
+
+bool SequencerEventMerger::next(SequencerEvent &event)
+{
+    int earliest = -1;
+
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        if (hasNextEvent[i] && (earliest == -1 || SequencerEvent::compareEvents(nextEvents[i], nextEvents[earliest])))
+            earliest = i;
+    }
+
+    if (earliest == -1)
+        return false;
+
+    event = nextEvents[earliest];
+    hasNextEvent[earliest] = sources[earliest]->next(nextEvents[earliest]);
+    return true;
+}
+
+void SequencerEventMerger::rewind()
+{
+    for (size_t i = 0; i < sources.size(); ++i)
+    {
+        sources[i]->rewind();
+        hasNextEvent[i] = sources[i]->next(nextEvents[i]);
+    }
+}
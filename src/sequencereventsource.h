@@ -0,0 +1,96 @@
+#ifndef SEQUENCEREVENTSOURCE_H
+#define SEQUENCEREVENTSOURCE_H
+#include "notestore.h"
+#include "sequencerevent.h"
+#include "simplemap.h"
+#include <vector>
+
+// Produces events one at a time, in the same order as
+// SequencerEvent::compareEvents(), without making an array of them first.
+// This is for exporting, where the whole song's events would take up a lot
+// of memory but are only needed once each (well, twice; see rewind()).
+
+class SequencerEventSource
+{
+public:
+    virtual ~SequencerEventSource() {}
+    virtual int estimatedCount() const = 0; // roughly how many events there are, for sizing buffers
+    virtual bool next(SequencerEvent &event) = 0; // returns false once there are no more events
+    virtual void rewind() = 0; // starts over from the first event
+};
+
+// ###########################################################################
+// ###########################################################################
+
+// the note ons and offs for some notes, which must not change while this is in use
+class NoteEventSource : public SequencerEventSource
+{
+public:
+    NoteEventSource(const NoteStore &store, const std::vector<NoteID> &notes);
+    int estimatedCount() const {return 2 * notesByStart.size();}
+    bool next(SequencerEvent &event);
+    void rewind();
+
+private:
+    const NoteStore &store;
+    std::vector<NoteID> notesByStart;
+    std::vector<SequencerEvent> pendingNoteOffs; // a heap, earliest first, of the notes that have started
+    size_t nextNote;
+};
+
+// ###########################################################################
+// ###########################################################################
+
+// the same events as FloatEnvelopeGenerator and MIDICCEnvelopeGenerator
+class EnvelopeEventSource : public SequencerEventSource
+{
+public:
+    EnvelopeEventSource(const SimpleMap<unsigned int, float> *nodes, double millisecondsPerTick, SequencerEvent::Type eventType);
+    EnvelopeEventSource(const SimpleMap<unsigned int, float> *nodes,
+                        double millisecondsPerTick,
+                        unsigned char ccType,
+                        unsigned char channel,
+                        unsigned char track,
+                        SequencerEvent::Type eventType); // repeated values are left out
+    int estimatedCount() const;
+    bool next(SequencerEvent &event);
+    void rewind();
+
+private:
+    bool setEvent(SequencerEvent &event, unsigned int ticks, double value); // returns false if the event should be left out
+
+    const SimpleMap<unsigned int, float> *nodes;
+    const double millisecondsPerTick;
+    const double ticksPerMillisecond;
+    const SequencerEvent::Type eventType;
+    const bool isMIDICC;
+    const unsigned char ccType;
+    const unsigned char channel;
+    const unsigned char track;
+
+    int segment; // the ramp from node segment to node segment + 1
+    double msPos;
+    int previousCCValue; // -1 if none yet
+};
+
+// ###########################################################################
+// ###########################################################################
+
+// merges other sources, which it takes ownership of, into one
+class SequencerEventMerger : public SequencerEventSource
+{
+public:
+    ~SequencerEventMerger();
+    void addSource(SequencerEventSource *source);
+    int estimatedCount() const;
+    bool next(SequencerEvent &event);
+    void rewind();
+
+private:
+    // there are only ever a few sources (a track's notes and its envelopes), so a linear search beats a heap
+    std::vector<SequencerEventSource*> sources;
+    std::vector<SequencerEvent> nextEvents;
+    std::vector<bool> hasNextEvent;
+};
+
+#endif
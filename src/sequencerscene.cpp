@@ -1,10 +1,16 @@
 #include "sequencerscene.h"
+#include "editjournal.h"
 #include "latticedata.h"
 #include "note.h"
 #include "notestruct.h"
+#include "projectfile.h"
+#include "qdatastreamoperators.h"
 #include "sequencercommands.h"
+#include "tracknoterenderer.h"
 #include <QtWidgets/QGraphicsSceneMouseEvent>
 #include <QtWidgets/QGraphicsView>
+#include <algorithm>
+#include <limits>
 
 // ===================================================== QDATASTREAM OPERATORS
 QDataStream &operator>>(QDataStream &in, NoteStruct &note)
@@ -13,28 +19,45 @@ QDataStream &operator>>(QDataStream &in, NoteStruct &note)
     return in;
 }
 
-QDataStream &operator<<(QDataStream &out, Note *note)
+QDataStream &operator<<(QDataStream &out, const NoteRecord &note)
 {
     short int j, k;
-    HexSettings::convertNoteLaneIndexToJK(note->getLaneIndex(), j, k);
-    out << note->track() << static_cast<float>(note->pos().x()) << static_cast<float>(note->boundingRect().width()) << note->getVelocity() << j << k;
+    HexSettings::convertNoteLaneIndexToJK(note.laneIndex, j, k);
+    out << note.track << static_cast<float>(note.start) << static_cast<float>(note.duration) << note.velocity << j << k;
     return out;
 }
 // ===========================================================================
 
 const double noteLaneWidth = .09;
 const double halfNoteLaneWidth = noteLaneWidth * .5;
+const int maxItemNoteIndexEdits = 64; // past this many since the index was sorted, sorting it again is cheaper than shifting it for each edit
+const int maxNoteItems = 5000; // if there are more notes than this in the item window, every track is drawn in batches
 
 SequencerScene::SequencerScene(LatticeData *latticeData, BarLineDrawer *barLineDrawer, QUndoStack *undoStack, QWidget *view)
     : AbstractSequencerScene(barLineDrawer, undoStack, view),
       latticeData(latticeData),
-      noteBeingCreated(0),
+      noteBeingCreated(invalidNoteID),
       defaultVelocity(90),
       darkLaneBrush(Qt::SolidPattern),
       lightLaneBrush(Qt::SolidPattern),
       pressedLaneBrush(Qt::SolidPattern),
-      m_currentTrack(0)
+      m_currentTrack(0),
+      m_batchedTrackRendering(true),
+      itemWindowLeft(-std::numeric_limits<double>::max()), // everything, until the view reports what it shows
+      itemWindowRight(std::numeric_limits<double>::max()),
+      zoomedOutToSummary(false),
+      longestIndexedNoteDuration(0),
+      itemNoteIndexDirty(true),
+      itemNoteIndexEdits(0),
+      m_noteItemsShown(true),
+      journal(0)
 {
+    // Note items take their y from the lattice when they're painted, so an
+    // index of their bounding rects would go stale whenever the lattice is
+    // retuned. There are only ever as many note items as fit around the
+    // visible part of the scene, so searching them all is cheap.
+    setItemIndexMethod(NoIndex);
+
     selectedNotePen.setCosmetic(true);
     unselectedNotePen.setCosmetic(true);
 
@@ -43,192 +66,517 @@ SequencerScene::SequencerScene(LatticeData *latticeData, BarLineDrawer *barLineD
         activeNoteBrushes[i].setStyle(Qt::SolidPattern);
         inactiveNoteBrushes[i].setStyle(Qt::SolidPattern);
     }
+
+    for (int i = 0; i < HexSettings::maxNumTracks; ++i)
+    {
+        trackRenderers[i] = new TrackNoteRenderer(i, latticeData);
+        addItem(trackRenderers[i]);
+    }
 }
 
-QGraphicsItem *SequencerScene::addNote(const NoteStruct &note)
+SequencerScene::~SequencerScene()
 {
-    int noteLaneIndex = HexSettings::convertJKToNoteLaneIndex(note.j, note.k);
-    Note *newNote = new Note(note.duration, note.velocity, noteLaneIndex, note.track);
-    newNote->setPos(note.startPosition, latticeData->buttonPositions[noteLaneIndex].y());
-    addItem(newNote);
-    return newNote;
+    clearNotes(); // puts every item in the pool, which the scene doesn't own
+
+    for (size_t i = 0; i < spareNoteItems.size(); ++i)
+        delete spareNoteItems[i];
 }
 
+void SequencerScene::acquireNoteItem(NoteID id)
+{
+    NoteRecord &note = noteStore[id];
+
+    if (spareNoteItems.empty())
+    {
+        note.item = new Note(id, latticeData);
+    }
+    else
+    {
+        note.item = spareNoteItems.back();
+        spareNoteItems.pop_back();
+        note.item->setId(id);
+    }
+
+    note.item->setListIndex(noteItems.size());
+    noteItems.push_back(note.item);
+    note.item->setEditable(note.track == m_currentTrack);
+    addItem(note.item);
+    note.item->setSelected(note.selected);
+    updateNoteItem(note);
+}
+
+NoteID SequencerScene::addNote(const NoteStruct &note)
+{
+    NoteID id = createNote(note.startPosition, note.duration, HexSettings::convertJKToNoteLaneIndex(note.j, note.k), note.velocity, note.track);
+    insertNote(id);
+    return id;
+}
+
+SimpleVector<NoteID> SequencerScene::allNotes() const
+{
+    int numNotes = 0;
+    for (int track = 0; track < HexSettings::maxNumTracks; ++track)
+        numNotes += notesInTrack[track].size();
+
+    SimpleVector<NoteID> notes(numNotes);
+    for (int track = 0; track < HexSettings::maxNumTracks; ++track)
+    {
+        for (size_t i = 0; i < notesInTrack[track].size(); ++i)
+            notes.append(notesInTrack[track][i]);
+    }
+
+    return notes;
+}
+
+void SequencerScene::clearNotes()
+{
+    while (!noteItems.empty())
+        releaseNoteItem(noteStore[noteItems.back()->id()]);
+
+    for (int track = 0; track < HexSettings::maxNumTracks; ++track)
+    {
+        notesInTrack[track].clear();
+        trackRenderers[track]->invalidate();
+    }
+
+    noteStore.clear();
+    noteBeingCreated = invalidNoteID;
+    itemNoteIndexDirty = true;
+}
+
+// the notes are copied one column per field, so that pasting can read each column in one go
 bool SequencerScene::copyImplementation(QDataStream &stream)
 {
-    SimpleVector<QGraphicsItem*> itemsToCopy(selectedItems());
+    SimpleVector<NoteID> notesToCopy(selectedNotes());
+    int numNotes = notesToCopy.size();
 
-    if (itemsToCopy.size() == 0)
+    if (numNotes == 0)
         return false;
 
-    stream << itemsToCopy.size();
+    NoteColumns columns;
+    columns.starts.reserve(numNotes);
+    columns.durations.reserve(numNotes);
+    columns.laneIndexes.reserve(numNotes);
+    columns.velocities.reserve(numNotes);
+
+    for (int i = 0; i < numNotes; ++i)
+    {
+        const NoteRecord &note = noteStore[notesToCopy[i]];
+        columns.starts.push_back(note.start);
+        columns.durations.push_back(note.duration);
+        columns.laneIndexes.push_back(note.laneIndex);
+        columns.velocities.push_back(note.velocity);
+    }
+
+    stream << numNotes;
+    writeRawColumn(stream, columns.starts);
+    writeRawColumn(stream, columns.durations);
+    writeRawColumn(stream, columns.laneIndexes);
+    writeRawColumn(stream, columns.velocities);
+    return true;
+}
+
+bool SequencerScene::countItemNoteIndexEdit()
+{
+    if (itemNoteIndexDirty)
+        return false; // it's rebuilt before it's used anyway
 
-    for (int i = 0; i < itemsToCopy.size(); ++i)
+    if (++itemNoteIndexEdits > maxItemNoteIndexEdits)
     {
-        stream << static_cast<Note*>(itemsToCopy[i]);
+        itemNoteIndexDirty = true;
+        return false;
     }
 
     return true;
 }
 
+NoteID SequencerScene::createNote(double start, double duration, unsigned short laneIndex, unsigned char velocity, int track)
+{
+    return noteStore.create(start, duration, laneIndex, velocity, track);
+}
+
 QUndoCommand *SequencerScene::deleteCommand()
 {
-    SimpleVector<QGraphicsItem*> itemsToDelete(selectedItems());
+    SimpleVector<NoteID> notesToDelete(selectedNotes());
 
-    if (itemsToDelete.size() == 0)
+    if (notesToDelete.size() == 0)
         return 0;
     else
-        return new DeleteNotesCommand(itemsToDelete);
+        return new DeleteNotesCommand(notesToDelete, this);
+}
+
+bool SequencerScene::decodeNoteChunk(const QByteArray &chunk, NoteColumns &columns)
+{
+    QDataStream in(chunk);
+    in.setVersion(13);
+
+    quint32 numNotes;
+    in >> numNotes;
+
+    const int bytesPerNote = 8 + 8 + 2 + 1;
+    if (in.status() != QDataStream::Ok || numNotes > static_cast<quint32>(chunk.size() / bytesPerNote))
+        return false;
+
+    columns.starts.resize(numNotes);
+    columns.durations.resize(numNotes);
+    columns.laneIndexes.resize(numNotes);
+    columns.velocities.resize(numNotes);
+
+    qint64 start = 0;
+    for (quint32 i = 0; i < numNotes; ++i)
+    {
+        qint64 distance;
+        in >> distance;
+        start += distance;
+        columns.starts[i] = start / ProjectFile::tickScale;
+    }
+
+    for (quint32 i = 0; i < numNotes; ++i)
+    {
+        qint64 duration;
+        in >> duration;
+        columns.durations[i] = duration / ProjectFile::tickScale;
+    }
+
+    for (quint32 i = 0; i < numNotes; ++i)
+        in >> columns.laneIndexes[i];
+
+    for (quint32 i = 0; i < numNotes; ++i)
+        in >> columns.velocities[i];
+
+    if (in.status() != QDataStream::Ok)
+    {
+        columns = NoteColumns();
+        return false;
+    }
+
+    return true;
+}
+
+void SequencerScene::deselectAll()
+{
+    // notes without items can be selected too, so clearing the items' selection isn't enough
+    if (m_currentTrack != -1)
+    {
+        const std::vector<NoteID> &notes = notesInTrack[m_currentTrack];
+        for (size_t i = 0; i < notes.size(); ++i)
+            noteStore[notes[i]].selected = false;
+    }
+
+    clearSelection();
 }
 
 void SequencerScene::drawBackground(QPainter *painter, const QRectF &rect)
+{
+    AbstractSequencerScene::drawBackground(painter, rect); // the lanes and bar lines, from the tile cache
+
+    // pressed lanes change all the time during playback, so they aren't cached
+    painter->setPen(Qt::NoPen);
+    painter->setRenderHint(QPainter::Antialiasing, true);
+    painter->setBrush(pressedLaneBrush);
+    drawLineSet(painter, rect, latticeData->pressedButtons);
+    painter->setRenderHint(QPainter::Antialiasing, false);
+}
+
+void SequencerScene::drawLineSet(QPainter *painter, const QRectF &rect, const ButtonSet &buttons)
+{
+    // QRectF is implemented in terms of left/top/width/height, so it's faster to calculate this just once
+    double rectTop = rect.top() - halfNoteLaneWidth; // allows lanes slightly off screen (or off a tile) to be partially visible
+    double rectBottom = rect.bottom() + halfNoteLaneWidth;
+
+    for (int i = buttons.first(); i != -1; i = buttons.next(i))
+    {
+        if (latticeData->buttonPositions[i].y() > rectTop && latticeData->buttonPositions[i].y() < rectBottom)
+            painter->drawRect(QRectF(rect.left(), latticeData->buttonPositions[i].y() - halfNoteLaneWidth, rect.width(), noteLaneWidth));
+    }
+}
+
+void SequencerScene::drawStaticBackground(QPainter *painter, const QRectF &rect)
 {
     painter->setPen(Qt::NoPen);
     painter->setRenderHint(QPainter::Antialiasing, true);
 
     painter->setBrush(darkLaneBrush);
-    drawLineSet(painter, rect, latticeData->darkIndices);
+    drawLineSet(painter, rect, latticeData->darkButtons);
     painter->setBrush(lightLaneBrush);
-    drawLineSet(painter, rect, latticeData->lightIndices);
-    painter->setBrush(pressedLaneBrush);
-    drawLineSet(painter, rect, latticeData->pressedIndices);
+    drawLineSet(painter, rect, latticeData->lightButtons);
 
     painter->setRenderHint(QPainter::Antialiasing, false);
 
-    AbstractSequencerScene::drawBackground(painter, rect); // draws the bar lines
+    drawBarLines(painter, rect);
 }
 
-void SequencerScene::drawLineSet(QPainter *painter, const QRectF &rect, const SimpleVector<unsigned int> &indices)
+int SequencerScene::findClosestNoteLane(double yPos) const
 {
-    // QRectF is implemented in terms of left/top/width/height, so it's faster to calculate this just once
-    double rectBottom = rect.bottom() + noteLaneWidth; // allows lanes slightly off screen to be partially visible
+    const SimpleVector<LanePosition> &lanes = latticeData->lanesSortedByY;
 
-    for (int i = 0; i < indices.size(); ++i)
+    if (lanes.size() == 0)
+        return 0;
+
+    int i = findFirstLaneBelow(yPos);
+
+    if (i == lanes.size())
+        return lanes[i - 1].index;
+
+    if (i > 0 && yPos - lanes[i - 1].y < lanes[i].y - yPos)
+        return lanes[i - 1].index;
+
+    return lanes[i].index;
+}
+
+int SequencerScene::findFirstLaneBelow(double yPos) const
+{
+    // binary search for the first lane whose y is >= yPos
+    const SimpleVector<LanePosition> &lanes = latticeData->lanesSortedByY;
+    int low = 0;
+    int high = lanes.size();
+
+    while (low < high)
     {
-        if (latticeData->buttonPositions[indices[i]].y() > rect.top() && latticeData->buttonPositions[indices[i]].y() < rectBottom)
-            painter->drawRect(QRectF(rect.left(), latticeData->buttonPositions[indices[i]].y() - halfNoteLaneWidth, rect.width(), noteLaneWidth));
+        int middle = (low + high) / 2;
+
+        if (lanes[middle].y < yPos)
+            low = middle + 1;
+        else
+            high = middle;
     }
+
+    return low;
 }
 
-int SequencerScene::findClosestNoteLane(double yPos) const
+int SequencerScene::findTopmostNoteLane(double yPos) const
 {
-    double closestDistance = 999999999;
-    unsigned int closestIndex = 0;
+    // light lanes are drawn over dark ones, so they take precedence where lanes overlap
+    const SimpleVector<LanePosition> &lanes = latticeData->lanesSortedByY;
+    double yPosLowerBound = yPos + halfNoteLaneWidth;
+    int closestLane = -1;
+    double closestDistance = halfNoteLaneWidth;
+    bool closestLaneIsLight = false;
+
+    for (int i = findFirstLaneBelow(yPos - halfNoteLaneWidth); i < lanes.size() && lanes[i].y < yPosLowerBound; ++i)
+    {
+        double distance = qAbs(lanes[i].y - yPos);
 
-    auto scanIndices = [=](const SimpleVector<unsigned int> &indices, double &closestDistance, unsigned int &closestIndex) {
-        for (int i = 0; i < indices.size(); ++i) // look through the light lines
+        if ((lanes[i].isLight && !closestLaneIsLight) || (lanes[i].isLight == closestLaneIsLight && distance < closestDistance))
         {
-            double thisDistance = qAbs(yPos - latticeData->buttonPositions[indices[i]].y());
-            if (thisDistance < closestDistance)
-            {
-                closestDistance = thisDistance;
-                closestIndex = indices[i];
-            }
+            closestLane = lanes[i].index;
+            closestDistance = distance;
+            closestLaneIsLight = lanes[i].isLight;
         }
-    };
+    }
+
+    return closestLane; // -1 if no note lane found
+}
+
+// The index is kept sorted as notes come and go, so that editing a note
+// doesn't mean sorting all of them again. A lot of edits at once (e.g.,
+// dragging a big selection) would each shift most of the index, though, so
+// after enough of them it's left to be rebuilt.
+void SequencerScene::indexNote(NoteID id)
+{
+    if (!countItemNoteIndexEdit())
+        return;
 
-    scanIndices(latticeData->lightIndices, closestDistance, closestIndex);
-    scanIndices(latticeData->darkIndices, closestDistance, closestIndex);
+    const NoteRecord &note = noteStore[id];
+    IndexedNote indexedNote = {note.start, id};
+    itemNoteIndex.insert(std::upper_bound(itemNoteIndex.begin(), itemNoteIndex.end(), indexedNote, IndexedNote::compare), indexedNote);
 
-    return closestIndex;
+    // this only ever grows until the index is rebuilt, which just means looking a little further back for notes
+    if (note.duration > longestIndexedNoteDuration)
+        longestIndexedNoteDuration = note.duration;
 }
 
-int SequencerScene::findTopmostNoteLane(double yPos) const
+void SequencerScene::invalidateIndexedTrackRenderers()
 {
-    double yPosLowerBound = yPos + halfNoteLaneWidth;
-    double yPosUpperBound = yPos - halfNoteLaneWidth;
+    // the renderers of the tracks with items weren't kept up to date
+    for (int track = 0; track < HexSettings::maxNumTracks; ++track)
+    {
+        if (trackIsIndexed(track))
+            trackRenderers[track]->invalidate();
+    }
+
+    update();
+}
+
+void SequencerScene::insertNote(NoteID id)
+{
+    NoteRecord &note = noteStore[id];
+
+    if (note.indexInTrack != -1)
+        return; // already in the scene
+
+    std::vector<NoteID> &notes = notesInTrack[note.track];
+    note.indexInTrack = notes.size();
+    notes.push_back(id);
 
-    for (int i = 0; i < latticeData->lightIndices.size(); ++i)
+    if (journal)
+        journal->noteInserted(note);
+
+    if (trackIsIndexed(note.track))
+        indexNote(id);
+
+    if (!trackUsesItems(note.track))
+        trackRenderers[note.track]->noteAdded(note);
+    else if (noteIsInItemWindow(note))
+        acquireNoteItem(id);
+}
+
+void SequencerScene::insertNoteColumns(int track, const NoteColumns &columns)
+{
+    std::vector<NoteID> ids;
+    ids.reserve(columns.starts.size());
+
+    for (size_t i = 0; i < columns.starts.size(); ++i)
     {
-        if (yPosLowerBound > latticeData->buttonPositions[latticeData->lightIndices[i]].y() && yPosUpperBound < latticeData->buttonPositions[latticeData->lightIndices[i]].y())
-            return latticeData->lightIndices[i];
+        if (columns.laneIndexes[i] >= HexSettings::numButtons || columns.velocities[i] > 127)
+            continue;
+
+        NoteID id = createNote(columns.starts[i], columns.durations[i], columns.laneIndexes[i], columns.velocities[i], track);
+        if (id != invalidNoteID)
+            ids.push_back(id);
     }
 
-    for (int i = 0; i < latticeData->darkIndices.size(); ++i)
+    insertNotes(ids);
+}
+
+// Inserting notes one at a time marks the item index dirty and adds an item
+// for every note that lands in the item window, each time. Here every note
+// goes into its track's list first, and then the index is rebuilt and the
+// items handed out once.
+void SequencerScene::insertNotes(const std::vector<NoteID> &ids)
+{
+    bool trackChanged[HexSettings::maxNumTracks] = {};
+
+    for (size_t i = 0; i < ids.size(); ++i)
     {
-        if (yPosLowerBound > latticeData->buttonPositions[latticeData->darkIndices[i]].y() && yPosUpperBound < latticeData->buttonPositions[latticeData->darkIndices[i]].y())
-            return latticeData->darkIndices[i];
+        NoteRecord &note = noteStore[ids[i]];
+
+        if (note.indexInTrack != -1)
+            continue; // already in the scene
+
+        std::vector<NoteID> &notes = notesInTrack[note.track];
+        note.indexInTrack = notes.size();
+        notes.push_back(ids[i]);
+        trackChanged[note.track] = true;
+
+        if (journal)
+            journal->noteInserted(note);
     }
 
-    return -1; // no note lane found
+    for (int track = 0; track < HexSettings::maxNumTracks; ++track)
+    {
+        if (!trackChanged[track])
+            continue;
+
+        if (trackIsIndexed(track))
+            itemNoteIndexDirty = true;
+
+        if (!trackUsesItems(track))
+            trackRenderers[track]->invalidate();
+    }
+
+    if (itemNoteIndexDirty)
+        updateNoteItems();
 }
 
-void SequencerScene::insertTrack(int index, const SimpleVector<Note*> &itemsInTrack)
+void SequencerScene::insertTrack(int index, const SimpleVector<NoteID> &notesInTrack)
 {
-    SimpleVector<QGraphicsItem*> allItems(items());
-    for (int i = 0; i < allItems.size(); ++i)
+    // shift the lists of the following tracks up by one and renumber only their notes
+    for (int track = HexSettings::maxNumTracks - 1; track > index; --track)
     {
-        if (static_cast<Note*>(allItems[i])->track() >= index)
-            static_cast<Note*>(allItems[i])->setTrack(static_cast<Note*>(allItems[i])->track() + 1);
+        this->notesInTrack[track].swap(this->notesInTrack[track - 1]);
+
+        for (size_t i = 0; i < this->notesInTrack[track].size(); ++i)
+            noteStore[this->notesInTrack[track][i]].track = track;
+
+        trackRenderers[track]->invalidate();
     }
 
-    for (int i = 0; i < itemsInTrack.size(); ++i)
+    trackRenderers[index]->invalidate();
+    itemNoteIndexDirty = true;
+
+    if (m_currentTrack >= index)
+        ++m_currentTrack;
+
+    for (int i = 0; i < notesInTrack.size(); ++i)
     {
-        itemsInTrack[i]->setTrack(index); // items might not actually "be" in this track
-        addItem(itemsInTrack[i]);
+        noteStore[notesInTrack[i]].track = index; // notes might not actually "be" in this track
+        insertNote(notesInTrack[i]);
     }
 }
 
 void SequencerScene::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
 {
-    if (noteBeingCreated != NULL)
+    if (noteBeingCreated != invalidNoteID)
     {
-        if (noteBeingCreated->scene() == 0)
-            addItem(noteBeingCreated);
+        if (noteStore[noteBeingCreated].indexInTrack == -1)
+        {
+            insertNote(noteBeingCreated);
+            setNoteSelected(noteBeingCreated, true);
+        }
 
-        double noteWidth = roundToNearestSnapPos(event->scenePos().x()) - noteBeingCreated->pos().x();
+        double noteWidth = roundToNearestSnapPos(event->scenePos().x()) - noteStore[noteBeingCreated].start;
 
         if (noteWidth < 0)
             noteWidth = 0;
 
-        noteBeingCreated->setWidth(noteWidth);
+        setNoteDuration(noteBeingCreated, noteWidth);
     }
     else
     {
         QGraphicsScene::mouseMoveEvent(event);
     }
 }
-#include <QDebug>
+
 void SequencerScene::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
-    noteBeingCreated = NULL;
+    noteBeingCreated = invalidNoteID;
 
     if (event->button() != Qt::LeftButton)
+    {
+        if (!event->modifiers().testFlag(Qt::ControlModifier))
+            deselectAll(); // the rubber band can only select notes with items
+
         return; // start a rubber band drag
+    }
 
     // check if an item wants the event
     QGraphicsScene::mousePressEvent(event);
     if (event->isAccepted()) // if clicked on a note
         return;
 
-    int noteLaneIndex = findTopmostNoteLane(event->scenePos().y());
-    if (noteLaneIndex == -1) // if no note lane at click position
+    // a click on a note that's drawn without an item would otherwise draw a new note on top of it
+    int noteLaneIndex = trackUsesItems(m_currentTrack) ? findTopmostNoteLane(event->scenePos().y()) : -1;
+    if (noteLaneIndex == -1) // if no note lane at click position, or notes can't be drawn in at this zoom
+    {
+        if (!event->modifiers().testFlag(Qt::ControlModifier))
+            deselectAll(); // QGraphicsScene only deselected the notes with items
+
         return; // start a rubber band drag
+    }
 
-    clearSelection();
-    noteBeingCreated = new Note(snapSize(), defaultVelocity, noteLaneIndex, currentTrack()); // create but do not add (unless dragged)
-    noteBeingCreated->setPos(roundToLowerSnapPos(event->scenePos().x()), latticeData->buttonPositions[noteLaneIndex].y());
-    noteBeingCreated->setSelected(true);
+    deselectAll();
+    noteBeingCreated = createNote(roundToLowerSnapPos(event->scenePos().x()), snapSize(), noteLaneIndex, defaultVelocity, currentTrack()); // create but do not add (unless dragged)
     event->accept(); // prevents rubber band drag
 }
 
 void SequencerScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 {
-    if (noteBeingCreated != NULL)
+    if (noteBeingCreated != invalidNoteID)
     {
-        if (noteBeingCreated->scene() == 0 || noteBeingCreated->boundingRect().width() == 0)
+        if (noteStore[noteBeingCreated].indexInTrack == -1 || noteStore[noteBeingCreated].duration == 0)
         {
-            delete noteBeingCreated;
+            releaseNote(noteBeingCreated);
             roundSetAndEmitCursorPos(event->scenePos().x());
         }
         else
         {
-            SimpleVector<QGraphicsItem*> note(1);
-            note.appendByValue(noteBeingCreated);
+            SimpleVector<NoteID> note(1);
+            note.append(noteBeingCreated);
             pushUndoCommand(new AddNotesCommand(note, this));
         }
 
-        noteBeingCreated = NULL;
+        noteBeingCreated = invalidNoteID;
     }
     else
     {
@@ -239,90 +587,295 @@ void SequencerScene::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
     }
 }
 
-QUndoCommand *SequencerScene::pasteCommand(QDataStream &stream, int numItems)
+// The notes are stored a column at a time, sorted by start, with each start
+// stored as the distance from the one before. Columns of small, similar
+// numbers are what qCompress() does best with.
+QByteArray SequencerScene::noteChunk(const NoteSnapshot &snapshot)
 {
-    NoteStruct *copiedNotes = new NoteStruct[numItems];
-    double leftmostCopiedNoteXPos = 999999999;
-    for (int i = 0; i < numItems; ++i)
+    const NoteStore &noteStore = snapshot.store;
+    std::vector<NoteID> notes(snapshot.ids);
+    std::sort(notes.begin(), notes.end(), [&noteStore](NoteID first, NoteID second) {return noteStore[first].start < noteStore[second].start;});
+
+    QByteArray chunk;
+    QDataStream out(&chunk, QIODevice::WriteOnly);
+    out.setVersion(13);
+
+    out << quint32(notes.size());
+
+    qint64 previousStart = 0;
+    for (size_t i = 0; i < notes.size(); ++i)
     {
-        stream >> copiedNotes[i];
-        if (copiedNotes[i].startPosition < leftmostCopiedNoteXPos)
-            leftmostCopiedNoteXPos = copiedNotes[i].startPosition;
+        qint64 start = qRound64(noteStore[notes[i]].start * ProjectFile::tickScale);
+        out << start - previousStart;
+        previousStart = start;
     }
 
+    for (size_t i = 0; i < notes.size(); ++i)
+        out << qRound64(noteStore[notes[i]].duration * ProjectFile::tickScale);
+
+    for (size_t i = 0; i < notes.size(); ++i)
+        out << quint16(noteStore[notes[i]].laneIndex);
+
+    for (size_t i = 0; i < notes.size(); ++i)
+        out << quint8(noteStore[notes[i]].velocity);
+
+    return chunk;
+}
+
+QUndoCommand *SequencerScene::pasteCommand(QDataStream &stream, int numItems)
+{
+    NoteColumns columns;
+
+    // anything left over means it isn't the columns that copyImplementation() writes
+    if (!readRawColumn(stream, columns.starts, numItems) || !readRawColumn(stream, columns.durations, numItems)
+            || !readRawColumn(stream, columns.laneIndexes, numItems) || !readRawColumn(stream, columns.velocities, numItems)
+            || !stream.atEnd())
+        return 0;
+
+    double leftmostCopiedNoteXPos = *std::min_element(columns.starts.begin(), columns.starts.end());
     double pastedNoteOffset = cursorPos() - leftmostCopiedNoteXPos;
 
-    SimpleVector<QGraphicsItem*> notesToPaste(numItems);
+    SimpleVector<NoteID> notesToPaste(numItems);
     for (int i = 0; i < numItems; ++i)
     {
-        int noteLaneIndex = HexSettings::convertJKToNoteLaneIndex(copiedNotes[i].j, copiedNotes[i].k);
-        Note *newNote = new Note(copiedNotes[i].duration, copiedNotes[i].velocity, noteLaneIndex, currentTrack());
-        newNote->setPos(copiedNotes[i].startPosition + pastedNoteOffset, latticeData->buttonPositions[noteLaneIndex].y());
-        newNote->setSelected(true);
-        notesToPaste.appendByValue(newNote);
+        if (columns.laneIndexes[i] >= HexSettings::numButtons || columns.velocities[i] > 127)
+            continue;
+
+        NoteID id = createNote(columns.starts[i] + pastedNoteOffset, columns.durations[i], columns.laneIndexes[i], columns.velocities[i], currentTrack());
+        if (id != invalidNoteID)
+            notesToPaste.append(id);
     }
 
-    delete [] copiedNotes;
+    if (notesToPaste.size() == 0)
+        return 0;
 
-    AddNotesCommand *addNotesCommand = new AddNotesCommand(notesToPaste, this);
+    AddNotesCommand *addNotesCommand = new AddNotesCommand(notesToPaste, this, true);
     addNotesCommand->setText((numItems == 1) ? tr("Paste Note") : tr("Paste Notes"));
     return addNotesCommand;
 }
 
-SimpleVector<Note*> SequencerScene::removeTrack(int index)
+void SequencerScene::rebuildItemNoteIndex()
 {
-    SimpleVector<QGraphicsItem*> allItems(items());
-    SimpleVector<Note*> itemsToRemove(allItems.size());
-    for (int i = 0; i < allItems.size(); ++i)
+    itemNoteIndex.clear();
+    longestIndexedNoteDuration = 0;
+
+    for (int track = 0; track < HexSettings::maxNumTracks; ++track)
     {
-        if (static_cast<Note*>(allItems[i])->track() == index)
-        {
-            itemsToRemove.appendByValue(static_cast<Note*>(allItems[i]));
-            removeItem(allItems[i]);
-        }
-        else if (static_cast<Note*>(allItems[i])->track() > index)
+        if (!trackIsIndexed(track))
+            continue;
+
+        for (size_t i = 0; i < notesInTrack[track].size(); ++i)
         {
-            static_cast<Note*>(allItems[i])->setTrack(static_cast<Note*>(allItems[i])->track() - 1);
+            const NoteRecord &note = noteStore[notesInTrack[track][i]];
+            IndexedNote indexedNote = {note.start, notesInTrack[track][i]};
+            itemNoteIndex.push_back(indexedNote);
+
+            if (note.duration > longestIndexedNoteDuration)
+                longestIndexedNoteDuration = note.duration;
         }
     }
 
-    return itemsToRemove;
+    std::sort(itemNoteIndex.begin(), itemNoteIndex.end(), IndexedNote::compare);
+    itemNoteIndexDirty = false;
+    itemNoteIndexEdits = 0;
+}
+
+void SequencerScene::releaseNote(NoteID id)
+{
+    if (!noteStore.contains(id))
+        return; // already released (or the project was cleared)
+
+    removeNote(id);
+    noteStore.release(id);
+}
+
+void SequencerScene::removeNote(NoteID id)
+{
+    NoteRecord &note = noteStore[id];
+
+    if (note.indexInTrack == -1)
+        return; // not in the scene
+
+    if (journal)
+        journal->noteRemoved(note);
+
+    // swap with the last note in the track so that removal is O(1)
+    std::vector<NoteID> &notes = notesInTrack[note.track];
+    NoteID lastNote = notes.back();
+    notes[note.indexInTrack] = lastNote;
+    noteStore[lastNote].indexInTrack = note.indexInTrack;
+    notes.pop_back();
+    note.indexInTrack = -1;
+    note.selected = false;
+
+    if (note.item != NULL)
+        releaseNoteItem(note);
+
+    if (trackIsIndexed(note.track))
+        unindexNote(id, note.start);
+
+    if (!trackUsesItems(note.track))
+        trackRenderers[note.track]->noteRemoved(note);
+}
+
+void SequencerScene::releaseNoteItem(NoteRecord &note)
+{
+    Note *item = note.item;
+    note.item = 0;
+
+    // the record keeps its selection, so the item is detached from it first
+    item->setId(invalidNoteID);
+    item->setSelected(false);
+    removeItem(item);
+
+    // swap with the last item so that removal is O(1)
+    Note *lastItem = noteItems.back();
+    noteItems[item->listIndex()] = lastItem;
+    lastItem->setListIndex(item->listIndex());
+    noteItems.pop_back();
+    item->setListIndex(-1);
+
+    spareNoteItems.push_back(item);
+}
+
+SimpleVector<NoteID> SequencerScene::removeTrack(int index)
+{
+    SimpleVector<NoteID> notesToRemove(notesInTrack[index].size());
+    for (size_t i = 0; i < notesInTrack[index].size(); ++i)
+    {
+        notesToRemove.append(notesInTrack[index][i]);
+    }
+
+    for (int i = 0; i < notesToRemove.size(); ++i)
+    {
+        removeNote(notesToRemove[i]); // also removes it from notesInTrack
+    }
+
+    // shift the lists of the following tracks down by one and renumber only their notes
+    for (int track = index + 1; track < HexSettings::maxNumTracks; ++track)
+    {
+        notesInTrack[track - 1].swap(notesInTrack[track]);
+
+        for (size_t i = 0; i < notesInTrack[track - 1].size(); ++i)
+            noteStore[notesInTrack[track - 1][i]].track = track - 1;
+
+        trackRenderers[track - 1]->invalidate();
+    }
+
+    trackRenderers[HexSettings::maxNumTracks - 1]->invalidate();
+    itemNoteIndexDirty = true;
+
+    if (m_currentTrack == index)
+        m_currentTrack = -1; // the next call to setCurrentTrack() makes the new current track editable
+    else if (m_currentTrack > index)
+        --m_currentTrack;
+
+    return notesToRemove;
 }
 
 void SequencerScene::restoreNotes(QDataStream &in)
 {
-    clear();
+    clearNotes();
 
     int numNotes;
     in >> numNotes;
 
-    NoteStruct note;
+    // decode everything before touching the scene, then insert it all at once
+    std::vector<NoteStruct> decodedNotes(std::max(numNotes, 0));
     for (int i = 0; i < numNotes; ++i)
+        in >> decodedNotes[i];
+
+    std::vector<NoteID> ids;
+    ids.reserve(decodedNotes.size());
+
+    for (size_t i = 0; i < decodedNotes.size(); ++i)
     {
-        in >> note;
-        addNote(note);
+        const NoteStruct &note = decodedNotes[i];
+        NoteID id = createNote(note.startPosition, note.duration, HexSettings::convertJKToNoteLaneIndex(note.j, note.k), note.velocity, note.track);
+        if (id != invalidNoteID)
+            ids.push_back(id);
     }
+
+    insertNotes(ids);
 }
 
 void SequencerScene::saveNotes(QDataStream &out) const
 {
-    SimpleVector<QGraphicsItem*> allNotes(items());
-    out << allNotes.size();
-    for (int i = 0; i < allNotes.size(); ++i)
+    SimpleVector<NoteID> notes(allNotes());
+    out << notes.size();
+    for (int i = 0; i < notes.size(); ++i)
     {
-        out << static_cast<Note*>(allNotes[i]);
+        out << noteStore[notes[i]];
     }
 }
 
 void SequencerScene::selectAll()
 {
-    SimpleVector<QGraphicsItem*> allItems(items());
+    if (m_currentTrack == -1)
+        return;
 
-    for (int i = 0; i < allItems.size(); ++i)
+    const std::vector<NoteID> &notes = notesInTrack[m_currentTrack];
+    for (size_t i = 0; i < notes.size(); ++i)
     {
-        if (m_currentTrack == static_cast<Note*>(allItems[i])->track())
-            allItems[i]->setSelected(true);
+        setNoteSelected(notes[i], true);
+    }
+}
+
+SimpleVector<NoteID> SequencerScene::selectedNotes() const
+{
+    if (m_currentTrack == -1)
+        return SimpleVector<NoteID>();
+
+    // only notes in the current track can be selected
+    const std::vector<NoteID> &notesInCurrentTrack = notesInTrack[m_currentTrack];
+    int numSelectedNotes = 0;
+
+    for (size_t i = 0; i < notesInCurrentTrack.size(); ++i)
+    {
+        if (noteStore[notesInCurrentTrack[i]].selected)
+            ++numSelectedNotes;
+    }
+
+    SimpleVector<NoteID> notes(numSelectedNotes);
+
+    for (size_t i = 0; i < notesInCurrentTrack.size(); ++i)
+    {
+        if (noteStore[notesInCurrentTrack[i]].selected)
+            notes.append(notesInCurrentTrack[i]);
+    }
+
+    std::sort(&notes[0], &notes[0] + notes.size());
+    return notes;
+}
+
+void SequencerScene::setBatchedTrackRendering(bool on)
+{
+    if (on == m_batchedTrackRendering)
+        return;
+
+    m_batchedTrackRendering = on;
+
+    for (int track = 0; track < HexSettings::maxNumTracks; ++track)
+    {
+        if (track != m_currentTrack)
+            trackRenderers[track]->invalidate();
+    }
+
+    // when turned off, the other tracks' notes get items in updateNoteItems()
+    if (on)
+    {
+        for (int i = static_cast<int>(noteItems.size()) - 1; i >= 0; --i)
+        {
+            NoteRecord &note = noteStore[noteItems[i]->id()];
+
+            if (note.track != m_currentTrack)
+                releaseNoteItem(note);
+        }
     }
+
+    itemNoteIndexDirty = true;
+    updateNoteItems();
+    update();
 }
 
 void SequencerScene::setCurrentTrack(int track)
@@ -330,27 +883,100 @@ void SequencerScene::setCurrentTrack(int track)
     if (track == m_currentTrack)
         return;
 
-    SimpleVector<QGraphicsItem*> allItems(items());
-    for (int i = 0; i < allItems.size(); ++i)
+    deselectAll(); // only notes in the current track can be selected
+
+    int oldTrack = m_currentTrack;
+    m_currentTrack = track;
+
+    if (oldTrack != -1)
+        trackRenderers[oldTrack]->invalidate();
+
+    for (int i = static_cast<int>(noteItems.size()) - 1; i >= 0; --i)
     {
-        if (static_cast<Note*>(allItems[i])->track() == m_currentTrack)
+        NoteRecord &note = noteStore[noteItems[i]->id()];
+
+        if (note.track == oldTrack)
         {
-            allItems[i]->setAcceptedMouseButtons(0);
-            allItems[i]->setAcceptHoverEvents(false);
-            allItems[i]->setFlag(QGraphicsItem::ItemIsSelectable, false);
+            if (m_batchedTrackRendering)
+                releaseNoteItem(note);
+            else
+                note.item->setEditable(false);
         }
-        else if (static_cast<Note*>(allItems[i])->track() == track)
+        else if (note.track == track)
         {
-            allItems[i]->setAcceptedMouseButtons(Qt::LeftButton);
-            allItems[i]->setAcceptHoverEvents(true);
-            allItems[i]->setFlag(QGraphicsItem::ItemIsSelectable, true);
+            note.item->setEditable(true);
         }
     }
 
-    m_currentTrack = track;
+    // the new track's notes get items in updateNoteItems()
+    itemNoteIndexDirty = true;
+    updateNoteItems();
     update();
 }
 
+void SequencerScene::setNoteDuration(NoteID id, double duration)
+{
+    NoteRecord before(noteStore[id]);
+    noteStore[id].duration = duration;
+    noteChanged(id, before);
+}
+
+void SequencerScene::setNoteLaneIndex(NoteID id, unsigned short laneIndex)
+{
+    NoteRecord before(noteStore[id]);
+    noteStore[id].laneIndex = laneIndex;
+    noteChanged(id, before);
+}
+
+void SequencerScene::setNoteSelected(NoteID id, bool selected)
+{
+    NoteRecord &note = noteStore[id];
+
+    if (selected && note.track != m_currentTrack)
+        return; // only notes in the current track can be selected
+
+    note.selected = selected;
+
+    if (note.item != NULL && note.item->isSelected() != selected)
+        note.item->setSelected(selected);
+}
+
+void SequencerScene::setNoteStart(NoteID id, double start)
+{
+    NoteRecord before(noteStore[id]);
+    noteStore[id].start = start;
+    noteChanged(id, before);
+}
+
+void SequencerScene::setNoteVelocity(NoteID id, unsigned char velocity)
+{
+    NoteRecord before(noteStore[id]);
+    noteStore[id].velocity = velocity;
+    noteChanged(id, before);
+}
+
+void SequencerScene::setVisibleTimeWindow(double left, double right, double pixelsPerTick)
+{
+    // The window reaches half a screen past either side, so scrolling a little
+    // doesn't need any new items. It only moves once the visible part leaves
+    // it, or once zooming in has left it much wider than it needs to be.
+    double width = right - left;
+    bool zoomedOut = TrackNoteRenderer::drawsSummary(pixelsPerTick);
+
+    if (zoomedOut == zoomedOutToSummary && left >= itemWindowLeft && right <= itemWindowRight && width * 4 > itemWindowRight - itemWindowLeft)
+        return;
+
+    if (zoomedOut != zoomedOutToSummary)
+    {
+        zoomedOutToSummary = zoomedOut;
+        invalidateIndexedTrackRenderers();
+    }
+
+    itemWindowLeft = left - width * .5;
+    itemWindowRight = right + width * .5;
+    updateNoteItems();
+}
+
 void SequencerScene::updateNoteBrushColors()
 {
     static const double oneOverOneTwentySeven = 1. / 127.;
@@ -376,11 +1002,121 @@ void SequencerScene::updateNoteBrushColors()
     update();
 }
 
-void SequencerScene::updateNotePositions()
+void SequencerScene::noteChanged(NoteID id, const NoteRecord &before)
+{
+    const NoteRecord &note = noteStore[id];
+
+    if (note.indexInTrack == -1)
+        return; // not in the scene
+
+    if (journal)
+        journal->noteChanged(id, before);
+
+    if (trackIsIndexed(note.track))
+    {
+        if (note.start != before.start)
+        {
+            unindexNote(id, before.start);
+            indexNote(id);
+        }
+        else if (note.duration > longestIndexedNoteDuration)
+        {
+            longestIndexedNoteDuration = note.duration;
+        }
+    }
+
+    // the renderer of a track with items isn't drawing, so it's only invalidated when that changes
+    if (!trackUsesItems(note.track))
+    {
+        trackRenderers[note.track]->noteRemoved(before);
+        trackRenderers[note.track]->noteAdded(note);
+        return;
+    }
+
+    // a note that leaves the window keeps its item until the window moves, but one that enters it needs one now
+    if (note.item != NULL)
+        updateNoteItem(note);
+    else if (noteIsInItemWindow(note))
+        acquireNoteItem(id);
+}
+
+void SequencerScene::updateNoteItem(const NoteRecord &note)
 {
-    SimpleVector<QGraphicsItem*> allNotes(items());
-    for (int i = 0; i < allNotes.size(); ++i)
+    note.item->setX(note.start);
+    note.item->setZValue(-note.laneIndex);
+    note.item->setLaneIndex(note.laneIndex);
+    note.item->setWidth(note.duration);
+    note.item->update();
+}
+
+void SequencerScene::updateNoteItems()
+{
+    if (itemNoteIndexDirty)
+        rebuildItemNoteIndex();
+
+    // a note that starts before the window can still reach into it, but not from further back than the longest note
+    std::vector<IndexedNote>::const_iterator first = std::lower_bound(itemNoteIndex.begin(), itemNoteIndex.end(),
+                                                                      itemWindowLeft - longestIndexedNoteDuration, IndexedNote::startsBefore);
+    std::vector<IndexedNote>::const_iterator last = std::upper_bound(first, itemNoteIndex.cend(), itemWindowRight, IndexedNote::startsAfter);
+
+    // with too many notes to give each one an item, the tracks other than the current one are drawn in batches too
+    bool shown = (last - first <= maxNoteItems);
+    if (shown != m_noteItemsShown)
     {
-        allNotes[i]->setY(latticeData->buttonPositions[static_cast<Note*>(allNotes[i])->getLaneIndex()].y());
+        m_noteItemsShown = shown;
+        invalidateIndexedTrackRenderers();
     }
+
+    // the item being dragged has to stay in the scene until the mouse is released
+    for (int i = static_cast<int>(noteItems.size()) - 1; i >= 0; --i)
+    {
+        NoteRecord &note = noteStore[noteItems[i]->id()];
+
+        if ((!noteIsInItemWindow(note) || !trackUsesItems(note.track)) && noteItems[i] != mouseGrabberItem())
+            releaseNoteItem(note);
+    }
+
+    if (zoomedOutToSummary)
+        return;
+
+    for (; first != last; ++first)
+    {
+        const NoteRecord &note = noteStore[first->id];
+
+        if (note.item == NULL && trackUsesItems(note.track) && noteIsInItemWindow(note))
+            acquireNoteItem(first->id);
+    }
+}
+
+void SequencerScene::unindexNote(NoteID id, double start)
+{
+    if (!countItemNoteIndexEdit())
+        return;
+
+    std::vector<IndexedNote>::iterator it = std::lower_bound(itemNoteIndex.begin(), itemNoteIndex.end(), start, IndexedNote::startsBefore);
+    while (it != itemNoteIndex.end() && it->start == start && it->id != id)
+        ++it;
+
+    if (it != itemNoteIndex.end() && it->id == id)
+        itemNoteIndex.erase(it);
+    else
+        itemNoteIndexDirty = true; // it wasn't where it should have been
+}
+
+void SequencerScene::updateLane(int laneIndex)
+{
+    double laneY = latticeData->buttonPositions[laneIndex].y();
+    update(QRectF(sceneRect().left(), laneY - halfNoteLaneWidth, sceneRect().width(), noteLaneWidth));
+}
+
+void SequencerScene::updateLanePositions()
+{
+    // the notes themselves look up their lanes' positions, but their bounds have to be re-indexed, like the renderers'
+    for (size_t i = 0; i < noteItems.size(); ++i)
+        noteItems[i]->updateLanePosition();
+
+    for (int track = 0; track < HexSettings::maxNumTracks; ++track)
+        trackRenderers[track]->updateLaneBounds();
+
+    invalidateBackgroundCache(); // also repaints the notes
 }
@@ -1,49 +1,98 @@
 #ifndef SEQUENCERSCENE_H
 #define SEQUENCERSCENE_H
 #include "abstractsequencerscene.h"
+#include "hexsettings.h"
+#include "latticedata.h"
+#include "notestore.h"
 #include <QtGui/QBrush>
 #include <QtGui/QPen>
+#include <vector>
 
 template <class QGraphicsItem>
 class SimpleVector;
 
+class EditJournal;
 class Note;
+class QByteArray;
 class QDataStream;
-struct LatticeData;
+class TrackNoteRenderer;
 struct NoteStruct;
 
 class SequencerScene : public AbstractSequencerScene
 {
 public:
+    // a track's notes as decoded from a project file chunk, one column per field
+    struct NoteColumns
+    {
+        std::vector<double> starts;
+        std::vector<double> durations;
+        std::vector<unsigned short> laneIndexes;
+        std::vector<unsigned char> velocities;
+    };
+
     SequencerScene(LatticeData *latticeData, BarLineDrawer *barLineDrawer, QUndoStack *undoStack, QWidget *view);
-    QGraphicsItem *addNote(const NoteStruct &note);
+    ~SequencerScene();
+    NoteID addNote(const NoteStruct &note);
+    SimpleVector<NoteID> allNotes() const; // every note in the scene
+    void clearNotes();
+    void deselectAll();
     int findClosestNoteLane(double yPos) const;
+    void insertNoteColumns(int track, const NoteColumns &columns);
+    NoteSnapshot noteSnapshot(int track) const {NoteSnapshot snapshot = {noteStore, notesInTrack[track]}; return snapshot;}
     void restoreNotes(QDataStream &in);
     void saveNotes(QDataStream &out) const;
     void selectAll();
+    SimpleVector<NoteID> selectedNotes() const; // in ascending order
+    void setBatchedTrackRendering(bool on); // on: other tracks are drawn by their TrackNoteRenderers; off: every note gets an item, as it used to
     void setCurrentTrack(int track);
-    void updateNotePositions();
+    void setVisibleTimeWindow(double left, double right, double pixelsPerTick); // call whenever the view scrolls or zooms horizontally
+    void updateLane(int laneIndex); // repaints just that lane, e.g., when its button is pressed
+    void updateLanePositions(); // call whenever the lattice moves the note lanes
+
+    void insertTrack(int index, const SimpleVector<NoteID> &notesInTrack);
+    SimpleVector<NoteID> removeTrack(int index);
+
+    // Notes that aren't in the scene (e.g., deleted notes that can still be
+    // restored by undoing) keep their IDs until they are released.
+    NoteID createNote(double start, double duration, unsigned short laneIndex, unsigned char velocity, int track);
+    void insertNote(NoteID id);
+    void insertNotes(const std::vector<NoteID> &ids); // much faster than inserting a lot of notes one at a time
+    void releaseNote(NoteID id);
+    void removeNote(NoteID id);
 
-    void insertTrack(int index, const SimpleVector<Note*> &itemsInTrack);
-    SimpleVector<Note*> removeTrack(int index);
+    void setNoteDuration(NoteID id, double duration);
+    void setNoteLaneIndex(NoteID id, unsigned short laneIndex);
+    void setNoteSelected(NoteID id, bool selected);
+    void setNoteStart(NoteID id, double start);
+    void setNoteVelocity(NoteID id, unsigned char velocity);
 
     // inline methods
+    bool batchedTrackRendering() const {return m_batchedTrackRendering;}
+    bool trackUsesItems(int track) const {return !zoomedOutToSummary && trackIsIndexed(track) && (m_noteItemsShown || track == m_currentTrack);} // otherwise its TrackNoteRenderer draws it
     int currentTrack() const {return m_currentTrack;}
+    const NoteRecord &note(NoteID id) const {return noteStore[id];}
+    const NoteStore &notes() const {return noteStore;}
+    const std::vector<NoteID> &trackNotes(int track) const {return notesInTrack[track];}
     unsigned char getDefaultVelocity() const {return defaultVelocity;}
     const QBrush &getActiveNoteBrush(int velocity) const {return activeNoteBrushes[velocity];}
     const QBrush &getInactiveNoteBrush(int velocity) const {return inactiveNoteBrushes[velocity];}
     const QPen& getSelectedNotePen() const {return selectedNotePen;}
     const QPen& getUnselectedNotePen() const {return unselectedNotePen;}
-    void setDarkLaneColor(const QColor &color) {darkLaneBrush.setColor(color);}
+    void setDarkLaneColor(const QColor &color) {darkLaneBrush.setColor(color); invalidateBackgroundCache();}
     void setDefaultVelocity(unsigned char vel) {defaultVelocity = vel;}
+    void setJournal(EditJournal *editJournal) {journal = editJournal;} // every change to the notes in the scene is reported to it
     void setInactiveNoteBrushOpacity(int opacity = 255) {inactiveNoteBrushOpacity = opacity; updateNoteBrushColors();}
-    void setLightLaneColor(const QColor &color) {lightLaneBrush.setColor(color);}
+    void setLightLaneColor(const QColor &color) {lightLaneBrush.setColor(color); invalidateBackgroundCache();}
     void setMaxVelocityColor(const QColor &color) {activeNoteBrushes[127] = color; updateNoteBrushColors();}
     void setMinVelocityColor(const QColor &color) {activeNoteBrushes[0] = color; updateNoteBrushColors();}
     void setPressedLaneColor(const QColor &color) {pressedLaneBrush.setColor(color);}
     void setSelectedNoteColor(const QColor &color) {selectedNotePen.setColor(color);}
     void setUnselectedNoteColor(const QColor &color) {unselectedNotePen.setColor(color);}
 
+    // project file chunks; these are safe to call from any thread
+    static bool decodeNoteChunk(const QByteArray &chunk, NoteColumns &columns);
+    static QByteArray noteChunk(const NoteSnapshot &notes);
+
 
 protected:
     void drawBackground(QPainter *painter, const QRectF &rect);
@@ -57,13 +106,36 @@ private:
     QString mimeType() const {return "hex/notes";}
     QUndoCommand *pasteCommand(QDataStream &stream, int numItems);
 
-    void drawLineSet(QPainter *painter, const QRectF &rect, const SimpleVector<unsigned int> &indices);
+    void drawLineSet(QPainter *painter, const QRectF &rect, const ButtonSet &buttons);
+    void drawStaticBackground(QPainter *painter, const QRectF &rect); // the lanes (other than pressed ones) and bar lines
+    int findFirstLaneBelow(double yPos) const; // index into latticeData->lanesSortedByY
     int findTopmostNoteLane(double yPos) const;
     void updateNoteBrushColors();
 
+    // With batched rendering, only the notes in the current track use items
+    // (so that they can be edited); the other tracks are drawn by their
+    // TrackNoteRenderer. Even then, only the notes within the item window
+    // have an item, which is taken from a pool of unused ones. If there are
+    // too many notes in the window, only the current track keeps its items,
+    // so that it can still be edited, and if the view is zoomed out so far
+    // that notes are narrower than a pixel, no track uses items (and no notes
+    // can be drawn in) until it's zoomed back in.
+    void acquireNoteItem(NoteID id);
+    bool countItemNoteIndexEdit(); // returns false once rebuilding the index would be cheaper
+    void indexNote(NoteID id);
+    void invalidateIndexedTrackRenderers(); // for when the indexed tracks switch between items and their renderers
+    bool noteIsInItemWindow(const NoteRecord &note) const {return note.start <= itemWindowRight && note.start + note.duration >= itemWindowLeft;}
+    void noteChanged(NoteID id, const NoteRecord &before);
+    void rebuildItemNoteIndex();
+    void releaseNoteItem(NoteRecord &note);
+    bool trackIsIndexed(int track) const {return !m_batchedTrackRendering || track == m_currentTrack;} // the tracks that use items when they're shown
+    void unindexNote(NoteID id, double start);
+    void updateNoteItem(const NoteRecord &note);
+    void updateNoteItems(); // gives items to the notes in the item window and takes them from the rest
+
     // these are initialized in the initializer list
     LatticeData *latticeData;
-    Note *noteBeingCreated;
+    NoteID noteBeingCreated;
 //    bool isCreatingANote;
     unsigned char defaultVelocity;
     QBrush darkLaneBrush;
@@ -71,11 +143,38 @@ private:
     QBrush pressedLaneBrush;
     int inactiveNoteBrushOpacity;
     int m_currentTrack;
+    bool m_batchedTrackRendering;
+    double itemWindowLeft;  // the visible part of the scene, plus a margin on either side
+    double itemWindowRight;
+    bool zoomedOutToSummary; // the renderers draw summaries rather than notes at this zoom
+    double longestIndexedNoteDuration;
+    bool itemNoteIndexDirty;
+    int itemNoteIndexEdits; // since it was last rebuilt
+    bool m_noteItemsShown;
+    EditJournal *journal;
 
     QBrush activeNoteBrushes[128];
     QBrush inactiveNoteBrushes[128];
     QPen unselectedNotePen;
     QPen selectedNotePen;
+
+    NoteStore noteStore;
+    std::vector<NoteID> notesInTrack[HexSettings::maxNumTracks]; // only the notes that are in the scene
+    TrackNoteRenderer *trackRenderers[HexSettings::maxNumTracks];
+
+    struct IndexedNote
+    {
+        static bool compare(const IndexedNote &a, const IndexedNote &b) {return a.start < b.start;}
+        static bool startsBefore(const IndexedNote &note, double pos) {return note.start < pos;}
+        static bool startsAfter(double pos, const IndexedNote &note) {return pos < note.start;}
+
+        double start;
+        NoteID id;
+    };
+
+    std::vector<IndexedNote> itemNoteIndex; // the notes in the indexed tracks, sorted by start
+    std::vector<Note*> noteItems;           // the items in the scene
+    std::vector<Note*> spareNoteItems;      // items taken out of the scene, ready to be reused
 };
 
 #endif
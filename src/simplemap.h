@@ -1,53 +1,93 @@
 #ifndef SIMPLEMAP_H
 #define SIMPLEMAP_H
+#include <algorithm>
+#include <atomic>
 
+// Copies share their arrays until one of them changes, so that a map can be
+// copied for another thread (e.g., to be saved) without copying its nodes.
+// Only the reference count is thread-safe; a map itself is not.
 template <class Key, class Value>
 class SimpleMap
 {
 private:
     Key *keyArray;
     Value *valueArray;
+    std::atomic<int> *refCount; // shared by the maps using the arrays (0 if there are none)
     int size;
+    unsigned int revisionNumber; // changes whenever the map does
+
+    void adopt(Key *keys, Value *values, int count)
+    {
+        keyArray = keys;
+        valueArray = values;
+        refCount = (keys != 0 || values != 0) ? new std::atomic<int>(1) : 0;
+        size = count;
+    }
+
+    // called before changing the arrays in place
+    void detach()
+    {
+        if (refCount == 0 || *refCount == 1)
+            return;
+
+        Key *keys = new Key[size];
+        Value *values = new Value[size];
+        std::copy(keyArray, keyArray + size, keys);
+        std::copy(valueArray, valueArray + size, values);
+
+        int count = size;
+        release();
+        adopt(keys, values, count);
+    }
+
+    void release()
+    {
+        if (refCount != 0 && --*refCount == 0)
+        {
+            delete [] keyArray;
+            delete [] valueArray;
+            delete refCount;
+        }
+
+        keyArray = 0;
+        valueArray = 0;
+        refCount = 0;
+        size = 0;
+    }
+
+    void share(const SimpleMap<Key, Value> &other)
+    {
+        keyArray = other.keyArray;
+        valueArray = other.valueArray;
+        refCount = other.refCount;
+        size = other.size;
+
+        if (refCount != 0)
+            ++*refCount;
+    }
 
 public:
     // constructs empty map
-    SimpleMap() : keyArray(0), valueArray(0), size(0)
+    SimpleMap() : keyArray(0), valueArray(0), refCount(0), size(0), revisionNumber(0)
     {
     }
 
     // constructs map and takes ownership of the arrays, which must be sorted beforehand
     SimpleMap(Key *keys, Value *values, int count)
-        : keyArray(keys), valueArray(values), size(count)
+        : revisionNumber(0)
     {
+        adopt(keys, values, count);
     }
 
     SimpleMap(const SimpleMap<Key, Value> &other)
-        : size(other.size)
+        : revisionNumber(0)
     {
-        if (size == 0)
-        {
-            keyArray = 0;
-            valueArray = 0;
-            return;
-        }
-
-        keyArray = new Key[size];
-        valueArray = new Value[size];
-
-        for (int i = 0; i < size; ++i)
-        {
-            keyArray[i] = other.keyArray[i];
-            valueArray[i] = other.valueArray[i];
-        }
+        share(other);
     }
 
     ~SimpleMap()
     {
-        delete [] keyArray;
-        delete [] valueArray;
-
-        keyArray = 0;
-        valueArray = 0;
+        release();
     }
 
     // #######################################################################
@@ -55,19 +95,7 @@ public:
 
     bool contains(Key key) const
     {
-        if (size == 0)
-            return false;
-
-        if (key < keyArray[0] || key > keyArray[size - 1])
-            return false;
-
-        for (int i = 0; i < size; ++i)
-        {
-            if (keyArray[i] == key)
-                return true;
-        }
-
-        return false;
+        return find(key) != -1;
     }
 
     int count() const
@@ -77,13 +105,13 @@ public:
 
     int find(Key key) const
     {
-        for (int i = 0; i < size; ++i)
-        {
-            if (keyArray[i] == key)
-                return i;
-        }
+        // the keys are sorted
+        const Key *position = std::lower_bound(keyArray, keyArray + size, key);
+
+        if (position == keyArray + size || *position != key)
+            return -1; // if key not found
 
-        return -1; // if key not found
+        return position - keyArray;
     }
 
     const Key *getKeyArray() const
@@ -98,6 +126,10 @@ public:
     const Value valueAt(int index) const
     { return valueArray[index]; }
 
+    // for caching things computed from the map; compare along with the map's address
+    unsigned int revision() const
+    { return revisionNumber; }
+
     // #######################################################################
     // ############################################# INSERT AND REMOVE METHODS
 
@@ -135,12 +167,42 @@ public:
         }
         // ===================================================================
 
-        delete [] keyArray;
-        delete [] valueArray;
+        release();
+        adopt(keyArrayCopier, valueArrayCopier, newSize);
+        ++revisionNumber;
+    }
 
-        size = newSize;
-        keyArray = keyArrayCopier;
-        valueArray = valueArrayCopier;
+    // inserts them all in one pass; the keys must be sorted
+    void insertMany(const Key *keys, const Value *values, int count)
+    {
+        if (count == 0)
+            return;
+
+        int newSize = size + count;
+        Key *newKeyArray = new Key[newSize];
+        Value *newValueArray = new Value[newSize];
+
+        // merge, with existing keys going first when they're equal (like insert() does)
+        int i = 0, j = 0;
+        for (int n = 0; n < newSize; ++n)
+        {
+            if (j == count || (i < size && !(keys[j] < keyArray[i])))
+            {
+                newKeyArray[n] = keyArray[i];
+                newValueArray[n] = valueArray[i];
+                ++i;
+            }
+            else
+            {
+                newKeyArray[n] = keys[j];
+                newValueArray[n] = values[j];
+                ++j;
+            }
+        }
+
+        release();
+        adopt(newKeyArray, newValueArray, newSize);
+        ++revisionNumber;
     }
 
     void remove(Key key)
@@ -150,16 +212,13 @@ public:
         if (indexOfKeyToBeRemoved == -1) // key not found
             return;
 
+        ++revisionNumber;
+
         int newSize = size - 1;
 
         if (newSize == 0)
         {
-            delete [] keyArray;
-            delete [] valueArray;
-
-            size = 0;
-            keyArray = 0;
-            valueArray = 0;
+            release();
             return;
         }
 
@@ -179,68 +238,89 @@ public:
             newValueArray[i] = valueArray[iPlusOne];
         }
 
-        delete [] keyArray;
-        delete [] valueArray;
+        release();
+        adopt(newKeyArray, newValueArray, newSize);
+    }
+
+    // removes them all in one pass; the keys must be sorted
+    void removeMany(const Key *keys, int count)
+    {
+        if (count == 0)
+            return;
+
+        detach();
+
+        int numKept = 0, j = 0;
+        for (int i = 0; i < size; ++i)
+        {
+            while (j < count && keys[j] < keyArray[i])
+                ++j;
+
+            if (j < count && keys[j] == keyArray[i])
+            {
+                ++j;
+                continue;
+            }
+
+            keyArray[numKept] = keyArray[i];
+            valueArray[numKept] = valueArray[i];
+            ++numKept;
+        }
+
+        if (numKept == size)
+            return;
+
+        size = numKept;
+        ++revisionNumber;
 
-        size = newSize;
-        keyArray = newKeyArray;
-        valueArray = newValueArray;
+        if (size == 0)
+            release();
     }
 
     // #######################################################################
     // ####################################################### REPLACE METHODS
 
     void replaceKey(Key oldKey, Key newKey)
-    { keyArray[find(oldKey)] = newKey; }
+    { int i = find(oldKey); detach(); keyArray[i] = newKey; ++revisionNumber; }
 
     void replaceKeyAt(int index, Key key)
-    { keyArray[index] = key; }
+    { detach(); keyArray[index] = key; ++revisionNumber; }
 
     void replaceKeyAndValue(Key oldKey, Key newKey, Value newValue)
     {
         int i = find(oldKey);
+        detach();
         keyArray[i] = newKey;
         valueArray[i] = newValue;
+        ++revisionNumber;
     }
 
     void replaceKeyAndValueAt(int index, Key newKey, Value newValue)
     {
+        detach();
         keyArray[index] = newKey;
         valueArray[index] = newValue;
+        ++revisionNumber;
     }
 
     void replaceValue(Key key, Value value)
-    { valueArray[find(key)] = value; }
+    { int i = find(key); detach(); valueArray[i] = value; ++revisionNumber; }
 
     void replaceValueAt(int index, Value value)
-    { valueArray[index] = value; }
+    { detach(); valueArray[index] = value; ++revisionNumber; }
 
     // #######################################################################
     // ################################################### ASSIGNMENT OPERATOR
 
     SimpleMap<Key, Value>& operator =(const SimpleMap<Key, Value> &other)
     {
-        delete [] keyArray;
-        delete [] valueArray;
-
-        size = other.size;
-
-        if (size == 0)
-        {
-            keyArray = 0;
-            valueArray = 0;
-            return *this;
-        }
-
-        keyArray = new Key[size];
-        valueArray = new Value[size];
-
-        for (int i = 0; i < size; ++i)
+        if (other.keyArray != keyArray || other.refCount != refCount)
         {
-            keyArray[i] = other.keyArray[i];
-            valueArray[i] = other.valueArray[i];
+            release();
+            share(other);
         }
 
+        ++revisionNumber;
         return *this;
     }
 };
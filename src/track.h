@@ -1,11 +1,11 @@
 #ifndef TRACK_H
 #define TRACK_H
 #include "envelopedata.h"
+#include "notestore.h"
 #include "simplevector.h"
 #include <QtCore/QString>
 
 class MIDIOutput;
-class Note;
 class QActionGroup;
 class QMenu;
 
@@ -17,7 +17,7 @@ struct Track
     MIDIOutput *outputPort;
     QMenu *menu; // the title of the menu is the name of the track (it's easier if the track has a pointer to the menu that to the list widget item)
     QActionGroup *trackTypeActionGroup;
-    SimpleVector<Note*> notes;
+    SimpleVector<NoteID> notes; // only used while the track is removed or being moved
     SimpleVector<EnvelopeData> envelopeDataVector;
 };
 
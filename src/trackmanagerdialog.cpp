@@ -1,13 +1,17 @@
 #include "trackmanagerdialog.h"
+#include "editjournal.h"
 #include "envelopecommands.h"
 #include "envelopegenerator.h"
 #include "envelopescene.h"
 #include "lineeditdelegate.h"
 #include "midiportmanager.h"
 #include "notesequencegenerator.h"
+#include "projectfile.h"
 #include "sequencereventcombiner.h"
+#include "sequencereventsource.h"
 #include "sequencerscene.h"
 #include "trackcommands.h"
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QDialogButtonBox>
 #include <QtWidgets/QFormLayout>
@@ -46,6 +50,61 @@ QDataStream &operator<<(QDataStream &out, const SimpleMap<unsigned int, float> &
     return out;
 }
 
+// ===================================================== PROJECT FILE COLUMNS
+// Version 2 files store an envelope's node positions and values as separate
+// columns, with each position stored as the distance from the one before.
+static bool readEnvelopeColumns(QDataStream &in, SimpleMap<unsigned int, float> &envelope)
+{
+    quint32 numNodes;
+    in >> numNodes;
+
+    if (in.status() != QDataStream::Ok || numNodes > static_cast<quint32>(in.device()->bytesAvailable() / 8))
+    {
+        envelope = SimpleMap<unsigned int, float>();
+        return false;
+    }
+
+    unsigned int *positions = new unsigned int[numNodes];
+    float *values = new float[numNodes];
+
+    unsigned int position = 0;
+    for (quint32 i = 0; i < numNodes; ++i)
+    {
+        quint32 distance;
+        in >> distance;
+        position += distance;
+        positions[i] = position;
+    }
+
+    for (quint32 i = 0; i < numNodes; ++i)
+        in >> values[i];
+
+    envelope = SimpleMap<unsigned int, float>(positions, values, numNodes);
+
+    if (in.status() != QDataStream::Ok)
+    {
+        envelope = SimpleMap<unsigned int, float>();
+        return false;
+    }
+
+    return true;
+}
+
+static void writeEnvelopeColumns(QDataStream &out, const SimpleMap<unsigned int, float> &envelope)
+{
+    out << quint32(envelope.count());
+
+    unsigned int previousPosition = 0;
+    for (int i = 0; i < envelope.count(); ++i)
+    {
+        out << quint32(envelope.keyAt(i) - previousPosition);
+        previousPosition = envelope.keyAt(i);
+    }
+
+    for (int i = 0; i < envelope.count(); ++i)
+        out << envelope.valueAt(i);
+}
+
 // ===========================================================================
 
 TrackManagerDialog::TrackManagerDialog(MIDIPortManager *portManager, SequencerScene *sequencerScene, EnvelopeScene *envelopeScene, QWidget *parent)
@@ -53,7 +112,8 @@ TrackManagerDialog::TrackManagerDialog(MIDIPortManager *portManager, SequencerSc
       m_numTotalTracks(0),
       m_portManager(portManager),
       m_sequencerScene(sequencerScene),
-      m_envelopeScene(envelopeScene)
+      m_envelopeScene(envelopeScene),
+      m_journal(0)
 {
     setWindowTitle(tr("Track and Envelope Setup"));
 
@@ -132,6 +192,9 @@ void TrackManagerDialog::addMIDICCEnvelope(int track, int index, const EnvelopeD
 {
     m_currentTracks[track]->envelopeDataVector.insertSafely(index, envelopeData);
     setCurrentTrack(track);
+
+    if (m_journal)
+        m_journal->requestCompaction();
 }
 
 void TrackManagerDialog::addNewTrack()
@@ -144,6 +207,9 @@ void TrackManagerDialog::addNewTrack()
     m_trackListWidget->addItem(item);
     ++m_numTotalTracks;
     setCurrentTrack(m_currentTracks.size() - 1);
+
+    if (m_journal)
+        m_journal->requestCompaction();
 }
 
 void TrackManagerDialog::addNode(int track, int envelope, unsigned int pos, float value)
@@ -153,6 +219,22 @@ void TrackManagerDialog::addNode(int track, int envelope, unsigned int pos, floa
     else
         m_currentTracks[track]->envelopeDataVector[envelope].envelope.insert(pos, value);
 
+    if (m_journal)
+        m_journal->nodeAdded(track, envelope, pos, value);
+
+    m_envelopeScene->update();
+}
+
+void TrackManagerDialog::addNodes(int track, int envelope, const unsigned int *positions, const float *values, int count)
+{
+    if (track == -1)
+        m_globalEnvelopes[envelope].insertMany(positions, values, count);
+    else
+        m_currentTracks[track]->envelopeDataVector[envelope].envelope.insertMany(positions, values, count);
+
+    for (int i = 0; m_journal && i < count; ++i)
+        m_journal->nodeAdded(track, envelope, positions[i], values[i]);
+
     m_envelopeScene->update();
 }
 
@@ -161,6 +243,9 @@ void TrackManagerDialog::changeMIDICCEnvelopeData(int track, int index, unsigned
     m_currentTracks[track]->envelopeDataVector[index].MIDIChannel = newChannel;
     m_currentTracks[track]->envelopeDataVector[index].MIDICCNumber = newMIDICCNumber;
     setCurrentTrack(track);
+
+    if (m_journal)
+        m_journal->requestCompaction();
 }
 
 void TrackManagerDialog::clear()
@@ -170,7 +255,7 @@ void TrackManagerDialog::clear()
         m_allTracks[i].id = i;
         m_allTracks[i].trackTypeActionGroup = 0;
         m_allTracks[i].outputPort = NULL;
-        m_allTracks[i].notes = SimpleVector<Note*>();
+        m_allTracks[i].notes = SimpleVector<NoteID>();
         m_allTracks[i].envelopeDataVector = SimpleVector<EnvelopeData>();
         delete m_allTracks[i].menu;
         m_allTracks[i].menu = NULL;
@@ -182,7 +267,7 @@ void TrackManagerDialog::clear()
     m_portManager->clearOutputs();
     m_trackListWidget->clear();
     m_MIDICCListWidget->clear();
-    m_sequencerScene->clear();
+    m_sequencerScene->clearNotes();
 }
 
 int TrackManagerDialog::currentTrack() const
@@ -266,7 +351,7 @@ SimpleVector<SequencerEvent> TrackManagerDialog::gatherSequencerEvents(double mi
 {
     SequencerEventArrayCombiner combiner;
 
-    NoteSequenceGenerator noteSequenceGenerator(m_sequencerScene->items());
+    NoteSequenceGenerator noteSequenceGenerator(m_sequencerScene->notes(), m_sequencerScene->allNotes());
     combiner.addSortedArray(noteSequenceGenerator.eventArray(), noteSequenceGenerator.numEvents());
 
     FloatEnvelopeGenerator betaEnvelopeGenerator(&m_globalEnvelopes[0], millisecondsPerTick, SequencerEvent::Generator);
@@ -332,20 +417,34 @@ EnvelopeData TrackManagerDialog::getMIDICCEnvelope(int track, int index) const
     return m_currentTracks[track]->envelopeDataVector[index];
 }
 
+SequencerEventSource *TrackManagerDialog::globalEventSource(double millisecondsPerTick) const
+{
+    SequencerEventMerger *merger = new SequencerEventMerger;
+    merger->addSource(new EnvelopeEventSource(&m_globalEnvelopes[0], millisecondsPerTick, SequencerEvent::Generator));
+    merger->addSource(new EnvelopeEventSource(&m_globalEnvelopes[1], millisecondsPerTick, 56, 1, 0, SequencerEvent::Harmonicity));
+    merger->addSource(new EnvelopeEventSource(&m_globalEnvelopes[2], millisecondsPerTick, 57, 1, 0, SequencerEvent::JI));
+    return merger;
+}
+
 void TrackManagerDialog::moveMIDICCEnvelope(int track, int oldIndex, int newIndex)
 {
     EnvelopeData data = m_currentTracks[track]->envelopeDataVector[oldIndex];
     m_currentTracks[track]->envelopeDataVector.removeIndex(oldIndex);
     m_currentTracks[track]->envelopeDataVector.insertSafely(newIndex, data);
     refreshMIDICCEnvelopes();
+
+    if (m_journal)
+        m_journal->requestCompaction();
 }
 
 void TrackManagerDialog::moveNode(int track, int envelope, int nodeIndex, unsigned int newPos, float newValue)
 {
-    if (track == -1)
-        m_globalEnvelopes[envelope].replaceKeyAndValueAt(nodeIndex, newPos, newValue);
-    else
-        m_currentTracks[track]->envelopeDataVector[envelope].envelope.replaceKeyAndValueAt(nodeIndex, newPos, newValue);
+    SimpleMap<unsigned int, float> &map = (track == -1) ? m_globalEnvelopes[envelope] : m_currentTracks[track]->envelopeDataVector[envelope].envelope;
+
+    if (m_journal)
+        m_journal->nodeMoved(track, envelope, map.keyAt(nodeIndex), newPos, newValue);
+
+    map.replaceKeyAndValueAt(nodeIndex, newPos, newValue);
     m_envelopeScene->update();
 }
 
@@ -365,6 +464,9 @@ void TrackManagerDialog::moveTrack(int oldIndex, int newIndex, bool moveListWidg
     m_sequencerScene->insertTrack(newIndex, m_currentTracks[newIndex]->notes); // insert the notes into the sequencer
 
     setCurrentTrack(newIndex);
+
+    if (m_journal)
+        m_journal->requestCompaction();
 }
 
 void TrackManagerDialog::onActionAddNewEnvelope()
@@ -450,6 +552,9 @@ void TrackManagerDialog::removeMIDICCEnvelope(int track, int index)
 
     if (track == currentTrack())
         refreshMIDICCEnvelopes();
+
+    if (m_journal)
+        m_journal->requestCompaction();
 }
 
 void TrackManagerDialog::removeNode(int track, int envelope, unsigned int pos)
@@ -458,6 +563,20 @@ void TrackManagerDialog::removeNode(int track, int envelope, unsigned int pos)
         m_globalEnvelopes[envelope].remove(pos);
     else
         m_currentTracks[track]->envelopeDataVector[envelope].envelope.remove(pos);
+
+    if (m_journal)
+        m_journal->nodeRemoved(track, envelope, pos);
+}
+
+void TrackManagerDialog::removeNodes(int track, int envelope, const unsigned int *positions, int count)
+{
+    if (track == -1)
+        m_globalEnvelopes[envelope].removeMany(positions, count);
+    else
+        m_currentTracks[track]->envelopeDataVector[envelope].envelope.removeMany(positions, count);
+
+    for (int i = 0; m_journal && i < count; ++i)
+        m_journal->nodeRemoved(track, envelope, positions[i]);
 }
 
 int TrackManagerDialog::removeTrack(int track)
@@ -468,9 +587,128 @@ int TrackManagerDialog::removeTrack(int track)
     m_menu->removeAction(m_allTracks[trackID].menu->menuAction());
     m_allTracks[trackID].notes = m_sequencerScene->removeTrack(track); // remove and save the notes
     delete m_trackListWidget->takeItem(track);
+
+    if (m_journal)
+        m_journal->requestCompaction();
+
     return trackID;
 }
 
+bool TrackManagerDialog::restoreChunks(const ProjectFileReader &file)
+{
+    // tracks are numbered from zero with no gaps
+    int numTracks = 0;
+    while (numTracks < maxNumTracks && file.hasChunk(ProjectFile::TrackChunk, numTracks))
+        ++numTracks;
+
+    if (numTracks == 0)
+        return false;
+
+    // the note chunks are most of the file, so they're decompressed and
+    // decoded on other threads while the rest is read here
+    std::vector<SequencerScene::NoteColumns> trackNotes(numTracks);
+    std::vector<QFuture<bool> > decodedTrackNotes;
+    for (int i = 0; i < numTracks; ++i)
+    {
+        SequencerScene::NoteColumns *columns = &trackNotes[i];
+        decodedTrackNotes.push_back(QtConcurrent::run([&file, columns, i]() {
+            return SequencerScene::decodeNoteChunk(file.chunk(ProjectFile::TrackNotesChunk, i), *columns);
+        }));
+    }
+
+    // Everything is read and checked before anything is changed, so that a
+    // damaged file leaves the project that was open as it was. Any chunk that
+    // doesn't read cleanly fails the whole file, rather than loading as empty
+    // and being saved over.
+    bool intact = true;
+
+    QByteArray globalChunk(file.chunk(ProjectFile::GlobalEnvelopesChunk));
+    QDataStream globalIn(globalChunk);
+    globalIn.setVersion(13);
+
+    qint32 numSavedGlobalEnvelopes;
+    globalIn >> numSavedGlobalEnvelopes;
+    intact = intact && globalIn.status() == QDataStream::Ok && numSavedGlobalEnvelopes >= 0;
+
+    SimpleMap<unsigned int, float> globalEnvelopes[numGlobalEnvelopes];
+    for (int i = 0; intact && i < numSavedGlobalEnvelopes && i < numGlobalEnvelopes; ++i)
+        intact = readEnvelopeColumns(globalIn, globalEnvelopes[i]);
+
+    struct RestoredTrack
+    {
+        QString name;
+        qint32 outputPort;
+        qint32 trackType;
+        SimpleVector<EnvelopeData> envelopes;
+    };
+
+    std::vector<RestoredTrack> tracks(numTracks);
+    for (int i = 0; intact && i < numTracks; ++i)
+    {
+        RestoredTrack &track = tracks[i];
+
+        QByteArray trackChunk(file.chunk(ProjectFile::TrackChunk, i));
+        QDataStream trackIn(trackChunk);
+        trackIn.setVersion(13);
+
+        trackIn >> track.name >> track.outputPort >> track.trackType;
+        if (trackIn.status() != QDataStream::Ok)
+        {
+            intact = false;
+            break;
+        }
+
+        QByteArray envelopesChunk(file.chunk(ProjectFile::TrackEnvelopesChunk, i));
+        QDataStream envelopesIn(envelopesChunk);
+        envelopesIn.setVersion(13);
+
+        qint32 numMIDICCEnvelopes;
+        envelopesIn >> numMIDICCEnvelopes;
+        if (envelopesIn.status() != QDataStream::Ok || numMIDICCEnvelopes < 0 || numMIDICCEnvelopes > envelopesChunk.size())
+        {
+            intact = false;
+            break;
+        }
+
+        track.envelopes = SimpleVector<EnvelopeData>(numMIDICCEnvelopes);
+        for (int j = 0; intact && j < numMIDICCEnvelopes; ++j)
+        {
+            EnvelopeData data;
+            envelopesIn >> data.MIDIChannel >> data.MIDICCNumber;
+            intact = readEnvelopeColumns(envelopesIn, data.envelope);
+            track.envelopes.append(data);
+        }
+    }
+
+    // the decoding threads use the file and the columns, so they're all waited for, whatever happened here
+    for (int i = 0; i < numTracks; ++i)
+    {
+        if (!decodedTrackNotes[i].result())
+            intact = false;
+    }
+
+    if (!intact)
+        return false;
+
+    clear();
+
+    for (int i = 0; i < numGlobalEnvelopes; ++i)
+        m_globalEnvelopes[i] = globalEnvelopes[i];
+
+    m_numTotalTracks = numTracks;
+    m_currentTracks = SimpleVector<Track*>(numTracks);
+
+    for (int i = 0; i < numTracks; ++i)
+    {
+        setUpRestoredTrack(i, tracks[i].name, tracks[i].outputPort, tracks[i].trackType);
+        m_allTracks[i].envelopeDataVector = tracks[i].envelopes;
+        m_sequencerScene->insertNoteColumns(i, trackNotes[i]);
+    }
+
+    setCurrentTrack(0);
+    return true;
+}
+
 void TrackManagerDialog::restoreData(QDataStream &stream)
 {
     clear();
@@ -498,8 +736,7 @@ void TrackManagerDialog::restoreData(QDataStream &stream)
 
         stream >> name >> outputPort >> trackType >> trackIsActive >> numMIDICCEnvelopes;
 
-        m_allTracks[i].outputPort = m_portManager->createOutput(outputPort);
-        setUpTrackSubMenu(m_allTracks[i], name, trackType);
+        setUpRestoredTrack(i, name, outputPort, trackType);
 
         m_allTracks[i].envelopeDataVector = SimpleVector<EnvelopeData>(numMIDICCEnvelopes);
         for (int j = 0 ; j < numMIDICCEnvelopes; ++j)
@@ -510,11 +747,6 @@ void TrackManagerDialog::restoreData(QDataStream &stream)
                    >> m_allTracks[i].envelopeDataVector[j].envelope
                    >> envelopeIsActive; // currently unused
         }
-        m_currentTracks.append(&m_allTracks[i]);
-
-        QListWidgetItem *item = new QListWidgetItem(m_allTracks[i].menu->title());
-        item->setFlags (item->flags() | Qt::ItemIsEditable);
-        m_trackListWidget->addItem(item);
     }
 
     m_sequencerScene->restoreNotes(stream);
@@ -534,6 +766,49 @@ void TrackManagerDialog::restoreTrack(int trackID, int trackIndex)
     item->setFlags (item->flags() | Qt::ItemIsEditable);
     m_trackListWidget->insertItem(trackIndex, item);
     setCurrentTrack(trackIndex);
+
+    if (m_journal)
+        m_journal->requestCompaction();
+}
+
+void TrackManagerDialog::saveChunks(const Snapshot &snapshot, ProjectFileWriter &file)
+{
+    QByteArray globalChunk;
+    QDataStream globalOut(&globalChunk, QIODevice::WriteOnly);
+    globalOut.setVersion(13);
+
+    globalOut << qint32(snapshot.globalEnvelopes.size());
+    for (size_t i = 0; i < snapshot.globalEnvelopes.size(); ++i)
+        writeEnvelopeColumns(globalOut, snapshot.globalEnvelopes[i]);
+
+    file.addChunk(ProjectFile::GlobalEnvelopesChunk, 0, globalChunk);
+
+    for (size_t i = 0; i < snapshot.tracks.size(); ++i)
+    {
+        const Snapshot::TrackSnapshot &track = snapshot.tracks[i];
+
+        QByteArray trackChunk;
+        QDataStream trackOut(&trackChunk, QIODevice::WriteOnly);
+        trackOut.setVersion(13);
+
+        trackOut << track.name << qint32(track.outputPort) << qint32(track.trackType);
+
+        file.addChunk(ProjectFile::TrackChunk, i, trackChunk, false); // too small to be worth compressing
+
+        QByteArray envelopesChunk;
+        QDataStream envelopesOut(&envelopesChunk, QIODevice::WriteOnly);
+        envelopesOut.setVersion(13);
+
+        envelopesOut << qint32(track.envelopes.size());
+        for (int j = 0; j < track.envelopes.size(); ++j)
+        {
+            envelopesOut << track.envelopes[j].MIDIChannel << track.envelopes[j].MIDICCNumber;
+            writeEnvelopeColumns(envelopesOut, track.envelopes[j].envelope);
+        }
+
+        file.addChunk(ProjectFile::TrackEnvelopesChunk, i, envelopesChunk);
+        file.addChunk(ProjectFile::TrackNotesChunk, i, SequencerScene::noteChunk(track.notes));
+    }
 }
 
 void TrackManagerDialog::saveData(QDataStream &stream)
@@ -568,6 +843,29 @@ void TrackManagerDialog::saveData(QDataStream &stream)
     m_sequencerScene->saveNotes(stream);
 }
 
+// only copying happens here; the notes' store and the envelopes' nodes are shared until they change, so they aren't even copied yet
+TrackManagerDialog::Snapshot TrackManagerDialog::snapshot() const
+{
+    Snapshot snapshot;
+
+    snapshot.globalEnvelopes.reserve(numGlobalEnvelopes);
+    for (int i = 0; i < numGlobalEnvelopes; ++i)
+        snapshot.globalEnvelopes.push_back(m_globalEnvelopes[i]);
+
+    snapshot.tracks.reserve(m_currentTracks.size());
+    for (int i = 0; i < m_currentTracks.size(); ++i)
+    {
+        Snapshot::TrackSnapshot track = {m_currentTracks[i]->menu->title(),
+                                         m_currentTracks[i]->outputPort->currentPortNumber(),
+                                         m_currentTracks[i]->trackTypeActionGroup->checkedAction()->data().toInt(),
+                                         m_currentTracks[i]->envelopeDataVector,
+                                         m_sequencerScene->noteSnapshot(i)};
+        snapshot.tracks.push_back(track);
+    }
+
+    return snapshot;
+}
+
 void TrackManagerDialog::setCurrentTrack(int track)
 {
     if (track == -1)
@@ -589,6 +887,17 @@ void TrackManagerDialog::setCurrentTrack(int track)
     refreshMIDICCEnvelopes();
 }
 
+void TrackManagerDialog::setUpRestoredTrack(int index, const QString &title, int outputPort, int trackType)
+{
+    m_allTracks[index].outputPort = m_portManager->createOutput(outputPort);
+    setUpTrackSubMenu(m_allTracks[index], title, trackType);
+    m_currentTracks.append(&m_allTracks[index]);
+
+    QListWidgetItem *item = new QListWidgetItem(m_allTracks[index].menu->title());
+    item->setFlags (item->flags() | Qt::ItemIsEditable);
+    m_trackListWidget->addItem(item);
+}
+
 void TrackManagerDialog::setUpTrackSubMenu(Track &track, const QString &title, int trackType)
 {
     track.menu = new QMenu(title);
@@ -620,3 +929,21 @@ void TrackManagerDialog::setUpTrackSubMenu(Track &track, const QString &title, i
     track.menu->addMenu(track.outputPort->menu());
     m_menu->addMenu(track.menu);
 }
+
+SequencerEventSource *TrackManagerDialog::trackEventSource(int track, double millisecondsPerTick) const
+{
+    SequencerEventMerger *merger = new SequencerEventMerger;
+    merger->addSource(new NoteEventSource(m_sequencerScene->notes(), m_sequencerScene->trackNotes(track)));
+
+    for (int j = 0; j < m_currentTracks[track]->envelopeDataVector.size(); ++j)
+    {
+        merger->addSource(new EnvelopeEventSource(&m_currentTracks[track]->envelopeDataVector[j].envelope,
+                                                  millisecondsPerTick,
+                                                  m_currentTracks[track]->envelopeDataVector[j].MIDICCNumber,
+                                                  m_currentTracks[track]->envelopeDataVector[j].MIDIChannel,
+                                                  track,
+                                                  SequencerEvent::MIDICC));
+    }
+
+    return merger;
+}
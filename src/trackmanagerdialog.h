@@ -1,44 +1,77 @@
 #ifndef TRACKMANAGERDIALOG_H
 #define TRACKMANAGERDIALOG_H
 #include "envelopedata.h"
+#include "hexsettings.h"
 #include "sequencerevent.h"
 #include "track.h"
 #include <QtWidgets/QDialog>
+#include <vector>
 
+class EditJournal;
 class EnvelopeScene;
 class MIDIPortManager;
+class ProjectFileReader;
+class ProjectFileWriter;
 class QComboBox;
 class QDataStream;
 class QGraphicsSceneContextMenuEvent;
 class QListWidget;
 class QMenu;
+class SequencerEventSource;
 class SequencerScene;
 
 class TrackManagerDialog : public QDialog
 {
 public:
+    // A copy of everything saveChunks() writes, taken on the GUI thread so
+    // that it can be encoded on another one.
+    struct Snapshot
+    {
+        struct TrackSnapshot
+        {
+            QString name;
+            int outputPort;
+            int trackType;
+            SimpleVector<EnvelopeData> envelopes;
+            NoteSnapshot notes;
+        };
+
+        std::vector<SimpleMap<unsigned int, float> > globalEnvelopes;
+        std::vector<TrackSnapshot> tracks;
+    };
+
     TrackManagerDialog(MIDIPortManager *portManager, SequencerScene *sequencerScene, EnvelopeScene *envelopeScene, QWidget *parent = 0);
     int currentTrack() const;
     QMenu *menu() const {return m_menu;}
+    int numTracks() const {return m_currentTracks.size();}
     void setCurrentTrack(int track);
     QComboBox *trackNameComboBox() const {return m_trackNameComboBox;}
 
     // meta methods
     void clear();
     SimpleVector<SequencerEvent> gatherSequencerEvents(double millisecondsPerTick) const;
+    SequencerEventSource *globalEventSource(double millisecondsPerTick) const; // the DT envelopes' events (the caller owns it)
+    SequencerEventSource *trackEventSource(int track, double millisecondsPerTick) const; // a track's notes and MIDI CC envelopes (the caller owns it)
+    bool restoreChunks(const ProjectFileReader &file); // returns false, without changing anything, if the file has no tracks or is damaged
     void restoreData(QDataStream &stream);
     void saveData(QDataStream &stream);
+    Snapshot snapshot() const;
+    static void saveChunks(const Snapshot &snapshot, ProjectFileWriter &file); // safe to call from any thread
 
     // node methods (note: global envelopes are tagged with track = -1)
     void addNode(int track, int envelope, unsigned int pos, float value);
+    void addNodes(int track, int envelope, const unsigned int *positions, const float *values, int count); // positions must be sorted
     void moveNode(int track, int envelope, int nodeIndex, unsigned int newPos, float newValue); // must not cross over any other node
     void removeNode(int track, int envelope, unsigned int pos);
+    void removeNodes(int track, int envelope, const unsigned int *positions, int count); // positions must be sorted
 
     // envelope methods
     void addMIDICCEnvelope(int track, int index, const EnvelopeData &envelopeData);
     void changeMIDICCEnvelopeData(int track, int index, unsigned char newChannel, unsigned char newMIDICCNumber);
     EnvelopeData getMIDICCEnvelope(int track, int index) const;
     void moveMIDICCEnvelope(int track, int oldIndex, int newIndex);
+    int numMIDICCEnvelopes(int track) const {return m_currentTracks[track]->envelopeDataVector.size();}
+    void setJournal(EditJournal *journal) {m_journal = journal;} // nodes are reported to it; anything else asks it to compact
     void removeMIDICCEnvelope(int track, int index);
 
     // track methods
@@ -57,13 +90,14 @@ public:
 
     void executeEnvelopeContextMenu(QGraphicsSceneContextMenuEvent *event, int indexOfClickedNode);
 
-    static const int maxNumTracks = 32;
+    static const int maxNumTracks = HexSettings::maxNumTracks;
     static const int numGlobalEnvelopes = 3;
 
 private:
     QString envelopeName(int track, int envelopeIndex) const;
     bool getChannelAndMIDICCNumber(unsigned char &channel, unsigned char &CCNumber, unsigned char defaultChannel = 0, unsigned char defaultCCNumber = 0);
     void refreshMIDICCEnvelopes();
+    void setUpRestoredTrack(int index, const QString &title, int outputPort, int trackType); // appends it to the current tracks
     void setUpTrackSubMenu(Track &track, const QString &title, int trackType);
 
     // data
@@ -82,6 +116,7 @@ private:
     MIDIPortManager *m_portManager;
     SequencerScene *m_sequencerScene;
     EnvelopeScene *m_envelopeScene;
+    EditJournal *m_journal;
 };
 
 #endif // TRACKMANAGERDIALOG_H
@@ -0,0 +1,371 @@
+#include "tracknoterenderer.h"
+#include "latticedata.h"
+#include "sequencerscene.h"
+#include <QtGui/QPainter>
+#include <QtWidgets/QStyleOptionGraphicsItem>
+#include <algorithm>
+#include <cmath>
+
+QVector<QRectF> TrackNoteRenderer::velocityBuckets[128];
+
+const double lodBaseCellWidth = 60; // ticks (a 32nd note); notes are drawn individually until this is less than a pixel
+const int maxLODLevel = 24;
+const int maxEditsBetweenPaints = 64; // past this, rebuilding once is cheaper than keeping up with each edit
+
+TrackNoteRenderer::TrackNoteRenderer(int track, const LatticeData *latticeData)
+    : track(track), latticeData(latticeData), dirty(true), longestNoteDuration(0), editsSincePaint(0)
+{
+    setFlag(ItemUsesExtendedStyleOption, true); // for exposedRect
+    setAcceptedMouseButtons(0);
+    setZValue(-HexSettings::numButtons - 1); // below the notes of the current track
+}
+
+bool TrackNoteRenderer::beginEdit()
+{
+    if (dirty)
+        return false; // it's rebuilt before it's drawn anyway
+
+    if (++editsSincePaint > maxEditsBetweenPaints)
+    {
+        invalidate();
+        return false;
+    }
+
+    return true;
+}
+
+QRectF TrackNoteRenderer::boundingRect() const
+{
+    if (dirty)
+        rebuild();
+
+    return bounds;
+}
+
+void TrackNoteRenderer::calculateVerticalBounds() const
+{
+    if (usedLanes.empty())
+        return;
+
+    double top = latticeData->buttonPositions[usedLanes[0]].y();
+    double bottom = top;
+
+    for (size_t i = 1; i < usedLanes.size(); ++i)
+    {
+        double y = latticeData->buttonPositions[usedLanes[i]].y();
+        top = qMin(top, y);
+        bottom = qMax(bottom, y);
+    }
+
+    bounds.setTop(top - .05);
+    bounds.setBottom(bottom + .05);
+}
+
+void TrackNoteRenderer::drawVelocityBuckets(QPainter *painter, const SequencerScene *sequencerScene, bool active)
+{
+    painter->setPen(Qt::NoPen);
+
+    for (int i = 0; i < 128; ++i)
+    {
+        if (velocityBuckets[i].isEmpty())
+            continue;
+
+        painter->setBrush(active ? sequencerScene->getActiveNoteBrush(i) : sequencerScene->getInactiveNoteBrush(i));
+        painter->drawRects(velocityBuckets[i].constData(), velocityBuckets[i].size());
+        velocityBuckets[i].resize(0);
+    }
+}
+
+bool TrackNoteRenderer::drawsSummary(double pixelsPerTick)
+{
+    return pixelsPerTick * lodBaseCellWidth < 1;
+}
+
+void TrackNoteRenderer::invalidate()
+{
+    if (dirty)
+        return;
+
+    prepareGeometryChange();
+    dirty = true;
+}
+
+const std::vector<TrackNoteRenderer::LODCell> &TrackNoteRenderer::lodLevel(int level) const
+{
+    // each level is built from the one below it
+    while (static_cast<int>(lodLevels.size()) <= level)
+    {
+        lodLevels.push_back(std::vector<LODCell>());
+        std::vector<LODCell> &cells = lodLevels.back();
+
+        if (lodLevels.size() == 1)
+        {
+            // mark every cell that a note touches
+            for (size_t i = 0; i < sortedNotes.size(); ++i)
+            {
+                const RenderedNote &note = sortedNotes[i];
+                int firstBucket = static_cast<int>(note.start / lodBaseCellWidth);
+                int lastBucket = qMax(firstBucket, static_cast<int>(std::ceil(note.end / lodBaseCellWidth)) - 1);
+
+                for (int bucket = firstBucket; bucket <= lastBucket; ++bucket)
+                {
+                    LODCell cell = {bucket, note.laneIndex, 1, note.velocity};
+                    cells.push_back(cell);
+                }
+            }
+        }
+        else
+        {
+            // each cell covers two cells of the level below
+            const std::vector<LODCell> &finerCells = lodLevels[lodLevels.size() - 2];
+            cells.reserve(finerCells.size());
+
+            for (size_t i = 0; i < finerCells.size(); ++i)
+            {
+                LODCell cell = {finerCells[i].bucket >> 1, finerCells[i].laneIndex, finerCells[i].count, finerCells[i].velocitySum};
+                cells.push_back(cell);
+            }
+        }
+
+        std::sort(cells.begin(), cells.end(), LODCell::compare);
+
+        // merge the cells that ended up in the same place
+        size_t numMergedCells = 0;
+        for (size_t i = 0; i < cells.size(); ++i)
+        {
+            if (numMergedCells > 0 && cells[numMergedCells - 1].bucket == cells[i].bucket && cells[numMergedCells - 1].laneIndex == cells[i].laneIndex)
+            {
+                cells[numMergedCells - 1].count += cells[i].count;
+                cells[numMergedCells - 1].velocitySum += cells[i].velocitySum;
+            }
+            else
+            {
+                cells[numMergedCells++] = cells[i];
+            }
+        }
+
+        cells.resize(numMergedCells);
+    }
+
+    return lodLevels[level];
+}
+
+void TrackNoteRenderer::noteAdded(const NoteRecord &record)
+{
+    if (!beginEdit())
+        return;
+
+    RenderedNote note = {record.start, record.start + record.duration, record.laneIndex, record.velocity};
+    sortedNotes.insert(std::upper_bound(sortedNotes.begin(), sortedNotes.end(), note, RenderedNote::compare), note);
+    longestNoteDuration = qMax(longestNoteDuration, record.duration);
+    updateLODCells(note, 1);
+
+    bool newLane = (laneNoteCounts[note.laneIndex]++ == 0);
+    if (newLane)
+        usedLanes.insert(std::lower_bound(usedLanes.begin(), usedLanes.end(), note.laneIndex), note.laneIndex);
+
+    // the bounds only grow here, and are only shrunk by a rebuild
+    double left = (sortedNotes.size() == 1) ? note.start : qMin(bounds.left(), note.start);
+    double right = (sortedNotes.size() == 1) ? note.end : qMax(bounds.right(), note.end);
+
+    if (!newLane && left == bounds.left() && right == bounds.right())
+        return;
+
+    prepareGeometryChange();
+    bounds.setLeft(left);
+    bounds.setRight(right);
+
+    if (newLane)
+        calculateVerticalBounds();
+}
+
+void TrackNoteRenderer::noteRemoved(const NoteRecord &record)
+{
+    if (!beginEdit())
+        return;
+
+    RenderedNote note = {record.start, record.start + record.duration, record.laneIndex, record.velocity};
+    std::vector<RenderedNote>::iterator it = std::lower_bound(sortedNotes.begin(), sortedNotes.end(), note, RenderedNote::compare);
+    while (it != sortedNotes.end() && it->start == note.start && !(*it == note))
+        ++it;
+
+    if (it == sortedNotes.end() || !(*it == note))
+    {
+        invalidate(); // it wasn't where it should have been
+        return;
+    }
+
+    sortedNotes.erase(it);
+    updateLODCells(note, -1);
+
+    // the horizontal bounds are left as they are, which only costs painting a little more than needed
+    if (--laneNoteCounts[note.laneIndex] == 0)
+    {
+        usedLanes.erase(std::lower_bound(usedLanes.begin(), usedLanes.end(), note.laneIndex));
+        prepareGeometryChange();
+        calculateVerticalBounds();
+    }
+}
+
+void TrackNoteRenderer::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
+{
+    const SequencerScene *sequencerScene = static_cast<SequencerScene*>(scene());
+
+    // notes in the current track have their own items, as do all notes when batching is off, unless there are too many of them
+    if (sequencerScene->trackUsesItems(track))
+        return;
+
+    if (dirty)
+        rebuild();
+
+    editsSincePaint = 0;
+    const QRectF &rect = option->exposedRect;
+    double pixelsPerTick = painter->worldTransform().m11();
+
+    if (drawsSummary(pixelsPerTick))
+    {
+        paintLOD(painter, rect, pixelsPerTick);
+        return;
+    }
+
+    double rectRight = rect.right();
+    double rectTop = rect.top() - .05;
+    double rectBottom = rect.bottom() + .05;
+
+    // no note starting before this can reach the exposed rect
+    RenderedNote firstPossibleNote = {rect.left() - longestNoteDuration, 0, 0, 0};
+    std::vector<RenderedNote>::const_iterator note = std::lower_bound(sortedNotes.begin(), sortedNotes.end(), firstPossibleNote, RenderedNote::compare);
+
+    for (; note != sortedNotes.end() && note->start < rectRight; ++note)
+    {
+        if (note->end < rect.left())
+            continue;
+
+        double y = latticeData->buttonPositions[note->laneIndex].y();
+
+        if (y < rectTop || y > rectBottom)
+            continue;
+
+        velocityBuckets[note->velocity].append(QRectF(note->start, y - .05, note->end - note->start, .1));
+    }
+
+    drawVelocityBuckets(painter, sequencerScene, sequencerScene->currentTrack() == track);
+}
+
+void TrackNoteRenderer::paintLOD(QPainter *painter, const QRectF &rect, double pixelsPerTick) const
+{
+    // use the finest level whose cells are at least a pixel wide
+    int level = 0;
+    while (level < maxLODLevel && lodBaseCellWidth * (1 << level) * pixelsPerTick < 1)
+        ++level;
+
+    const std::vector<LODCell> &cells = lodLevel(level);
+    double cellWidth = lodBaseCellWidth * (1 << level);
+    int lastBucket = static_cast<int>(rect.right() / cellWidth);
+    double rectTop = rect.top() - .05;
+    double rectBottom = rect.bottom() + .05;
+
+    std::vector<LODCell>::const_iterator cell = std::lower_bound(cells.begin(), cells.end(), static_cast<int>(rect.left() / cellWidth), LODCell::isBefore);
+
+    for (; cell != cells.end() && cell->bucket <= lastBucket; ++cell)
+    {
+        double y = latticeData->buttonPositions[cell->laneIndex].y();
+
+        if (y < rectTop || y > rectBottom)
+            continue;
+
+        velocityBuckets[cell->velocity()].append(QRectF(cell->bucket * cellWidth, y - .05, cellWidth, .1));
+    }
+
+    const SequencerScene *sequencerScene = static_cast<SequencerScene*>(scene());
+    drawVelocityBuckets(painter, sequencerScene, sequencerScene->currentTrack() == track);
+}
+
+void TrackNoteRenderer::rebuild() const
+{
+    dirty = false;
+    sortedNotes.clear();
+    usedLanes.clear();
+    laneNoteCounts.assign(HexSettings::numButtons, 0);
+    lodLevels.clear();
+    longestNoteDuration = 0;
+    editsSincePaint = 0;
+    bounds = QRectF();
+
+    if (scene() == NULL)
+        return;
+
+    const SequencerScene *sequencerScene = static_cast<SequencerScene*>(scene());
+    const std::vector<NoteID> &notes = sequencerScene->trackNotes(track);
+
+    if (notes.empty())
+        return;
+
+    sortedNotes.reserve(notes.size());
+    double left = sequencerScene->note(notes[0]).start;
+    double right = left;
+
+    for (size_t i = 0; i < notes.size(); ++i)
+    {
+        const NoteRecord &record = sequencerScene->note(notes[i]);
+        RenderedNote note = {record.start, record.start + record.duration, record.laneIndex, record.velocity};
+        sortedNotes.push_back(note);
+        ++laneNoteCounts[record.laneIndex];
+
+        left = qMin(left, note.start);
+        right = qMax(right, note.end);
+        longestNoteDuration = qMax(longestNoteDuration, record.duration);
+    }
+
+    for (int i = 0; i < HexSettings::numButtons; ++i)
+    {
+        if (laneNoteCounts[i] > 0)
+            usedLanes.push_back(i);
+    }
+
+    std::sort(sortedNotes.begin(), sortedNotes.end(), RenderedNote::compare);
+    bounds = QRectF(left, 0, right - left, 0);
+    calculateVerticalBounds();
+}
+
+void TrackNoteRenderer::updateLODCells(const RenderedNote &note, int sign)
+{
+    int firstBucket = static_cast<int>(note.start / lodBaseCellWidth);
+    int lastBucket = qMax(firstBucket, static_cast<int>(std::ceil(note.end / lodBaseCellWidth)) - 1);
+
+    for (int level = 0; level < static_cast<int>(lodLevels.size()); ++level)
+    {
+        std::vector<LODCell> &cells = lodLevels[level];
+
+        for (int bucket = firstBucket >> level; bucket <= lastBucket >> level; ++bucket)
+        {
+            // a coarser cell counts each of the finest cells of the note that fall in it
+            int count = qMin(lastBucket, ((bucket + 1) << level) - 1) - qMax(firstBucket, bucket << level) + 1;
+            LODCell change = {bucket, note.laneIndex, count * sign, static_cast<qint64>(count) * note.velocity * sign};
+            std::vector<LODCell>::iterator cell = std::lower_bound(cells.begin(), cells.end(), change, LODCell::compare);
+
+            if (cell == cells.end() || LODCell::compare(change, *cell))
+            {
+                if (sign > 0)
+                    cells.insert(cell, change);
+
+                continue;
+            }
+
+            cell->count += change.count;
+            cell->velocitySum += change.velocitySum;
+
+            if (cell->count <= 0)
+                cells.erase(cell);
+        }
+    }
+}
+
+void TrackNoteRenderer::updateLaneBounds()
+{
+    if (dirty)
+        return; // the bounds are recalculated when rebuilt anyway
+
+    prepareGeometryChange();
+    calculateVerticalBounds();
+}
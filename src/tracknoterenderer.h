@@ -0,0 +1,90 @@
+#ifndef TRACKNOTERENDERER_H
+#define TRACKNOTERENDERER_H
+#include <QtCore/QVector>
+#include <QtWidgets/QGraphicsItem>
+#include <vector>
+
+class SequencerScene;
+struct LatticeData;
+struct NoteRecord;
+
+// Draws all of a track's notes as a single item, so that tracks that aren't
+// being edited (or any track, once there are too many notes in view to give
+// each one an item) don't cost the scene one item per note. The notes are copied
+// into an array sorted by start time whenever the track changes, which lets
+// paint() find the notes in the exposed rect quickly and draw them with one
+// drawRects() call per velocity.
+//
+// Once the view is zoomed out so far that notes are narrower than a pixel,
+// paint() draws a level-of-detail summary instead: a pyramid of lane/time
+// cells, each marking that some note covers it, where every level's cells
+// are twice as wide as the level below. The level whose cells are about a
+// pixel wide is drawn, so a fully zoomed-out track costs the same to paint
+// however many notes it has.
+//
+// Adding or removing a few notes only touches the copies and the cells that
+// those notes cover. Past a handful of edits between paints, the renderer
+// just rebuilds everything the next time it's drawn.
+class TrackNoteRenderer : public QGraphicsItem
+{
+public:
+    TrackNoteRenderer(int track, const LatticeData *latticeData);
+    QRectF boundingRect() const;
+    void invalidate(); // call whenever notes in the track are added, removed, or changed in bulk
+    void noteAdded(const NoteRecord &note); // call when a single note is added or changed (removing it as it was first)
+    void noteRemoved(const NoteRecord &note);
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *);
+    void updateLaneBounds(); // call whenever the note lanes move; this is O(lanes used by the track)
+
+    static bool drawsSummary(double pixelsPerTick); // whether notes are too narrow at this zoom to be drawn individually
+
+private:
+    struct RenderedNote
+    {
+        static bool compare(const RenderedNote &a, const RenderedNote &b) {return a.start < b.start;}
+        bool operator==(const RenderedNote &other) const {return start == other.start && end == other.end && laneIndex == other.laneIndex && velocity == other.velocity;}
+
+        double start;
+        double end;
+        unsigned short laneIndex;
+        unsigned char velocity;
+    };
+
+    struct LODCell
+    {
+        static bool compare(const LODCell &a, const LODCell &b) {return (a.bucket != b.bucket) ? a.bucket < b.bucket : a.laneIndex < b.laneIndex;}
+        static bool isBefore(const LODCell &cell, int bucket) {return cell.bucket < bucket;}
+
+        int velocity() const {return static_cast<int>(velocitySum / count);} // the average, weighted by how much of the cell each note covers
+
+        int bucket; // which stretch of time the cell covers, in units of the level's cell width
+        unsigned short laneIndex;
+        int count; // how many of the finest cells that notes cover fall in this one; a note may count more than once
+        qint64 velocitySum;
+    };
+
+    bool beginEdit(); // returns false if the edit should just be left to the next rebuild
+    void calculateVerticalBounds() const;
+    static void drawVelocityBuckets(QPainter *painter, const SequencerScene *sequencerScene, bool active);
+    const std::vector<LODCell> &lodLevel(int level) const;
+    void paintLOD(QPainter *painter, const QRectF &rect, double pixelsPerTick) const;
+    void rebuild() const;
+    void updateLODCells(const RenderedNote &note, int sign); // adds (1) or removes (-1) a note's share of each built level
+
+    // these are initialized in the initializer list
+    int track;
+    const LatticeData *latticeData;
+    mutable bool dirty;
+    mutable double longestNoteDuration; // only ever grows until the next rebuild
+    mutable int editsSincePaint;
+
+    mutable QRectF bounds;
+    mutable std::vector<RenderedNote> sortedNotes;
+    mutable std::vector<unsigned short> usedLanes; // the notes' y positions are only looked up when needed
+    mutable std::vector<int> laneNoteCounts; // so usedLanes can be kept up to date as notes come and go
+    mutable std::vector<std::vector<LODCell> > lodLevels; // built as the levels are needed
+
+    static QVector<QRectF> velocityBuckets[128]; // reused between paints
+};
+
+#endif